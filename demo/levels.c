@@ -0,0 +1,417 @@
+#include "levels.h"
+#include "map_builder.h"
+#include "map_reader.h"
+#include <stdlib.h>
+#include <stdio.h>
+
+static level_data *demo_level;
+static light *dynamic_light;
+
+/* How far the dynamic light of each level moves up and down */
+static const float light_movement_ranges[DEMO_LEVELS_COUNT] = { 48, 48, 400, 48, 24, 48 };
+
+static void create_demo_level();
+static void create_grid_level();
+static void create_big_one();
+static void create_semi_intersecting_sectors();
+static void create_crossing_and_splitting_sectors();
+static void create_large_sky();
+
+level_data*
+demo_levels_create(int n, light **light_out, float *light_movement_range_out)
+{
+  dynamic_light = NULL;
+
+  switch (n) {
+  case 1: create_demo_level(); break;
+  case 2: create_big_one(); break;
+  case 3: create_semi_intersecting_sectors(); break;
+  case 4: create_crossing_and_splitting_sectors(); break;
+  case 5: create_large_sky(); break;
+  default: create_grid_level(); break;
+  }
+
+  if (light_out) {
+    *light_out = dynamic_light;
+  }
+
+  if (light_movement_range_out) {
+    *light_movement_range_out = light_movement_ranges[n > 0 && n < DEMO_LEVELS_COUNT ? n : 0];
+  }
+
+  return demo_level;
+}
+
+level_data*
+demo_levels_load(int n, const char *path, light **light_out, float *light_movement_range_out)
+{
+  level_data *level = level_data_load(path);
+
+  if (!level) {
+    level = demo_levels_create(n, light_out, light_movement_range_out);
+    level_data_save(level, path);
+    return level;
+  }
+
+  /* Levels have at most one light, which is the one that moves */
+  if (light_out) {
+    *light_out = level->lights_count ? level_data_light_at(level, 0) : NULL;
+  }
+
+  if (light_movement_range_out) {
+    *light_movement_range_out = light_movement_ranges[n > 0 && n < DEMO_LEVELS_COUNT ? n : 0];
+  }
+
+  return level;
+}
+
+level_data*
+demo_levels_load_map(const char *path)
+{
+  map_reader_error error;
+  level_data *level;
+  uint32_t magic = 0;
+  FILE *file = fopen(path, "rb");
+
+  if (!file) {
+    fprintf(stderr, "%s: Could not open the file\n", path);
+    return NULL;
+  }
+
+  if (fread(&magic, sizeof(magic), 1, file) != 1) {
+    magic = 0;
+  }
+
+  fclose(file);
+
+  /* A text map can't start with the magic, its first token is a keyword */
+  if (magic == LEVEL_FILE_MAGIC) {
+    if (!(level = level_data_load(path))) {
+      fprintf(stderr, "%s: Compiled by a build with another struct layout, or corrupt\n", path);
+    }
+  } else if (!(level = map_reader_load(path, &error))) {
+    fprintf(stderr, "%s:%u: %s\n", path, error.line, error.message);
+  }
+
+  return level;
+}
+
+static void create_grid_level()
+{
+  const int w = 24;
+  const int h = 24;
+  const int size = 256;
+
+  register int x, y, c, f;
+
+  map_builder builder = { 0 };
+
+  srand(1311858591);
+
+  for (y = 0; y < h; ++y) {
+    for (x = 0; x < w; ++x) {
+      if (rand() % 20 == 5) {
+        c = f = 0;
+      } else {
+        f = 8 * (rand() % 16);
+        c = 1024 - 32 * (rand() % 24);
+      }
+
+      map_builder_add_polygon(&builder, f, c, 1.f, WALLTEX(SMALL_BRICKS_TEXTURE), FLOOR_TEXTURE, CEILING_TEXTURE, VERTICES(
+        VEC2F(x*size, y*size),
+        VEC2F(x*size + size, y*size),
+        VEC2F(x*size + size, y*size + size),
+        VEC2F(x*size, y*size + size)
+      ));
+    }
+  }
+
+  demo_level = map_builder_build(&builder);
+
+  // TODO: Vertices could be moved real-time but related linedefs need to be updated too
+  /*for (x = 0; x < demo_level->vertices_count; ++x) {
+    demo_level->vertices[x].point.x += (-24 + rand() % 48);
+    demo_level->vertices[x].point.y += (-24 + rand() % 48);
+  }*/
+  
+  map_builder_free(&builder);
+}
+
+static void create_demo_level()
+{
+  map_builder builder = { 0 };
+
+  map_builder_add_polygon(&builder, 0, 144, 0.8f, WALLTEX(STONEWALL_TEXTURE), FLOOR_TEXTURE, CEILING_TEXTURE, VERTICES(
+    VEC2F(0, 0),
+    VEC2F(400, 0),
+    VEC2F(400, 400),
+    VEC2F(200, 300),
+    VEC2F(0, 400)
+  ));
+
+  map_builder_add_polygon(&builder, -32, 176, 1.1f, WALLTEX(STONEWALL_TEXTURE), FLOOR_TEXTURE, TEXTURE_NONE, VERTICES(
+    VEC2F(50, 50),
+    VEC2F(50, 200),
+    VEC2F(200, 200),
+    VEC2F(200, 50)
+  ));
+
+  map_builder_add_polygon(&builder, 128, 128, 1.f, WALLTEX(WOOD_TEXTURE), WOOD_TEXTURE, WOOD_TEXTURE, VERTICES(
+    VEC2F(100, 100),
+    VEC2F(125, 100),
+    VEC2F(125, 125),
+    VEC2F(100, 125)
+  ));
+
+  map_builder_add_polygon(&builder, 32, 128, 0.5f, WALLTEX(STONEWALL_TEXTURE), FLOOR_TEXTURE, CEILING_TEXTURE, VERTICES(
+    VEC2F(0, 0),
+    VEC2F(400, 0),
+    VEC2F(300, -256),
+    VEC2F(0, -128)
+  ));
+
+  map_builder_add_polygon(&builder, -128, 256, 0.25f, WALLTEX(STONEWALL_TEXTURE), FLOOR_TEXTURE, CEILING_TEXTURE, VERTICES(
+    VEC2F(400, 400),
+    VEC2F(200, 300),
+    VEC2F(100, 1000),
+    VEC2F(500, 1000)
+  ));
+
+  map_builder_add_polygon(&builder, 0, 214, 1.5f, WALLTEX(STONEWALL_TEXTURE), FLOOR_TEXTURE, CEILING_TEXTURE, VERTICES(
+    VEC2F(275, 500),
+    VEC2F(325, 500),
+    VEC2F(325, 700),
+    VEC2F(275, 700)
+  ));
+
+  demo_level = map_builder_build(&builder);
+  demo_level->sky_texture = SKY_TEXTURE;
+
+  /* Configure some transparent textures */
+  linedef_set_middle_texture(
+    level_data_find_linedef(demo_level, VEC2F(0, 0), VEC2F(400, 0)),
+    METAL_BARS
+  );
+
+  /* Some billboard sprites */
+  level_data_add_sprite(demo_level, VEC3F(300, 100, 0), 32, 64, METAL_BARS);
+  level_data_add_sprite(demo_level, VEC3F(300, 200, 0), 32, 64, METAL_BARS);
+  level_data_add_sprite(demo_level, VEC3F(300, 800, -128), 48, 96, METAL_GRATING);
+
+  map_builder_free(&builder);
+}
+
+static void create_big_one()
+{
+  map_builder builder = { 0 };
+
+  map_builder_add_polygon(&builder, 0, 2048, 0.25f, WALLTEX(LARGE_BRICKS_TEXTURE), FLOOR_TEXTURE, CEILING_TEXTURE, VERTICES(
+    VEC2F(0, 0),
+    VEC2F(6144, 0),
+    VEC2F(6144, 6144),
+    VEC2F(0, 6144)
+  ));
+
+  const int w = 20;
+  const int h = 20;
+  const int size = 256;
+
+  register int x, y, c, f;
+
+  for (y = 0; y < h; ++y) {
+    for (x = 0; x < w; ++x) {
+      if (rand() % 20 == 5) {
+        c = f = 0;
+      } else {
+        f = 256 + 8 * (rand() % 16);
+        c = 1440 - 32 * (rand() % 24);
+      }
+
+      map_builder_add_polygon(&builder, f, c, 0.5f, WALLTEX(LARGE_BRICKS_TEXTURE), FLOOR_TEXTURE, CEILING_TEXTURE, VERTICES(
+        VEC2F(512+x*size,        512+y*size),
+        VEC2F(512+x*size + size, 512+y*size),
+        VEC2F(512+x*size + size, 512+y*size + size),
+        VEC2F(512+x*size,        512+y*size + size)
+      ));
+    }
+  }
+
+  demo_level = map_builder_build(&builder);
+
+  dynamic_light = level_data_add_light(demo_level, VEC3F(460, 460, 512), 1024, 1.0f);
+
+  map_builder_free(&builder);
+}
+
+static void create_semi_intersecting_sectors()
+{
+  const float base_light = 0.25f;
+
+  map_builder builder = { 0 };
+
+  map_builder_add_polygon(&builder, 0, 128, base_light, WALLTEX(SMALL_BRICKS_TEXTURE), FLOOR_TEXTURE, CEILING_TEXTURE, VERTICES(
+    VEC2F(0, 0),
+    VEC2F(500, 0),
+    VEC2F(500, 500),
+    VEC2F(0, 500)
+  ));
+
+  map_builder_add_polygon(&builder, 40, 86, base_light, WALLTEX(SMALL_BRICKS_TEXTURE), FLOOR_TEXTURE, CEILING_TEXTURE, VERTICES(
+    VEC2F(0, 200),
+    VEC2F(50, 200),
+    VEC2F(50, 400),
+    VEC2F(0, 400)
+  ));
+
+  map_builder_add_polygon(&builder, -20, 192, 0.35, WALLTEX(SMALL_BRICKS_TEXTURE), DIRT_TEXTURE, TEXTURE_NONE, VERTICES(
+    VEC2F(250, 250),
+    VEC2F(2000, 250),
+    VEC2F(2000, 350),
+    VEC2F(250, 350)
+  ));
+
+  map_builder_add_polygon(&builder, 0, 86, base_light, WALLTEX(SMALL_BRICKS_TEXTURE), FLOOR_TEXTURE, SMALL_BRICKS_TEXTURE, VERTICES(
+    VEC2F(512, 350),
+    VEC2F(640, 350),
+    VEC2F(640, 364),
+    VEC2F(512, 364)
+  ));
+
+  map_builder_add_polygon(&builder, 0, 128, base_light, WALLTEX(LARGE_BRICKS_TEXTURE), FLOOR_TEXTURE, CEILING_TEXTURE, VERTICES(
+    VEC2F(512, 364),
+    VEC2F(640, 364),
+    VEC2F(640, 480),
+    VEC2F(512, 480)
+  ));
+
+  map_builder_add_polygon(&builder, 56, 96, base_light, WALLTEX(WOOD_TEXTURE), WOOD_TEXTURE, WOOD_TEXTURE, VERTICES(
+    VEC2F(240, 240),
+    VEC2F(260, 240),
+    VEC2F(260, 260),
+    VEC2F(240, 260)
+  ));
+
+  map_builder_add_polygon(&builder, 56, 88, base_light, WALLTEX(WOOD_TEXTURE), WOOD_TEXTURE, WOOD_TEXTURE, VERTICES(
+    VEC2F(240, 340),
+    VEC2F(260, 340),
+    VEC2F(260, 360),
+    VEC2F(240, 360)
+  ));
+
+  map_builder_add_polygon(&builder, 56, 96, base_light, WALLTEX(WOOD_TEXTURE), WOOD_TEXTURE, WOOD_TEXTURE, VERTICES(
+    VEC2F(400, 350),
+    VEC2F(420, 350),
+    VEC2F(420, 370),
+    VEC2F(400, 370)
+  ));
+
+  map_builder_add_polygon(&builder, 16, 96, base_light, WALLTEX(WOOD_TEXTURE), WOOD_TEXTURE, WOOD_TEXTURE, VERTICES(
+    VEC2F(400, 250),
+    VEC2F(420, 250),
+    VEC2F(420, 270),
+    VEC2F(400, 270)
+  ));
+
+  map_builder_add_polygon(&builder, 20, 108, base_light, WALLTEX(SMALL_BRICKS_TEXTURE), FLOOR_TEXTURE, CEILING_TEXTURE, VERTICES(
+    VEC2F(240, 250),
+    VEC2F(250, 260),
+    VEC2F(250, 350),
+    VEC2F(240, 350)
+  ));
+
+  map_builder_add_polygon(&builder, -128, 256, base_light, WALLTEX(SMALL_BRICKS_TEXTURE), FLOOR_TEXTURE, CEILING_TEXTURE, VERTICES(
+    VEC2F(-100, 500),
+    VEC2F(100, 100),
+    VEC2F(100, -100),
+    VEC2F(-100, -100)
+  ));
+
+  demo_level = map_builder_build(&builder);
+  demo_level->sky_texture = SKY_TEXTURE;
+
+  dynamic_light = level_data_add_light(demo_level, VEC3F(300, 400, 64), 300, 1.0f);
+
+  /* Configure some transparent textures */
+  linedef_set_middle_texture(
+    level_data_find_linedef(demo_level, VEC2F(512, 364), VEC2F(640, 364)),
+    METAL_GRATING
+  );
+
+  map_builder_free(&builder);
+}
+
+static void
+create_crossing_and_splitting_sectors()
+{
+  map_builder builder = { 0 };
+
+  map_builder_add_polygon(&builder, 0, 128, 0.1f, WALLTEX(LARGE_BRICKS_TEXTURE), FLOOR_TEXTURE, CEILING_TEXTURE, VERTICES(
+    VEC2F(-500, 0),
+    VEC2F(1000, 0),
+    VEC2F(1000, 100),
+    VEC2F(-500, 100)
+  ));
+
+  /* This sector will split the first one so you end up with 3 sectors */
+  map_builder_add_polygon(&builder, -32, 96, 0.1f, WALLTEX(LARGE_BRICKS_TEXTURE), FLOOR_TEXTURE, CEILING_TEXTURE, VERTICES(
+    VEC2F(225, -250),
+    VEC2F(325, -250),
+    VEC2F(325, 250),
+    VEC2F(225, 250)
+  ));
+
+  demo_level = map_builder_build(&builder);
+
+  dynamic_light = level_data_add_light(demo_level, VEC3F(250, 50, 50), 200, 0.5f);
+
+  map_builder_free(&builder);
+}
+
+static void
+create_large_sky()
+{
+  map_builder builder = { 0 };
+
+  /* First area */
+  map_builder_add_polygon(&builder, 0, 256, 0.75f, WALLTEX(LARGE_BRICKS_TEXTURE), FLOOR_TEXTURE, TEXTURE_NONE, VERTICES(
+    VEC2F(-500, -500),
+    VEC2F(500, -500),
+    VEC2F(500, 500),
+    VEC2F(-500, 500)
+  ));
+
+  map_builder_add_polygon(&builder, 32, 512, 1.f, WALLTEX(LARGE_BRICKS_TEXTURE), FLOOR_TEXTURE, TEXTURE_NONE, VERTICES(
+    VEC2F(-100, -100),
+    VEC2F(100, -100),
+    VEC2F(100, 100),
+    VEC2F(-100, 100)
+  ));
+
+  map_builder_add_polygon(&builder, 192, 256, 1.f, WALLTEX(WOOD_TEXTURE), WOOD_TEXTURE, WOOD_TEXTURE, VERTICES(
+    VEC2F(-10, -10),
+    VEC2F(10, -10),
+    VEC2F(10, 10),
+    VEC2F(-10, 10)
+  ));
+
+  /* Second area */
+  map_builder_add_polygon(&builder, 0, 256, 0.75f, WALLTEX(LARGE_BRICKS_TEXTURE), GRASS_TEXTURE, TEXTURE_NONE, VERTICES(
+    VEC2F(1000, -500),
+    VEC2F(2000, -500),
+    VEC2F(2000, 500),
+    VEC2F(1000, 500)
+  ));
+
+  /* Corridor between them */
+  map_builder_add_polygon(&builder, 32, 128, 0.25f, WALLTEX(LARGE_BRICKS_TEXTURE), FLOOR_TEXTURE, CEILING_TEXTURE, VERTICES(
+    VEC2F(500, -50),
+    VEC2F(1000, -50),
+    VEC2F(1000, 50),
+    VEC2F(500, 50)
+  ));
+
+  demo_level = map_builder_build(&builder);
+  demo_level->sky_texture = SKY_TEXTURE;
+
+  map_builder_free(&builder);
+}
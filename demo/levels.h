@@ -0,0 +1,43 @@
+#ifndef RAYCAST_DEMO_LEVELS_INCLUDED
+#define RAYCAST_DEMO_LEVELS_INCLUDED
+
+#include "level_data.h"
+
+#define SMALL_BRICKS_TEXTURE 0
+#define LARGE_BRICKS_TEXTURE 1
+#define FLOOR_TEXTURE 2
+#define CEILING_TEXTURE 3
+#define WOOD_TEXTURE 4
+#define SKY_TEXTURE 5
+#define METAL_GRATING 6
+#define METAL_BARS 7
+#define GRASS_TEXTURE 8
+#define DIRT_TEXTURE 9
+#define STONEWALL_TEXTURE 10
+
+#define DEMO_LEVELS_COUNT 6
+
+/*
+ * Builds demo level 'n' (the grid level if out of range). Levels with a
+ * light meant to be moved around give it in 'dynamic_light' along with how
+ * far it should move, others give NULL.
+ */
+level_data*
+demo_levels_create(int n, light **dynamic_light, float *light_movement_range);
+
+/*
+ * Like demo_levels_create, but loads the level compiled into 'path' if
+ * there is one. Otherwise the level is built and compiled there for the
+ * next time, so delete the file after changing the level.
+ */
+level_data*
+demo_levels_load(int n, const char *path, light **dynamic_light, float *light_movement_range);
+
+/*
+ * Loads a compiled level if the file starts with the level file magic,
+ * otherwise builds it as a text map. Prints why it couldn't to stderr.
+ */
+level_data*
+demo_levels_load_map(const char *path);
+
+#endif
@@ -2,7 +2,7 @@
 #include "renderer.h"
 #include "camera.h"
 #include "level_data.h"
-#include "map_builder.h"
+#include "levels.h"
 #include <SDL3/SDL.h>
 #include <SDL3/SDL_main.h>
 #include <SDL3/SDL_render.h>
@@ -13,25 +13,15 @@
 #include <string.h>
 #include <stdio.h>
 
-#define SMALL_BRICKS_TEXTURE 0
-#define LARGE_BRICKS_TEXTURE 1
-#define FLOOR_TEXTURE 2
-#define CEILING_TEXTURE 3
-#define WOOD_TEXTURE 4
-#define SKY_TEXTURE 5
-#define METAL_GRATING 6
-#define METAL_BARS 7
-#define GRASS_TEXTURE 8
-#define DIRT_TEXTURE 9
-#define STONEWALL_TEXTURE 10
-
 SDL_Window* window = NULL;
 SDL_Renderer *sdl_renderer = NULL;
 SDL_Texture *texture = NULL;
 
 static renderer rend;
+static renderer_view view;
 static camera cam;
 static level_data *demo_level = NULL;
+static const char *map_path = NULL;
 static light *dynamic_light = NULL;
 static float light_z, light_movement_range = 48;
 static uint64_t last_ticks;
@@ -49,12 +39,6 @@ static struct {
   float forward, turn, raise, pitch;
 } movement = { 0 };
 
-static void create_demo_level();
-static void create_grid_level();
-static void create_big_one();
-static void create_semi_intersecting_sectors();
-static void create_crossing_and_splitting_sectors();
-static void create_large_sky();
 static void load_level(int);
 static void process_camera_movement(const float delta_time);
 
@@ -79,6 +63,9 @@ SDL_AppResult SDL_AppInit(void **appstate, int argc, char *argv[])
   for (i = 1; i < argc; ++i) {
     if (!strcmp(argv[i], "-level")) {
       level = atoi(argv[i+1]);
+    } else if (!strcmp(argv[i], "-map")) {
+      map_path = argv[i+1];
+      level = -1;
     } else if (!strcmp(argv[i], "-f") || !strcmp(argv[i], "-fullscreen")) {
       fullscreen = true;
     } else if (!strcmp(argv[i], "-s") || !strcmp(argv[i], "-scale")) {
@@ -105,6 +92,7 @@ SDL_AppResult SDL_AppInit(void **appstate, int argc, char *argv[])
   SDL_SetRenderVSync(sdl_renderer, 1);
 
   renderer_init(&rend, VEC2I(initial_window_width / scale, initial_window_height / scale));
+  renderer_view_init(&view);
 
   if (!rend.buffer) {
     return -1;
@@ -139,6 +127,7 @@ SDL_AppResult SDL_AppInit(void **appstate, int argc, char *argv[])
 
 void SDL_AppQuit(void *appstate, SDL_AppResult result)
 {
+  renderer_view_destroy(&view);
   renderer_destroy(&rend);
 }
 
@@ -272,7 +261,7 @@ SDL_AppIterate(void *userdata)
   }
 
   process_camera_movement(delta_time);
-  renderer_draw(&rend, &cam);
+  renderer_draw(&rend, &view, &cam);
 
   SDL_UpdateTexture(texture, NULL, rend.buffer, rend.buffer_size.x*sizeof(pixel_type));
 
@@ -339,343 +328,25 @@ static void process_camera_movement(const float delta_time)
   }
 }
 
-static void create_grid_level()
-{
-  const int w = 24;
-  const int h = 24;
-  const int size = 256;
-
-  register int x, y, c, f;
-
-  map_builder builder = { 0 };
-
-  srand(1311858591);
-
-  for (y = 0; y < h; ++y) {
-    for (x = 0; x < w; ++x) {
-      if (rand() % 20 == 5) {
-        c = f = 0;
-      } else {
-        f = 8 * (rand() % 16);
-        c = 1024 - 32 * (rand() % 24);
-      }
-
-      map_builder_add_polygon(&builder, f, c, 1.f, WALLTEX(SMALL_BRICKS_TEXTURE), FLOOR_TEXTURE, CEILING_TEXTURE, VERTICES(
-        VEC2F(x*size, y*size),
-        VEC2F(x*size + size, y*size),
-        VEC2F(x*size + size, y*size + size),
-        VEC2F(x*size, y*size + size)
-      ));
-    }
-  }
-
-  demo_level = map_builder_build(&builder);
-
-  // TODO: Vertices could be moved real-time but related linedefs need to be updated too
-  /*for (x = 0; x < demo_level->vertices_count; ++x) {
-    demo_level->vertices[x].point.x += (-24 + rand() % 48);
-    demo_level->vertices[x].point.y += (-24 + rand() % 48);
-  }*/
-  
-  map_builder_free(&builder);
-}
-
-static void create_demo_level()
-{
-  map_builder builder = { 0 };
-
-  map_builder_add_polygon(&builder, 0, 144, 0.8f, WALLTEX(STONEWALL_TEXTURE), FLOOR_TEXTURE, CEILING_TEXTURE, VERTICES(
-    VEC2F(0, 0),
-    VEC2F(400, 0),
-    VEC2F(400, 400),
-    VEC2F(200, 300),
-    VEC2F(0, 400)
-  ));
-
-  map_builder_add_polygon(&builder, -32, 176, 1.1f, WALLTEX(STONEWALL_TEXTURE), FLOOR_TEXTURE, TEXTURE_NONE, VERTICES(
-    VEC2F(50, 50),
-    VEC2F(50, 200),
-    VEC2F(200, 200),
-    VEC2F(200, 50)
-  ));
-
-  map_builder_add_polygon(&builder, 128, 128, 1.f, WALLTEX(WOOD_TEXTURE), WOOD_TEXTURE, WOOD_TEXTURE, VERTICES(
-    VEC2F(100, 100),
-    VEC2F(125, 100),
-    VEC2F(125, 125),
-    VEC2F(100, 125)
-  ));
-
-  map_builder_add_polygon(&builder, 32, 128, 0.5f, WALLTEX(STONEWALL_TEXTURE), FLOOR_TEXTURE, CEILING_TEXTURE, VERTICES(
-    VEC2F(0, 0),
-    VEC2F(400, 0),
-    VEC2F(300, -256),
-    VEC2F(0, -128)
-  ));
-
-  map_builder_add_polygon(&builder, -128, 256, 0.25f, WALLTEX(STONEWALL_TEXTURE), FLOOR_TEXTURE, CEILING_TEXTURE, VERTICES(
-    VEC2F(400, 400),
-    VEC2F(200, 300),
-    VEC2F(100, 1000),
-    VEC2F(500, 1000)
-  ));
-
-  map_builder_add_polygon(&builder, 0, 214, 1.5f, WALLTEX(STONEWALL_TEXTURE), FLOOR_TEXTURE, CEILING_TEXTURE, VERTICES(
-    VEC2F(275, 500),
-    VEC2F(325, 500),
-    VEC2F(325, 700),
-    VEC2F(275, 700)
-  ));
-
-  demo_level = map_builder_build(&builder);
-  demo_level->sky_texture = SKY_TEXTURE;
-
-  /* Configure some transparent textures */
-  linedef_set_middle_texture(
-    level_data_find_linedef(demo_level, VEC2F(0, 0), VEC2F(400, 0)),
-    METAL_BARS
-  );
-
-  map_builder_free(&builder);
-}
-
-static void create_big_one()
-{
-  map_builder builder = { 0 };
-
-  map_builder_add_polygon(&builder, 0, 2048, 0.25f, WALLTEX(LARGE_BRICKS_TEXTURE), FLOOR_TEXTURE, CEILING_TEXTURE, VERTICES(
-    VEC2F(0, 0),
-    VEC2F(6144, 0),
-    VEC2F(6144, 6144),
-    VEC2F(0, 6144)
-  ));
-
-  const int w = 20;
-  const int h = 20;
-  const int size = 256;
-
-  register int x, y, c, f;
-
-  for (y = 0; y < h; ++y) {
-    for (x = 0; x < w; ++x) {
-      if (rand() % 20 == 5) {
-        c = f = 0;
-      } else {
-        f = 256 + 8 * (rand() % 16);
-        c = 1440 - 32 * (rand() % 24);
-      }
-
-      map_builder_add_polygon(&builder, f, c, 0.5f, WALLTEX(LARGE_BRICKS_TEXTURE), FLOOR_TEXTURE, CEILING_TEXTURE, VERTICES(
-        VEC2F(512+x*size,        512+y*size),
-        VEC2F(512+x*size + size, 512+y*size),
-        VEC2F(512+x*size + size, 512+y*size + size),
-        VEC2F(512+x*size,        512+y*size + size)
-      ));
-    }
-  }
-
-  demo_level = map_builder_build(&builder);
-
-  dynamic_light = level_data_add_light(demo_level, VEC3F(460, 460, 512), 1024, 1.0f);
-  light_z = dynamic_light->entity.z;
-  light_movement_range = 400;
-
-  map_builder_free(&builder);
-}
-
-static void create_semi_intersecting_sectors()
-{
-  const float base_light = 0.25f;
-
-  map_builder builder = { 0 };
-
-  map_builder_add_polygon(&builder, 0, 128, base_light, WALLTEX(SMALL_BRICKS_TEXTURE), FLOOR_TEXTURE, CEILING_TEXTURE, VERTICES(
-    VEC2F(0, 0),
-    VEC2F(500, 0),
-    VEC2F(500, 500),
-    VEC2F(0, 500)
-  ));
-
-  map_builder_add_polygon(&builder, 40, 86, base_light, WALLTEX(SMALL_BRICKS_TEXTURE), FLOOR_TEXTURE, CEILING_TEXTURE, VERTICES(
-    VEC2F(0, 200),
-    VEC2F(50, 200),
-    VEC2F(50, 400),
-    VEC2F(0, 400)
-  ));
-
-  map_builder_add_polygon(&builder, -20, 192, 0.35, WALLTEX(SMALL_BRICKS_TEXTURE), DIRT_TEXTURE, TEXTURE_NONE, VERTICES(
-    VEC2F(250, 250),
-    VEC2F(2000, 250),
-    VEC2F(2000, 350),
-    VEC2F(250, 350)
-  ));
-
-  map_builder_add_polygon(&builder, 0, 86, base_light, WALLTEX(SMALL_BRICKS_TEXTURE), FLOOR_TEXTURE, SMALL_BRICKS_TEXTURE, VERTICES(
-    VEC2F(512, 350),
-    VEC2F(640, 350),
-    VEC2F(640, 364),
-    VEC2F(512, 364)
-  ));
-
-  map_builder_add_polygon(&builder, 0, 128, base_light, WALLTEX(LARGE_BRICKS_TEXTURE), FLOOR_TEXTURE, CEILING_TEXTURE, VERTICES(
-    VEC2F(512, 364),
-    VEC2F(640, 364),
-    VEC2F(640, 480),
-    VEC2F(512, 480)
-  ));
-
-  map_builder_add_polygon(&builder, 56, 96, base_light, WALLTEX(WOOD_TEXTURE), WOOD_TEXTURE, WOOD_TEXTURE, VERTICES(
-    VEC2F(240, 240),
-    VEC2F(260, 240),
-    VEC2F(260, 260),
-    VEC2F(240, 260)
-  ));
-
-  map_builder_add_polygon(&builder, 56, 88, base_light, WALLTEX(WOOD_TEXTURE), WOOD_TEXTURE, WOOD_TEXTURE, VERTICES(
-    VEC2F(240, 340),
-    VEC2F(260, 340),
-    VEC2F(260, 360),
-    VEC2F(240, 360)
-  ));
-
-  map_builder_add_polygon(&builder, 56, 96, base_light, WALLTEX(WOOD_TEXTURE), WOOD_TEXTURE, WOOD_TEXTURE, VERTICES(
-    VEC2F(400, 350),
-    VEC2F(420, 350),
-    VEC2F(420, 370),
-    VEC2F(400, 370)
-  ));
-
-  map_builder_add_polygon(&builder, 16, 96, base_light, WALLTEX(WOOD_TEXTURE), WOOD_TEXTURE, WOOD_TEXTURE, VERTICES(
-    VEC2F(400, 250),
-    VEC2F(420, 250),
-    VEC2F(420, 270),
-    VEC2F(400, 270)
-  ));
-
-  map_builder_add_polygon(&builder, 20, 108, base_light, WALLTEX(SMALL_BRICKS_TEXTURE), FLOOR_TEXTURE, CEILING_TEXTURE, VERTICES(
-    VEC2F(240, 250),
-    VEC2F(250, 260),
-    VEC2F(250, 350),
-    VEC2F(240, 350)
-  ));
-
-  map_builder_add_polygon(&builder, -128, 256, base_light, WALLTEX(SMALL_BRICKS_TEXTURE), FLOOR_TEXTURE, CEILING_TEXTURE, VERTICES(
-    VEC2F(-100, 500),
-    VEC2F(100, 100),
-    VEC2F(100, -100),
-    VEC2F(-100, -100)
-  ));
-
-  demo_level = map_builder_build(&builder);
-  demo_level->sky_texture = SKY_TEXTURE;
-
-  dynamic_light = level_data_add_light(demo_level, VEC3F(300, 400, 64), 300, 1.0f);
-  light_z = dynamic_light->entity.z;
-  light_movement_range = 48;
-
-  /* Configure some transparent textures */
-  linedef_set_middle_texture(
-    level_data_find_linedef(demo_level, VEC2F(512, 364), VEC2F(640, 364)),
-    METAL_GRATING
-  );
-
-  map_builder_free(&builder);
-}
-
-static void
-create_crossing_and_splitting_sectors()
-{
-  map_builder builder = { 0 };
-
-  map_builder_add_polygon(&builder, 0, 128, 0.1f, WALLTEX(LARGE_BRICKS_TEXTURE), FLOOR_TEXTURE, CEILING_TEXTURE, VERTICES(
-    VEC2F(-500, 0),
-    VEC2F(1000, 0),
-    VEC2F(1000, 100),
-    VEC2F(-500, 100)
-  ));
-
-  /* This sector will split the first one so you end up with 3 sectors */
-  map_builder_add_polygon(&builder, -32, 96, 0.1f, WALLTEX(LARGE_BRICKS_TEXTURE), FLOOR_TEXTURE, CEILING_TEXTURE, VERTICES(
-    VEC2F(225, -250),
-    VEC2F(325, -250),
-    VEC2F(325, 250),
-    VEC2F(225, 250)
-  ));
-
-  demo_level = map_builder_build(&builder);
-
-  dynamic_light = level_data_add_light(demo_level, VEC3F(250, 50, 50), 200, 0.5f);
-  light_z = dynamic_light->entity.z;
-  light_movement_range = 24;
-
-  map_builder_free(&builder);
-}
-
-static void
-create_large_sky()
-{
-  map_builder builder = { 0 };
-
-  /* First area */
-  map_builder_add_polygon(&builder, 0, 256, 0.75f, WALLTEX(LARGE_BRICKS_TEXTURE), FLOOR_TEXTURE, TEXTURE_NONE, VERTICES(
-    VEC2F(-500, -500),
-    VEC2F(500, -500),
-    VEC2F(500, 500),
-    VEC2F(-500, 500)
-  ));
-
-  map_builder_add_polygon(&builder, 32, 512, 1.f, WALLTEX(LARGE_BRICKS_TEXTURE), FLOOR_TEXTURE, TEXTURE_NONE, VERTICES(
-    VEC2F(-100, -100),
-    VEC2F(100, -100),
-    VEC2F(100, 100),
-    VEC2F(-100, 100)
-  ));
-
-  map_builder_add_polygon(&builder, 192, 256, 1.f, WALLTEX(WOOD_TEXTURE), WOOD_TEXTURE, WOOD_TEXTURE, VERTICES(
-    VEC2F(-10, -10),
-    VEC2F(10, -10),
-    VEC2F(10, 10),
-    VEC2F(-10, 10)
-  ));
-
-  /* Second area */
-  map_builder_add_polygon(&builder, 0, 256, 0.75f, WALLTEX(LARGE_BRICKS_TEXTURE), GRASS_TEXTURE, TEXTURE_NONE, VERTICES(
-    VEC2F(1000, -500),
-    VEC2F(2000, -500),
-    VEC2F(2000, 500),
-    VEC2F(1000, 500)
-  ));
-
-  /* Corridor between them */
-  map_builder_add_polygon(&builder, 32, 128, 0.25f, WALLTEX(LARGE_BRICKS_TEXTURE), FLOOR_TEXTURE, CEILING_TEXTURE, VERTICES(
-    VEC2F(500, -50),
-    VEC2F(1000, -50),
-    VEC2F(1000, 50),
-    VEC2F(500, 50)
-  ));
-
-  demo_level = map_builder_build(&builder);
-  demo_level->sky_texture = SKY_TEXTURE;
-
-  map_builder_free(&builder);
-}
-
 static void
 load_level(int n)
 {
+  char path[64];
+
   if (demo_level) {
-    free(demo_level);
+    level_data_free(demo_level);
   }
 
-  dynamic_light = NULL;
+  if (n < 0 && (demo_level = demo_levels_load_map(map_path))) {
+    dynamic_light = NULL;
+  } else {
+    /* Built and compiled the first time, mapped straight in after that */
+    snprintf(path, sizeof(path), "res/level%d.rcl", M_MAX(n, 0));
+    demo_level = demo_levels_load(M_MAX(n, 0), path, &dynamic_light, &light_movement_range);
+  }
 
-  switch (n) {
-  case 1: create_demo_level(); break;
-  case 2: create_big_one(); break;
-  case 3: create_semi_intersecting_sectors(); break;
-  case 4: create_crossing_and_splitting_sectors(); break;
-  case 5: create_large_sky(); break;
-  default: create_grid_level(); break;
+  if (dynamic_light) {
+    light_z = dynamic_light->entity.z;
   }
   
   camera_init(&cam, demo_level);
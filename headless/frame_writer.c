@@ -0,0 +1,279 @@
+#include "frame_writer.h"
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+  #include <io.h>
+  #include <fcntl.h>
+  #define dup _dup
+  #define dup2 _dup2
+  #define fdopen _fdopen
+  #define fileno _fileno
+#else
+  #include <unistd.h>
+#endif
+
+#define MAX_FRAME_PATH 512
+
+static FILE*
+open_stdout(void);
+
+static bool
+write_frame(frame_writer*, const pixel_type*);
+
+static bool
+write_ppm(frame_writer*, FILE*, const pixel_type*);
+
+static bool
+write_y4m(frame_writer*, const pixel_type*);
+
+#ifdef FRAME_WRITER_THREADED
+  static void*
+  writer_thread(void*);
+#endif
+
+bool
+frame_writer_open(
+  frame_writer *this,
+  const char *path,
+  frame_format format,
+  vec2i size,
+  uint32_t fps
+) {
+  this->file = NULL;
+  this->path_pattern = NULL;
+  this->format = format;
+  this->size = size;
+  this->fps = fps;
+  this->frames_count = 0;
+  this->scratch = NULL;
+  this->pending = NULL;
+  this->failed = false;
+
+  if (format == FRAME_FORMAT_PPM && strchr(path, '%')) {
+    this->path_pattern = path;
+  } else if (!strcmp(path, "-")) {
+    this->file = open_stdout();
+  } else {
+    this->file = fopen(path, "wb");
+  }
+
+  if (!this->file && !this->path_pattern) {
+    return false;
+  }
+
+  switch (format) {
+  case FRAME_FORMAT_PPM: this->scratch = malloc(size.x * 3); break;
+  case FRAME_FORMAT_Y4M: this->scratch = malloc(size.x * size.y * 3); break;
+  default: break;
+  }
+
+  if (format == FRAME_FORMAT_Y4M) {
+    fprintf(this->file, "YUV4MPEG2 W%d H%d F%u:1 Ip A1:1 C444\n", size.x, size.y, fps);
+  }
+
+#ifdef FRAME_WRITER_THREADED
+  this->quit = false;
+  pthread_mutex_init(&this->lock, NULL);
+  pthread_cond_init(&this->changed, NULL);
+
+  if (pthread_create(&this->thread, NULL, writer_thread, this)) {
+    pthread_cond_destroy(&this->changed);
+    pthread_mutex_destroy(&this->lock);
+    return false;
+  }
+#endif
+
+  return true;
+}
+
+bool
+frame_writer_submit(frame_writer *this, const pixel_type *frame)
+{
+#ifdef FRAME_WRITER_THREADED
+  pthread_mutex_lock(&this->lock);
+
+  while (this->pending) {
+    pthread_cond_wait(&this->changed, &this->lock);
+  }
+
+  this->pending = frame;
+  pthread_cond_broadcast(&this->changed);
+  const bool failed = this->failed;
+  pthread_mutex_unlock(&this->lock);
+#else
+  const bool failed = (this->failed |= !write_frame(this, frame));
+#endif
+
+  return !failed;
+}
+
+bool
+frame_writer_close(frame_writer *this)
+{
+#ifdef FRAME_WRITER_THREADED
+  pthread_mutex_lock(&this->lock);
+  this->quit = true;
+  pthread_cond_broadcast(&this->changed);
+  pthread_mutex_unlock(&this->lock);
+  pthread_join(this->thread, NULL);
+  pthread_cond_destroy(&this->changed);
+  pthread_mutex_destroy(&this->lock);
+#endif
+
+  if (this->file) {
+    this->failed |= fclose(this->file) != 0;
+    this->file = NULL;
+  }
+
+  free(this->scratch);
+  this->scratch = NULL;
+
+  return !this->failed;
+}
+
+/*
+ * Debug builds print to stdout, which would end up in the middle of the
+ * frames. The stream takes stdout's descriptor and stdout goes to stderr.
+ */
+static FILE*
+open_stdout(void)
+{
+  FILE *file;
+  int fd;
+
+  fflush(stdout);
+
+  if ((fd = dup(fileno(stdout))) < 0 || !(file = fdopen(fd, "wb"))) {
+    return NULL;
+  }
+
+  dup2(fileno(stderr), fileno(stdout));
+
+#ifdef _WIN32
+  _setmode(fd, _O_BINARY);
+#endif
+
+  return file;
+}
+
+#ifdef FRAME_WRITER_THREADED
+
+static void*
+writer_thread(void *data)
+{
+  frame_writer *this = (frame_writer*)data;
+  bool written;
+
+  pthread_mutex_lock(&this->lock);
+
+  for (;;) {
+    while (!this->pending && !this->quit) {
+      pthread_cond_wait(&this->changed, &this->lock);
+    }
+
+    if (!this->pending) {
+      break;
+    }
+
+    pthread_mutex_unlock(&this->lock);
+    written = write_frame(this, this->pending);
+    pthread_mutex_lock(&this->lock);
+
+    this->failed |= !written;
+    this->pending = NULL;
+    pthread_cond_broadcast(&this->changed);
+  }
+
+  pthread_mutex_unlock(&this->lock);
+
+  return NULL;
+}
+
+#endif
+
+static bool
+write_frame(frame_writer *this, const pixel_type *frame)
+{
+  char path[MAX_FRAME_PATH];
+  FILE *file;
+  bool written;
+
+  this->frames_count++;
+
+  if (this->failed) {
+    return false;
+  }
+
+  switch (this->format) {
+  case FRAME_FORMAT_RAW:
+    return fwrite(frame, sizeof(pixel_type), this->size.x * this->size.y, this->file) == (size_t)(this->size.x * this->size.y);
+
+  case FRAME_FORMAT_Y4M:
+    return write_y4m(this, frame);
+
+  case FRAME_FORMAT_PPM:
+    if (!this->path_pattern) {
+      return write_ppm(this, this->file, frame);
+    }
+
+    snprintf(path, MAX_FRAME_PATH, this->path_pattern, this->frames_count - 1);
+
+    if (!(file = fopen(path, "wb"))) {
+      return false;
+    }
+
+    written = write_ppm(this, file, frame);
+
+    return (fclose(file) == 0) && written;
+  }
+
+  return false;
+}
+
+static bool
+write_ppm(frame_writer *this, FILE *file, const pixel_type *frame)
+{
+  register int32_t x, y;
+  uint8_t *row = this->scratch;
+  pixel_type p;
+
+  fprintf(file, "P6\n%d %d\n255\n", this->size.x, this->size.y);
+
+  for (y = 0; y < this->size.y; ++y, frame += this->size.x) {
+    for (x = 0; x < this->size.x; ++x) {
+      p = frame[x];
+      row[x * 3] = (p >> 16) & 0xFF;
+      row[x * 3 + 1] = (p >> 8) & 0xFF;
+      row[x * 3 + 2] = p & 0xFF;
+    }
+
+    if (fwrite(row, 3, this->size.x, file) != (size_t)this->size.x) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/* Studio range BT.601, the usual meaning of a Y4M stream without a colour range tag */
+static bool
+write_y4m(frame_writer *this, const pixel_type *frame)
+{
+  register size_t i;
+  const size_t count = this->size.x * this->size.y;
+  uint8_t *y = this->scratch, *u = y + count, *v = u + count;
+  int32_t r, g, b;
+
+  for (i = 0; i < count; ++i) {
+    r = (frame[i] >> 16) & 0xFF;
+    g = (frame[i] >> 8) & 0xFF;
+    b = frame[i] & 0xFF;
+    y[i] = (uint8_t)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+    u[i] = (uint8_t)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+    v[i] = (uint8_t)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+  }
+
+  return fputs("FRAME\n", this->file) >= 0
+      && fwrite(this->scratch, 1, count * 3, this->file) == count * 3;
+}
@@ -0,0 +1,58 @@
+#ifndef RAYCAST_FRAME_WRITER_INCLUDED
+#define RAYCAST_FRAME_WRITER_INCLUDED
+
+#include "renderer.h"
+#include <stdio.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+  #define FRAME_WRITER_THREADED
+  #include <pthread.h>
+#endif
+
+typedef enum frame_format {
+  FRAME_FORMAT_RAW, /* pixel_type values as they are in memory, back to back */
+  FRAME_FORMAT_PPM, /* Binary PPM, one file per frame or concatenated in a stream */
+  FRAME_FORMAT_Y4M  /* YUV4MPEG2 with 4:4:4 BT.601 planes */
+} frame_format;
+
+/*
+ * Writes frames to a file or pipe on a thread of its own, straight from
+ * the frame buffer handed to it. Draw into a second buffer while a frame
+ * is being written, then hand that one over and swap back.
+ */
+typedef struct frame_writer {
+  FILE *file;
+  /* printf pattern with one number for writing each frame to its own file, or NULL */
+  const char *path_pattern;
+  frame_format format;
+  vec2i size;
+  uint32_t fps, frames_count;
+  /* Rows or planes converted from the frame, for formats that aren't written as is */
+  uint8_t *scratch;
+  /* Frame being written, NULL once it's done */
+  const pixel_type *pending;
+  bool failed;
+#ifdef FRAME_WRITER_THREADED
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+  bool quit;
+#endif
+} frame_writer;
+
+/* 'path' is a file, "-" for stdout, or (for PPM) a pattern like "out/%04d.ppm" */
+bool
+frame_writer_open(frame_writer *this, const char *path, frame_format format, vec2i size, uint32_t fps);
+
+/*
+ * Waits for the previous frame to be written and starts writing 'frame'.
+ * The frame must be left alone until the next submit or close returns.
+ */
+bool
+frame_writer_submit(frame_writer *this, const pixel_type *frame);
+
+/* Finishes the last frame and closes the output, returning false if any write failed */
+bool
+frame_writer_close(frame_writer *this);
+
+#endif
@@ -0,0 +1,250 @@
+#include "renderer.h"
+#include "camera.h"
+#include "level_data.h"
+#include "texture.h"
+#include "levels.h"
+#include "frame_writer.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+/*
+ * Draws one of the demo levels along a camera path without a window and
+ * streams the frames out, for making videos and comparing frames in CI:
+ *
+ *   headless -level 1 -size 640x360 -path flythrough.txt -o - | ffmpeg -i - out.mp4
+ *
+ * A path file has a keyframe per line, "frame x y z angle pitch" with the
+ * angle in degrees. The camera moves linearly between keyframes. Without
+ * one, the camera turns around once where it starts.
+ */
+
+#define MAX_PATH_KEYFRAMES 1024
+
+typedef struct keyframe {
+  uint32_t frame;
+  float x, y, z, angle, pitch;
+} keyframe;
+
+static keyframe path[MAX_PATH_KEYFRAMES];
+static size_t path_count = 0;
+
+M_INLINED float
+lerp(float a, float b, float t)
+{
+  return a + (b - a) * t;
+}
+
+static bool load_path(const char*);
+static keyframe path_at(uint32_t);
+static void place_camera(camera*, const keyframe*);
+static void print_usage(void);
+
+int main(int argc, char *argv[])
+{
+  int i;
+  int level_index = 0;
+  vec2i size = VEC2I(320, 240);
+  uint32_t frame, frames_count = 0, fps = 30;
+  frame_format format = FRAME_FORMAT_Y4M;
+  const char *output = "-", *map_path = NULL;
+  keyframe start;
+  level_data *level;
+  renderer rend;
+  renderer_view view;
+  camera cam;
+  frame_writer writer;
+  pixel_type *back_buffer, *swap;
+
+  for (i = 1; i < argc; ++i) {
+    if (!strcmp(argv[i], "-level") && i + 1 < argc) {
+      level_index = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "-map") && i + 1 < argc) {
+      map_path = argv[++i];
+    } else if (!strcmp(argv[i], "-size") && i + 1 < argc) {
+      if (sscanf(argv[++i], "%dx%d", &size.x, &size.y) != 2 || size.x <= 0 || size.y <= 0) {
+        print_usage();
+        return 1;
+      }
+    } else if (!strcmp(argv[i], "-frames") && i + 1 < argc) {
+      frames_count = (uint32_t)atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "-fps") && i + 1 < argc) {
+      fps = M_MAX(1, atoi(argv[++i]));
+    } else if (!strcmp(argv[i], "-format") && i + 1 < argc) {
+      ++i;
+      if (!strcmp(argv[i], "raw")) { format = FRAME_FORMAT_RAW; }
+      else if (!strcmp(argv[i], "ppm")) { format = FRAME_FORMAT_PPM; }
+      else if (!strcmp(argv[i], "y4m")) { format = FRAME_FORMAT_Y4M; }
+      else { print_usage(); return 1; }
+    } else if (!strcmp(argv[i], "-path") && i + 1 < argc) {
+      if (!load_path(argv[++i])) {
+        fprintf(stderr, "Could not read camera path %s\n", argv[i]);
+        return 1;
+      }
+    } else if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+      output = argv[++i];
+    } else {
+      print_usage();
+      return 1;
+    }
+  }
+
+  if (!frames_count) {
+    frames_count = path_count ? path[path_count - 1].frame + 1 : 120;
+  }
+
+  /* Opened first, so debug output from building the level stays out of a stdout stream */
+  if (!frame_writer_open(&writer, output, format, size, fps)) {
+    fprintf(stderr, "Could not open %s for writing\n", output);
+    return 1;
+  }
+
+  texture_sampler = debug_texture_sampler;
+
+  if (map_path) {
+    if (!(level = demo_levels_load_map(map_path))) {
+      frame_writer_close(&writer);
+      return 1;
+    }
+  } else {
+    level = demo_levels_create(level_index, NULL, NULL);
+  }
+
+  camera_init(&cam, level);
+
+  /* Without a path, turn around where the camera starts */
+  if (!path_count) {
+    start = (keyframe) { 0, cam.entity.position.x, cam.entity.position.y, cam.entity.z, 0.f, 0.f };
+    path[path_count++] = start;
+    start.frame = frames_count - 1;
+    start.angle = 360.f * (frames_count - 1) / frames_count;
+    path[path_count++] = start;
+  }
+
+  renderer_init(&rend, size);
+  renderer_view_init(&view);
+  back_buffer = malloc(size.x * size.y * sizeof(pixel_type));
+
+  for (frame = 0; frame < frames_count; ++frame) {
+    start = path_at(frame);
+    place_camera(&cam, &start);
+
+    if (!cam.entity.sector) {
+      fprintf(stderr, "Camera is outside the level at frame %u\n", frame);
+      break;
+    }
+
+    renderer_draw(&rend, &view, &cam);
+
+    /* The writer keeps the frame just drawn, the next one goes into the buffer it's done with */
+    if (!frame_writer_submit(&writer, rend.buffer)) {
+      fprintf(stderr, "Writing frame %u failed\n", frame);
+      break;
+    }
+
+    swap = rend.buffer;
+    rend.buffer = back_buffer;
+    back_buffer = swap;
+  }
+
+  i = (frame_writer_close(&writer) && frame == frames_count) ? 0 : 1;
+
+  free(back_buffer);
+  renderer_view_destroy(&view);
+  renderer_destroy(&rend);
+  level_data_free(level);
+
+  return i;
+}
+
+static bool
+load_path(const char *filename)
+{
+  char line[256];
+  keyframe k;
+  FILE *file = fopen(filename, "r");
+
+  if (!file) {
+    return false;
+  }
+
+  while (fgets(line, sizeof(line), file) && path_count < MAX_PATH_KEYFRAMES) {
+    if (line[0] == '#') {
+      continue;
+    }
+
+    k.pitch = 0.f;
+
+    if (sscanf(line, "%u %f %f %f %f %f", &k.frame, &k.x, &k.y, &k.z, &k.angle, &k.pitch) < 5) {
+      continue;
+    }
+
+    /* Keyframes have to be in order */
+    if (path_count && k.frame <= path[path_count - 1].frame) {
+      fclose(file);
+      return false;
+    }
+
+    path[path_count++] = k;
+  }
+
+  fclose(file);
+
+  return path_count > 0;
+}
+
+static keyframe
+path_at(uint32_t frame)
+{
+  size_t i;
+  keyframe k;
+  const keyframe *a, *b;
+  float t;
+
+  for (i = 1; i < path_count && path[i].frame <= frame; ++i);
+
+  if (i == path_count || frame <= path[0].frame) {
+    return path[frame <= path[0].frame ? 0 : path_count - 1];
+  }
+
+  a = &path[i - 1];
+  b = &path[i];
+  t = (frame - a->frame) / (float)(b->frame - a->frame);
+
+  k.frame = frame;
+  k.x = lerp(a->x, b->x, t);
+  k.y = lerp(a->y, b->y, t);
+  k.z = lerp(a->z, b->z, t);
+  k.angle = lerp(a->angle, b->angle, t);
+  k.pitch = lerp(a->pitch, b->pitch, t);
+
+  return k;
+}
+
+static void
+place_camera(camera *cam, const keyframe *k)
+{
+  const float angle = k->angle * (M_PI / 180.f);
+
+  entity_set_position(&cam->entity, VEC2F(k->x, k->y));
+  cam->entity.z = k->z;
+  cam->entity.direction = VEC2F(cosf(angle), sinf(angle));
+  cam->pitch = math_clamp(k->pitch, MIN_CAMERA_PITCH, MAX_CAMERA_PITCH);
+  camera_set_fov(cam, cam->fov);
+}
+
+static void
+print_usage(void)
+{
+  fprintf(stderr,
+    "Usage: headless [options]\n"
+    "  -level N      demo level to draw (default 0)\n"
+    "  -map FILE     compiled level or text map to draw instead\n"
+    "  -size WxH     frame size (default 320x240)\n"
+    "  -frames N     frames to draw (default: to the end of the path, or 120)\n"
+    "  -fps N        frame rate of Y4M streams (default 30)\n"
+    "  -format F     raw, ppm or y4m (default y4m)\n"
+    "  -path FILE    camera path, lines of \"frame x y z angle pitch\"\n"
+    "  -o PATH       output file, - for stdout (default), or a pattern like out/%%04d.ppm for PPM files\n"
+  );
+}
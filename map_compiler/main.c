@@ -0,0 +1,45 @@
+#include "level_data.h"
+#include "map_reader.h"
+#include <string.h>
+#include <stdio.h>
+
+/*
+ * Compiles a text map (see map_reader.h) into a level file that
+ * level_data_load maps straight in:
+ *
+ *   map_compiler level.map level.rcl
+ *
+ * A map of "-" is read from stdin. Compiled levels are only read by
+ * builds with the same struct layout as the compiler.
+ */
+
+int main(int argc, char *argv[])
+{
+  map_reader_error error;
+  level_data *level;
+  bool saved;
+
+  if (argc != 3) {
+    fprintf(stderr, "Usage: map_compiler MAP OUTPUT\n");
+    return 1;
+  }
+
+  level = strcmp(argv[1], "-") ? map_reader_load(argv[1], &error) : map_reader_read(stdin, &error);
+
+  if (!level) {
+    fprintf(stderr, "%s:%u: %s\n", argv[1], error.line, error.message);
+    return 1;
+  }
+
+  if (!(saved = level_data_save(level, argv[2]))) {
+    fprintf(stderr, "Could not write %s\n", argv[2]);
+  } else {
+    fprintf(stderr, "%s: %zu sectors, %zu linedefs, %zu lights, %zu sprites\n",
+      argv[2], level->sectors_count, level->linedefs_count, level->lights_count, level->sprites_count
+    );
+  }
+
+  level_data_free(level);
+
+  return saved ? 0 : 1;
+}
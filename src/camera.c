@@ -2,14 +2,11 @@
 #include "level_data.h"
 #include <stdio.h>
 
-static void
-find_current_sector(camera *this);
-
 void
 camera_init(camera *this, level_data *level)
 {
   this->entity = (entity) {
-    .level = level,
+    .level = NULL,
     .sector = NULL,
     .position = VEC2F(70, 70),
     .z = 64,
@@ -22,17 +19,21 @@ camera_init(camera *this, level_data *level)
   this->pitch = 0.f;
   this->plane = vec2f_make(this->entity.direction.y * this->fov, -this->entity.direction.x * this->fov);
 
-  find_current_sector(this);
+  level_data_add_entity(level, &this->entity);
 }
 
 void
 camera_move(camera *this, float distance)
 {
-  this->entity.position = vec2f_add(this->entity.position, vec2f_mul(this->entity.direction, distance));
+  IF_DEBUG(const sector *previous_sector = this->entity.sector;)
+
+  entity_set_position(&this->entity, vec2f_add(this->entity.position, vec2f_mul(this->entity.direction, distance)));
 
-  if (!sector_point_inside(this->entity.sector, this->entity.position)) {
-    find_current_sector(this);
-  }
+  IF_DEBUG(
+    if (this->entity.sector != previous_sector) {
+      printf("Camera entered sector: %d\n", (int)(this->entity.sector - this->entity.level->sectors));
+    }
+  )
 }
 
 void
@@ -53,19 +54,3 @@ camera_set_fov(camera *this, float fov)
   this->fov = fov;
   this->plane = vec2f_make(this->entity.direction.y*fov, -this->entity.direction.x*fov);
 }
-
-static void
-find_current_sector(camera *this)
-{
-  register size_t i;
-
-  for (i = 0; i < this->entity.level->sectors_count; ++i) {
-    if (&this->entity.level->sectors[i] == this->entity.sector) { continue; }
-    // printf("Check sector %d\n", i);
-    if (sector_point_inside(&this->entity.level->sectors[i], this->entity.position)) {
-      this->entity.sector = (sector *)&this->entity.level->sectors[i];
-      printf("Camera entered sector: %d\n", i);
-      break;
-    }
-  }
-}
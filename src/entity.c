@@ -0,0 +1,91 @@
+#include "entity.h"
+#include "level_data.h"
+
+#define MAX_SECTOR_TRACE_STEPS 64
+
+static sector*
+trace_sector(sector*, vec2f, vec2f, bool*);
+
+/*
+ * Moves the entity and follows it from sector to sector by crossing the
+ * linedefs between its old and new position, so the cost depends on the
+ * size of the sectors it passes through rather than the whole level.
+ */
+void
+entity_set_position(entity *this, vec2f position)
+{
+  bool crossed = false;
+  const vec2f previous_position = this->position;
+  sector *sect;
+
+  this->position = position;
+
+  if (!this->level) {
+    return;
+  }
+
+  if (this->sector) {
+    sect = trace_sector(this->sector, previous_position, position, &crossed);
+
+    if (crossed && (!sect || !sector_point_inside(sect, position))) {
+      sect = level_data_find_sector(this->level, position);
+    }
+  } else {
+    sect = level_data_find_sector(this->level, position);
+  }
+
+  /* Keep the last known sector when leaving the level */
+  if (sect) {
+    this->sector = sect;
+  }
+
+  map_cache_link_entity(&this->level->cache, this);
+}
+
+/*
+ * Walk the segment from sector to sector through the nearest crossed
+ * linedef until no more linedefs are crossed. Returns NULL if the
+ * segment leaves the level through a one-sided linedef.
+ */
+static sector*
+trace_sector(sector *sect, vec2f from, vec2f to, bool *crossed)
+{
+  register size_t i, steps;
+  float t, nearest_t, last_t = 0.f;
+  linedef *line, *nearest_line, *previous_line = NULL;
+
+  for (steps = 0; steps < MAX_SECTOR_TRACE_STEPS; ++steps) {
+    nearest_line = NULL;
+    nearest_t = FLT_MAX;
+
+    for (i = 0; i < sect->linedefs_count; ++i) {
+      line = sect->linedefs[i];
+
+      if (line == previous_line) {
+        continue;
+      }
+
+      if (math_find_line_intersection(from, to, line->v0->point, line->v1->point, NULL, &t) &&
+          t >= last_t && t < nearest_t) {
+        nearest_t = t;
+        nearest_line = line;
+      }
+    }
+
+    if (!nearest_line) {
+      return sect;
+    }
+
+    *crossed = true;
+    last_t = nearest_t;
+    previous_line = nearest_line;
+    sect = nearest_line->side[0].sector == sect ? nearest_line->side[1].sector : nearest_line->side[0].sector;
+
+    if (!sect) {
+      return NULL;
+    }
+  }
+
+  /* Give up and let the caller look the sector up */
+  return NULL;
+}
@@ -5,10 +5,12 @@
 
 struct level_data;
 struct sector;
+struct map_cache_cell;
 
 typedef enum entity_type {
   ENTITY_CAMERA,
-  ENTITY_LIGHT
+  ENTITY_LIGHT,
+  ENTITY_SPRITE
 } entity_type;
 
 typedef struct entity {
@@ -19,6 +21,9 @@ typedef struct entity {
         direction;
   float z;
   entity_type type;
+  /* Map cache cell the entity is linked to (NULL when not linked) */
+  struct map_cache_cell *cell;
+  struct entity *cell_prev, *cell_next;
 } entity;
 
 M_INLINED vec3f
@@ -27,4 +32,7 @@ entity_world_position(const entity *this)
   return VEC3F(this->position.x, this->position.y, this->z);
 }
 
+void
+entity_set_position(entity *this, vec2f position);
+
 #endif
@@ -3,26 +3,84 @@
 
 #include "sector.h"
 #include "light.h"
+#include "sprite.h"
 #include "texture.h"
 #include "map_cache.h"
 
+#define LEVEL_DATA_CHUNK_SIZE 64
+#define LEVEL_DATA_VISIBILITY_STRIDE(COUNT) (((COUNT) + 31) >> 5)
+
 struct polygon;
 
+/* Chained hash of element indices, -1 terminates a chain */
+typedef struct level_data_hash {
+  uint32_t mask;
+  int32_t *buckets,
+          *next;
+} level_data_hash;
+
+/*
+ * A built level lives in a single allocation, with the level_data at its
+ * base. Lights and sprites are added at runtime and live in fixed-size
+ * chunks, so pointers to them stay valid as more are added.
+ */
 typedef struct level_data {
   size_t sectors_count,
          linedefs_count,
          vertices_count,
-         lights_count;
-  vertex vertices[16384];
-  linedef linedefs[8192];
-  sector sectors[2048];
-  light lights[64];
+         lights_count,
+         sprites_count,
+         entities_count;
+  vertex *vertices;
+  linedef *linedefs;
+  sector *sectors;
+  light **light_chunks;
+  sprite **sprite_chunks;
+  float sprites_max_width;
   vec2f min,
         max;
+  level_data_hash vertex_hash,
+                  edge_hash;
+  /* Sector to sector visibility, one row of bits per sector (NULL if not built) */
+  uint32_t *sector_visibility;
+  /* Linedefs visible from sector i, sorted, are linedef_visibility[linedef_visibility_offsets[i] .. [i+1]] */
+  uint32_t *linedef_visibility_offsets,
+           *linedef_visibility;
   map_cache cache;
   texture_ref sky_texture;
+  /* Size of the file mapping a loaded level lives in, 0 when it was allocated */
+  size_t mapped_size;
 } level_data;
 
+void
+level_data_init_scratch(level_data*, size_t, size_t);
+
+level_data*
+level_data_pack(level_data*);
+
+void
+level_data_free(level_data*);
+
+/* Compiled level files start with this word, "RCLV" read as a little endian word */
+#define LEVEL_FILE_MAGIC 0x564C4352u
+
+/* The level starts this far into a compiled level file, keeping the arena aligned in a mapping */
+#define LEVEL_FILE_HEADER_SIZE 64
+
+/*
+ * Compiled levels hold the packed level as it is in memory, pointers
+ * stored as offsets from its start, followed by its lights and sprites.
+ * Loading maps the file, checks every offset and index stays within its
+ * array, and turns the offsets back into pointers, so they are only read
+ * by builds with the same struct layout. Turning them back
+ * writes to every page of the private mapping, so each page gets copied.
+ */
+bool
+level_data_save(const level_data*, const char*);
+
+level_data*
+level_data_load(const char*);
+
 vertex*
 level_data_get_vertex(level_data*, vec2f);
 
@@ -38,19 +96,58 @@ level_data_add_light(level_data*, vec3f, float, float);
 void
 level_data_update_lights(level_data*);
 
-M_INLINED linedef*
-level_data_find_linedef(level_data *this, vec2f p0, vec2f p1)
+/* Updates the wall segments a light reaches after it moved from the given position */
+void
+level_data_update_light(level_data*, light*, vec3f);
+
+sprite*
+level_data_add_sprite(level_data*, vec3f, float, float, texture_ref);
+
+sector*
+level_data_find_sector(level_data*, vec2f);
+
+linedef*
+level_data_find_linedef(level_data*, vec2f, vec2f);
+
+void
+level_data_add_entity(level_data*, entity*);
+
+void
+level_data_remove_entity(level_data*, entity*);
+
+M_INLINED light*
+level_data_light_at(const level_data *this, size_t index)
+{
+  return &this->light_chunks[index / LEVEL_DATA_CHUNK_SIZE][index % LEVEL_DATA_CHUNK_SIZE];
+}
+
+/* Whether anything in one sector may have a line of sight into the other */
+M_INLINED bool
+level_data_sectors_visible(const level_data *this, const sector *a, const sector *b)
 {
-  size_t i;
-  linedef *line;
-  for (i = 0; i < this->linedefs_count; ++i) {
-    line = &this->linedefs[i];
-    if ((VEC2F_EQUAL(line->v0->point, p0) && VEC2F_EQUAL(line->v1->point, p1)) ||
-        (VEC2F_EQUAL(line->v0->point, p1) && VEC2F_EQUAL(line->v1->point, p0))) {
-      return line;
-    }
+  const size_t row = (a - this->sectors) * LEVEL_DATA_VISIBILITY_STRIDE(this->sectors_count);
+  const size_t column = b - this->sectors;
+  return !this->sector_visibility || (this->sector_visibility[row + (column >> 5)] >> (column & 31)) & 1;
+}
+
+/* Sorted indices of the linedefs potentially visible from a sector, NULL when any may be */
+M_INLINED const uint32_t*
+level_data_visible_linedefs(const level_data *this, const sector *sect, size_t *count)
+{
+  const size_t index = sect - this->sectors;
+
+  if (!this->linedef_visibility_offsets || !sect) {
+    return NULL;
   }
-  return NULL;
+
+  *count = this->linedef_visibility_offsets[index + 1] - this->linedef_visibility_offsets[index];
+  return &this->linedef_visibility[this->linedef_visibility_offsets[index]];
+}
+
+M_INLINED sprite*
+level_data_sprite_at(const level_data *this, size_t index)
+{
+  return &this->sprite_chunks[index / LEVEL_DATA_CHUNK_SIZE][index % LEVEL_DATA_CHUNK_SIZE];
 }
 
 #endif
@@ -3,8 +3,6 @@
 
 #include "entity.h"
 
-#define MAX_LIGHTS_PER_SURFACE 4
-
 void
 level_data_update_lights(struct level_data*);
 
@@ -16,7 +14,39 @@ typedef struct light {
   float strength;
 } light;
 
+/*
+ * Lights of one surface or map cache cell, stored as a range of a shared
+ * light_pool and kept sorted strongest first. A list that outgrows its
+ * capacity moves to the end of the pool with twice the room.
+ */
+typedef struct light_list {
+  uint32_t offset;
+  uint16_t count,
+           capacity;
+} light_list;
+
+typedef struct light_pool {
+  light **lights;
+  uint32_t count,
+           capacity;
+} light_pool;
+
 void
 light_set_position(light *this, vec3f position);
 
+void
+light_list_insert(light_list*, light_pool*, light*);
+
+bool
+light_list_remove(light_list*, light_pool*, const light*);
+
+void
+light_pool_free(light_pool*);
+
+M_INLINED light**
+light_list_lights(const light_list *this, const light_pool *pool)
+{
+  return this->count ? pool->lights + this->offset : NULL;
+}
+
 #endif
@@ -8,6 +8,8 @@
 static const float LINEDEF_SEGMENT_LENGTH_INV = 1.f / 128;
 
 struct sector;
+struct map_cache;
+struct map_cache_line;
 
 typedef enum {
   LINE_TEXTURE_TOP = 0,
@@ -17,8 +19,7 @@ typedef enum {
 
 typedef struct linedef_segment {
   vec2f p0, p1;
-  light *lights[MAX_LIGHTS_PER_SURFACE];
-  uint8_t lights_count;
+  light_list lights;
 } linedef_segment;
 
 typedef struct linedef {
@@ -33,6 +34,8 @@ typedef struct linedef {
           min_ceiling_height;
   uint16_t segments;
   float length, xmin, xmax, ymin, ymax;
+  struct map_cache *cache;
+  struct map_cache_line *cache_line;
 } linedef;
 
 void
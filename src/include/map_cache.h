@@ -4,40 +4,96 @@
 #include "types.h"
 #include "light.h"
 
-#define CELL_SIZE 76.f
+#define MAP_CACHE_LINEDEFS_PER_CELL 4 /* Target used when picking the cell size */
+#define MAP_CACHE_MIN_CELL_SIZE 16.f
+#define MAP_CACHE_MAX_CELL_SIZE 1024.f
+#define MAP_CACHE_MAX_CELLS (1 << 22)
+#define MAP_CACHE_BLOCK_SHIFT 3 /* Blocks of 8x8 cells */
 
 struct level_data;
 struct linedef;
+struct sector;
 struct map_cache_cell;
 
+/* Packed copy of what rays are tested against, kept in sync by the linedef */
+typedef struct map_cache_line {
+  vec2f v0,
+        direction;
+  float max_floor_height,
+        min_ceiling_height;
+  bool solid;
+} map_cache_line;
+
+/*
+ * Coarse block of cells. Rays skip a block in one step when it has no
+ * linedefs, or when their height stays above every floor and below every
+ * ceiling of its lines. The bounds only ever widen when heights change.
+ */
+typedef struct map_cache_block {
+  uint32_t count;
+  float max_floor_height,
+        min_ceiling_height;
+} map_cache_block;
+
 typedef struct map_cache_cell {
-  uint8_t count, lights_count;
-  struct linedef **linedefs;
-  light *lights[MAX_LIGHTS_PER_SURFACE];
+  uint16_t sectors_count;
+  /* Sectors that may contain a point in this cell, in level order */
+  struct sector **sectors;
+  light_list lights;
+  entity *entities;
 } map_cache_cell;
 
 typedef struct map_cache {
   vec2f origin;
+  float cell_size;
   uint32_t cell_count;
-  uint16_t w, h;
+  uint16_t w, h,
+           blocks_w, blocks_h;
   map_cache_cell *cells;
+  map_cache_block *blocks;
+  /* Linedefs of cell i are cell_linedefs[cell_offsets[i] .. cell_offsets[i+1]] */
+  uint32_t *cell_offsets,
+           *cell_linedefs;
+  map_cache_line *lines;
+  struct sector **sectors;
+  /* Light lists of the cells and of the wall segments */
+  light_pool light_pool;
 } map_cache;
 
+/*
+ * Builds the cache with cells of the given size. A size of 0 picks one from
+ * the number and average length of the linedefs so that each cell holds
+ * about MAP_CACHE_LINEDEFS_PER_CELL of them. Either size is raised to at least
+ * MAP_CACHE_MIN_CELL_SIZE, and further if the grid would have more than
+ * MAP_CACHE_MAX_CELLS cells or more than 16 bits' worth of them on a side.
+ */
 void
-map_cache_process_level_data(map_cache*, struct level_data*);
+map_cache_process_level_data(map_cache*, struct level_data*, float);
 
 void
 map_cache_process_light(map_cache*, struct light*, vec3f);
 
+void
+map_cache_link_entity(map_cache*, entity*);
+
+void
+map_cache_unlink_entity(map_cache*, entity*);
+
+void
+map_cache_update_line_bounds(map_cache*, const struct linedef*);
+
 bool
 map_cache_intersect_3d(const map_cache*, vec3f, vec3f);
 
+struct sector*
+map_cache_find_sector(const map_cache*, vec2f);
+
 M_INLINED map_cache_cell *
 map_cache_cell_at(const map_cache *this, const vec2f world_position)
 {
   const vec2f local_position = vec2f_sub(world_position, this->origin);
-  uint16_t x = local_position.x / CELL_SIZE;
-  uint16_t y = local_position.y / CELL_SIZE;
+  uint16_t x = local_position.x / this->cell_size;
+  uint16_t y = local_position.y / this->cell_size;
   if (x < 0 || y < 0 || x >= this->w || y >= this->h) {
     return NULL;
   }
@@ -173,6 +173,32 @@ math_point_in_triangle(vec2f point, vec2f v0, vec2f v1, vec2f v2) {
   return !(((d0 < 0) || (d1 < 0) || (d2 < 0)) && ((d0 > 0) || (d1 > 0) || (d2 > 0)));
 }
 
+/* Separating axis test of a triangle against the box from 'min' to 'max' */
+M_INLINED bool
+math_triangle_overlaps_box(vec2f v0, vec2f v1, vec2f v2, vec2f min, vec2f max) {
+  const vec2f v[3] = { v0, v1, v2 };
+  register int i;
+  float side;
+
+  if (fmaxf(fmaxf(v0.x, v1.x), v2.x) < min.x || fminf(fminf(v0.x, v1.x), v2.x) > max.x ||
+      fmaxf(fmaxf(v0.y, v1.y), v2.y) < min.y || fminf(fminf(v0.y, v1.y), v2.y) > max.y) {
+    return false;
+  }
+
+  for (i = 0; i < 3; ++i) {
+    side = math_sign(v[i], v[(i + 1) % 3], v[(i + 2) % 3]);
+
+    if (side * math_sign(v[i], v[(i + 1) % 3], min) < 0 &&
+        side * math_sign(v[i], v[(i + 1) % 3], max) < 0 &&
+        side * math_sign(v[i], v[(i + 1) % 3], VEC2F(min.x, max.y)) < 0 &&
+        side * math_sign(v[i], v[(i + 1) % 3], VEC2F(max.x, min.y)) < 0) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
 M_INLINED float
 math_line_segment_point_perpendicular_distance(vec2f a, vec2f b, vec2f point) {
   return fabsf(math_cross(vec2f_sub(b, a), vec2f_sub(a, point))) / math_length(vec2f_sub(b, a));
@@ -4,17 +4,105 @@
 #include "types.h"
 
 struct camera;
+struct frame_info;
+struct light;
+struct sprite;
+struct linedef;
 
 typedef uint32_t pixel_type;
 typedef pixel_type* frame_buffer;
 
+/*
+ * Depth is stored as planar distance, linearly quantized to 16 bits
+ * over the draw distance. Pixels that hit nothing (or sky) keep the
+ * maximum value.
+ */
+typedef uint16_t depth_type;
+typedef depth_type* depth_buffer;
+
 #define RENDERER_DRAW_DISTANCE 12000.f
+#define RENDERER_DEPTH_MAX UINT16_MAX
+
+#define LIGHT_TILE_SIZE 16
+
+/* Sprite projected to screen space for the current frame */
+typedef struct visible_sprite {
+  const struct sprite *sprite;
+  float screen_left,
+        screen_top,
+        screen_width_inverse,
+        screen_height_inverse,
+        light;
+  int32_t x_start, x_end,
+          y_start, y_end;
+  depth_type depth;
+  uint8_t mip_level;
+} visible_sprite;
+
+/* Screen bounds of everything a light can reach, for the current frame */
+typedef struct visible_light {
+  struct light *light;
+  int32_t x_start, x_end,
+          y_start, y_end;
+} visible_light;
+
+/* Lights reaching a square tile of the screen, strongest first */
+typedef struct light_tile {
+  uint32_t offset, count;
+} light_tile;
+
+/* Visible linedefs facing into one sector, only valid when 'frame' is the current one */
+typedef struct visible_range {
+  uint32_t frame, offset, count;
+} visible_range;
+
+/*
+ * What one view sees in a frame, filled in by renderer_draw. Owned by the
+ * caller, so several views of the same level can be drawn at once (each
+ * with its own renderer) while the level itself is only read.
+ */
+typedef struct renderer_view {
+  struct {
+    visible_sprite *list, *sort_buffer;
+    size_t count, capacity;
+  } sprites;
+  /* Lights on screen this frame, listed per tile */
+  struct {
+    visible_light *visible;
+    light_tile *tiles;
+    struct light **list;
+    size_t visible_count, visible_capacity, list_capacity, tiles_capacity;
+    int32_t tiles_w, tiles_h;
+  } lights;
+#ifdef RAYCASTER_PRERENDER_VISCHECK
+  /*
+   * Linedefs rays are tested against this frame, grouped by the sector
+   * whose side of them faces the camera. 'in_view' and 'candidates' are
+   * scratch space for building them.
+   */
+  struct {
+    uint32_t *in_view,
+             *candidates;
+    struct linedef **lines;
+    visible_range *ranges;
+    size_t linedefs_capacity, sectors_capacity;
+    uint32_t frame;
+  } visible;
+#endif
+} renderer_view;
 
 typedef struct {
   volatile frame_buffer buffer;
+  volatile depth_buffer depth;
   volatile float *depth_values;
+  /* Depth behind which a column is fully covered (RENDERER_DEPTH_MAX if it has gaps) */
+  depth_type *column_depth;
+  /* Views renderer_draw_batch reuses, one per camera, and their frame setup */
+  renderer_view *batch_views;
+  struct frame_info *batch_frames;
+  /* Frames packed one after another in the buffers, each buffer_size large */
+  size_t frames_count, batch_views_count;
   vec2i buffer_size;
-  uint32_t tick;
 } renderer;
 
 void
@@ -27,7 +115,38 @@ void
 renderer_destroy(renderer *this);
 
 void
-renderer_draw(renderer *this, struct camera *camera);
+renderer_draw(renderer *this, renderer_view *view, const struct camera *camera);
+
+void
+renderer_draw_batch(renderer *this, struct camera **cameras, size_t count);
+
+void
+renderer_view_init(renderer_view *this);
+
+void
+renderer_view_destroy(renderer_view *this);
+
+/* Frame 'index' of the last renderer_draw_batch (frame 0 is also what renderer_draw draws to) */
+M_INLINED pixel_type*
+renderer_frame(const renderer *this, size_t index)
+{
+  return this->buffer + index * this->buffer_size.x * this->buffer_size.y;
+}
+
+M_INLINED depth_type
+renderer_depth_from_distance(float planar_distance)
+{
+  /* Compared first, the scaled draw distance can round down to just below the maximum */
+  return planar_distance >= RENDERER_DRAW_DISTANCE
+    ? RENDERER_DEPTH_MAX
+    : (depth_type)(planar_distance * (RENDERER_DEPTH_MAX / RENDERER_DRAW_DISTANCE));
+}
+
+M_INLINED float
+renderer_distance_from_depth(depth_type depth)
+{
+  return depth * (RENDERER_DRAW_DISTANCE / RENDERER_DEPTH_MAX);
+}
 
 #if defined(RAYCASTER_DEBUG) && !defined(RAYCASTER_PARALLEL_RENDERING)
   extern void (*renderer_step)(const renderer*);
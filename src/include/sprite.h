@@ -0,0 +1,21 @@
+#ifndef RAYCASTER_SPRITE_INCLUDED
+#define RAYCASTER_SPRITE_INCLUDED
+
+#include "entity.h"
+#include "texture.h"
+
+/*
+ * Camera-facing billboard. Entity z is the bottom of the sprite
+ * and the texture is stretched over width x height world units.
+ */
+typedef struct sprite {
+  entity entity;
+  texture_ref texture;
+  float width,
+        height;
+} sprite;
+
+void
+sprite_set_position(sprite *this, vec3f position);
+
+#endif
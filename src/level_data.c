@@ -1,33 +1,410 @@
 #include "level_data.h"
 #include "polygon.h"
 #include <assert.h>
+#include <stddef.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+  #define LEVEL_DATA_MMAP
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <fcntl.h>
+  #include <unistd.h>
+#endif
 
 #define XY(V) (int)V.x, (int)V.y
+#define ARENA_ALIGNMENT 16
+
+/* Translate a pointer into one array to the same element of another */
+#define REMAP(PTR, FROM, TO) ((PTR) ? (TO) + ((PTR) - (FROM)) : NULL)
+
+#define LEVEL_FILE_VERSION 1
+
+typedef struct level_file_header {
+  uint32_t magic,
+           version,
+           /* Sizes of what the file holds as is, any mismatch means another struct layout */
+           pointer_size,
+           level_size,
+           linedef_size,
+           sector_size,
+           cell_size,
+           segment_size;
+  uint64_t arena_size,
+           lights_count,
+           sprites_count;
+} level_file_header;
+
+typedef struct level_file_light {
+  float position[3],
+        radius,
+        strength;
+} level_file_light;
+
+typedef struct level_file_sprite {
+  float position[3],
+        width,
+        height;
+  texture_ref texture;
+} level_file_sprite;
+
+static void
+update_light_segments(level_data*, light*, vec3f);
+
+static size_t
+collect_light_linedefs(const map_cache*, vec2f, float, uint32_t**, size_t, size_t*);
+
+static int
+compare_indices(const void*, const void*);
+
+static bool
+linedef_segment_contains_light(const linedef_segment*, const light_pool*, const light*);
+
+static size_t
+level_data_pack_into(uint8_t*, const level_data*);
+
+static void
+level_data_free_scratch(level_data*);
 
 static bool
-linedef_segment_contains_light(const linedef_segment*, const light*);
+level_data_check(const level_data*, size_t);
+
+static void
+level_data_relocate(level_data*, uintptr_t, uintptr_t);
+
+static void
+level_file_header_init(level_file_header*, size_t, size_t, size_t);
+
+static bool
+level_file_header_valid(const level_file_header*);
+
+static level_data*
+level_data_add_file_entities(level_data*, const level_file_header*, const uint8_t*);
+
+static void*
+arena_take(uint8_t*, size_t*, size_t);
+
+static void*
+chunk_slot(void***, size_t, size_t);
+
+static uint32_t*
+pack_words(uint8_t*, size_t*, const uint32_t*, size_t);
+
+static void*
+hash_layout(level_data_hash*, uint8_t*, size_t*, size_t);
+
+static void
+hash_insert(level_data_hash*, uint32_t, int32_t);
+
+static uint32_t
+vertex_hash_key(int32_t, int32_t);
+
+static uint32_t
+edge_hash_key(const level_data*, const vertex*, const vertex*);
+
+static int32_t
+find_vertex_index(const level_data*, vec2f);
+
+/*
+ * Prepares an empty level for building, with room for the given number of
+ * vertices (and linedefs) and sectors.
+ */
+void
+level_data_init_scratch(level_data *this, size_t max_vertices, size_t max_sectors)
+{
+  size_t size = 0;
+  uint8_t *hashes;
+
+  this->vertices = malloc(max_vertices * sizeof(vertex));
+  this->linedefs = malloc(max_vertices * sizeof(linedef));
+  this->sectors = malloc(max_sectors * sizeof(sector));
+
+  /* Both hashes share one block, starting with the vertex hash */
+  hash_layout(&this->vertex_hash, NULL, &size, max_vertices);
+  hash_layout(&this->edge_hash, NULL, &size, max_vertices);
+  hashes = malloc(size);
+  size = 0;
+  hash_layout(&this->vertex_hash, hashes, &size, max_vertices);
+  hash_layout(&this->edge_hash, hashes, &size, max_vertices);
+}
+
+/*
+ * Moves a level built into scratch storage into a single allocation holding
+ * exact-size arrays for everything the level references. The scratch
+ * storage is released. The result is freed with level_data_free.
+ */
+level_data*
+level_data_pack(level_data *scratch)
+{
+  const size_t size = level_data_pack_into(NULL, scratch);
+  uint8_t *arena = malloc(size);
+
+  level_data_pack_into(arena, scratch);
+  level_data_free_scratch(scratch);
+
+  IF_DEBUG(printf("\tPacked level into %zu bytes\n", size))
+
+  return (level_data*)arena;
+}
+
+void
+level_data_free(level_data *this)
+{
+  register size_t i;
+
+  if (!this) {
+    return;
+  }
+
+  for (i = 0; i * LEVEL_DATA_CHUNK_SIZE < this->lights_count; ++i) {
+    free(this->light_chunks[i]);
+  }
+
+  for (i = 0; i * LEVEL_DATA_CHUNK_SIZE < this->sprites_count; ++i) {
+    free(this->sprite_chunks[i]);
+  }
+
+  light_pool_free(&this->cache.light_pool);
+  free(this->light_chunks);
+  free(this->sprite_chunks);
+
+#ifdef LEVEL_DATA_MMAP
+  if (this->mapped_size) {
+    munmap((uint8_t*)this - LEVEL_FILE_HEADER_SIZE, this->mapped_size);
+    return;
+  }
+#endif
+
+  free(this);
+}
+
+/*
+ * Writes a copy of the packed level without anything added at runtime,
+ * its pointers turned into offsets, then the lights and sprites to add
+ * back when it's loaded.
+ */
+bool
+level_data_save(const level_data *this, const char *path)
+{
+  register size_t i, j;
+  int side;
+  level_file_header header;
+  level_file_light file_light;
+  level_file_sprite file_sprite;
+  uint8_t padding[LEVEL_FILE_HEADER_SIZE] = { 0 };
+  const light *lite;
+  const sprite *sprt;
+  const size_t size = level_data_pack_into(NULL, this);
+  const size_t cells_count = this->cache.cells ? this->cache.w * this->cache.h : 0;
+  level_data *copy = malloc(size);
+  FILE *file;
+  bool written;
+
+  level_data_pack_into((uint8_t*)copy, this);
+
+  copy->lights_count = copy->sprites_count = copy->entities_count = 0;
+  copy->light_chunks = NULL;
+  copy->sprite_chunks = NULL;
+  copy->sprites_max_width = 0.f;
+  copy->cache.light_pool = (light_pool) { 0 };
+  copy->mapped_size = 0;
+
+  for (i = 0; i < cells_count; ++i) {
+    copy->cache.cells[i].lights = (light_list) { 0 };
+    copy->cache.cells[i].entities = NULL;
+  }
+
+  for (i = 0; i < copy->linedefs_count; ++i) {
+    for (side = 0; side < 2; ++side) {
+      for (j = 0; copy->linedefs[i].side[side].segments && j < copy->linedefs[i].segments; ++j) {
+        copy->linedefs[i].side[side].segments[j].lights = (light_list) { 0 };
+      }
+    }
+  }
+
+  level_data_relocate(copy, (uintptr_t)copy, 0);
+
+  level_file_header_init(&header, size, this->lights_count, this->sprites_count);
+
+  if (!(file = fopen(path, "wb"))) {
+    free(copy);
+    return false;
+  }
+
+  written = fwrite(&header, sizeof(header), 1, file) == 1
+         && fwrite(padding, LEVEL_FILE_HEADER_SIZE - sizeof(header), 1, file) == 1
+         && fwrite(copy, size, 1, file) == 1;
+
+  for (i = 0; written && i < this->lights_count; ++i) {
+    lite = level_data_light_at(this, i);
+    file_light = (level_file_light) {
+      { lite->entity.position.x, lite->entity.position.y, lite->entity.z },
+      lite->radius,
+      lite->strength
+    };
+    written = fwrite(&file_light, sizeof(file_light), 1, file) == 1;
+  }
+
+  for (i = 0; written && i < this->sprites_count; ++i) {
+    sprt = level_data_sprite_at(this, i);
+    file_sprite = (level_file_sprite) {
+      { sprt->entity.position.x, sprt->entity.position.y, sprt->entity.z },
+      sprt->width,
+      sprt->height,
+      sprt->texture
+    };
+    written = fwrite(&file_sprite, sizeof(file_sprite), 1, file) == 1;
+  }
+
+  free(copy);
+
+  return (fclose(file) == 0) && written;
+}
+
+/*
+ * Maps a level saved with level_data_save, or reads it where there's no
+ * mmap. Returns NULL if the file can't be read, was saved by a build
+ * with another struct layout, or points outside of itself.
+ */
+level_data*
+level_data_load(const char *path)
+{
+  level_file_header header;
+  level_data *level;
+  size_t entities_size;
+
+#ifdef LEVEL_DATA_MMAP
+  struct stat info;
+  uint8_t *mapping;
+  const int fd = open(path, O_RDONLY);
+
+  if (fd < 0) {
+    return NULL;
+  }
+
+  if (fstat(fd, &info) || (size_t)info.st_size < LEVEL_FILE_HEADER_SIZE) {
+    close(fd);
+    return NULL;
+  }
+
+  /* Private, so the level can change at runtime without touching the file */
+  mapping = mmap(NULL, info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if (mapping == MAP_FAILED) {
+    return NULL;
+  }
+
+  memcpy(&header, mapping, sizeof(header));
+  entities_size = header.lights_count * sizeof(level_file_light) + header.sprites_count * sizeof(level_file_sprite);
+
+  if (!level_file_header_valid(&header) ||
+      (size_t)info.st_size != LEVEL_FILE_HEADER_SIZE + header.arena_size + entities_size) {
+    munmap(mapping, info.st_size);
+    return NULL;
+  }
+
+  level = (level_data*)(mapping + LEVEL_FILE_HEADER_SIZE);
+
+  if (!level_data_check(level, header.arena_size)) {
+    munmap(mapping, info.st_size);
+    return NULL;
+  }
+
+  level_data_relocate(level, 0, (uintptr_t)level);
+
+  level->mapped_size = info.st_size;
+
+  return level_data_add_file_entities(level, &header, (uint8_t*)level + header.arena_size);
+#else
+  uint8_t *entities;
+  FILE *file = fopen(path, "rb");
+
+  if (!file) {
+    return NULL;
+  }
+
+  if (fread(&header, sizeof(header), 1, file) != 1 || fseek(file, LEVEL_FILE_HEADER_SIZE, SEEK_SET)) {
+    fclose(file);
+    return NULL;
+  }
+
+  if (!level_file_header_valid(&header)) {
+    fclose(file);
+    return NULL;
+  }
+
+  entities_size = header.lights_count * sizeof(level_file_light) + header.sprites_count * sizeof(level_file_sprite);
+  level = malloc(header.arena_size);
+  entities = malloc(entities_size + 1);
+
+  if (!level || !entities ||
+      fread(level, header.arena_size, 1, file) != 1 ||
+      fread(entities, 1, entities_size, file) != entities_size) {
+    fclose(file);
+    free(entities);
+    free(level);
+    return NULL;
+  }
+
+  fclose(file);
+
+  if (!level_data_check(level, header.arena_size)) {
+    free(entities);
+    free(level);
+    return NULL;
+  }
+
+  level_data_relocate(level, 0, (uintptr_t)level);
 
-/* FIND a vertex at given point OR CREATE a new one */
+  level_data_add_file_entities(level, &header, entities);
+  free(entities);
+
+  return level;
+#endif
+}
+
+/*
+ * FIND a vertex at given point OR CREATE a new one. Vertices are hashed by
+ * their position rounded down to whole units, so any vertex closer than
+ * one unit lies in the same or one of the eight neighbouring buckets.
+ */
 vertex*
 level_data_get_vertex(level_data *this, vec2f point)
 {
-  register size_t i;
+  register int32_t i, x, y;
+  int32_t found = -1;
+  const int32_t qx = (int32_t)floorf(point.x);
+  const int32_t qy = (int32_t)floorf(point.y);
+  uint32_t key;
 
   if (!this->vertices_count) {
     this->min = VEC2F(FLT_MAX, FLT_MAX);
     this->max = VEC2F(-FLT_MAX, -FLT_MAX);
   }
 
-  for (i = 0; i < this->vertices_count; ++i) {
-    if (math_length(vec2f_sub(this->vertices[i].point, point)) < 1) {
-      return &this->vertices[i];
+  for (y = qy - 1; y <= qy + 1; ++y) {
+    for (x = qx - 1; x <= qx + 1; ++x) {
+      key = vertex_hash_key(x, y) & this->vertex_hash.mask;
+
+      for (i = this->vertex_hash.buckets[key]; i != -1; i = this->vertex_hash.next[i]) {
+        /* Prefer the oldest vertex in reach, like a linear scan would */
+        if ((found == -1 || i < found) && math_length(vec2f_sub(this->vertices[i].point, point)) < 1) {
+          found = i;
+        }
+      }
     }
   }
 
+  if (found != -1) {
+    return &this->vertices[found];
+  }
+
   this->vertices[this->vertices_count] = (vertex) {
     .point = point
   };
 
+  hash_insert(&this->vertex_hash, vertex_hash_key(qx, qy), this->vertices_count);
+
   if (point.x < this->min.x) { this->min.x = point.x; }
   if (point.y < this->min.y) { this->min.y = point.y; }
   if (point.x > this->max.x) { this->max.x = point.x; }
@@ -40,11 +417,12 @@ level_data_get_vertex(level_data *this, vec2f point)
 linedef*
 level_data_get_linedef(level_data *this, sector *sect, vertex *v0, vertex *v1, texture_ref texture[])
 {
-  register size_t i;
+  register int32_t i;
   linedef *line;
+  const uint32_t key = edge_hash_key(this, v0, v1);
 
   /* Check for existing linedef with these vertices */
-  for (i = 0; i < this->linedefs_count; ++i) {
+  for (i = this->edge_hash.buckets[key & this->edge_hash.mask]; i != -1; i = this->edge_hash.next[i]) {
     line = &this->linedefs[i];
 
     if ((line->v0 == v0 && line->v1 == v1) || (line->v0 == v1 && line->v1 == v0)) {
@@ -98,6 +476,7 @@ level_data_get_linedef(level_data *this, sector *sect, vertex *v0, vertex *v1, t
   };
 
   linedef_create_segments_for_side(&this->linedefs[this->linedefs_count], 0);
+  hash_insert(&this->edge_hash, key, this->linedefs_count);
 
   IF_DEBUG(printf("\t\tNew linedef (0x%p): (%d,%d) <-> (%d,%d) (Front: 0x%p, Back: 0x%p)\n",
     (void*)&this->linedefs[this->linedefs_count], XY(v0->point), XY(v1->point), (void*)sect, NULL
@@ -123,11 +502,6 @@ level_data_create_sector_from_polygon(level_data *this, polygon *poly)
   sect->linedefs = NULL;
   sect->linedefs_count = 0;
 
-#ifdef RAYCASTER_PRERENDER_VISCHECK
-  sect->visible_linedefs = NULL;
-  sect->visible_linedefs_count = 0;
-#endif
-
   for (i = 0; i < poly->vertices_count; ++i) {
     linedef_update_floor_ceiling_limits(
       sector_add_linedef(
@@ -148,14 +522,10 @@ level_data_create_sector_from_polygon(level_data *this, polygon *poly)
 
 light*
 level_data_add_light(level_data *this, vec3f pos, float r, float s) {
-  if (this->lights_count == 64) {
-    return NULL;
-  }
-
-  light *new_light = &this->lights[this->lights_count++];
+  light *new_light = chunk_slot((void***)&this->light_chunks, this->lights_count++, sizeof(light));
 
   new_light->entity = (entity) {
-    .level = this,
+    .level = NULL,
     .sector = NULL,
     .position = VEC2F(pos.x, pos.y),
     .z = pos.z,
@@ -168,22 +538,120 @@ level_data_add_light(level_data *this, vec3f pos, float r, float s) {
   new_light->radius_sq_inverse = 1.f / new_light->radius_sq;
   new_light->strength = s;
 
-  level_data_update_lights(this);
+  level_data_add_entity(this, &new_light->entity);
+  level_data_update_light(this, new_light, pos);
   map_cache_process_light(&this->cache, new_light, pos);
 
   return new_light;
 }
 
+sprite*
+level_data_add_sprite(level_data *this, vec3f pos, float w, float h, texture_ref texture) {
+  sprite *new_sprite = chunk_slot((void***)&this->sprite_chunks, this->sprites_count++, sizeof(sprite));
+
+  new_sprite->entity = (entity) {
+    .level = NULL,
+    .sector = NULL,
+    .position = VEC2F(pos.x, pos.y),
+    .z = pos.z,
+    .data = (void*)new_sprite,
+    .type = ENTITY_SPRITE
+  };
+
+  new_sprite->texture = texture;
+  new_sprite->width = w;
+  new_sprite->height = h;
+
+  this->sprites_max_width = math_max(this->sprites_max_width, w);
+
+  level_data_add_entity(this, &new_sprite->entity);
+
+  return new_sprite;
+}
+
+sector*
+level_data_find_sector(level_data *this, vec2f point)
+{
+  register size_t i;
+
+  if (this->cache.cells) {
+    return map_cache_find_sector(&this->cache, point);
+  }
+
+  for (i = 0; i < this->sectors_count; ++i) {
+    if (sector_point_inside(&this->sectors[i], point)) {
+      return &this->sectors[i];
+    }
+  }
+
+  return NULL;
+}
+
+/* Linedef between the vertices at the given points, in either direction, or NULL */
+linedef*
+level_data_find_linedef(level_data *this, vec2f p0, vec2f p1)
+{
+  register int32_t i;
+  linedef *line;
+  const int32_t i0 = find_vertex_index(this, p0);
+  const int32_t i1 = find_vertex_index(this, p1);
+
+  if (i0 == -1 || i1 == -1) {
+    return NULL;
+  }
+
+  const vertex *v0 = &this->vertices[i0], *v1 = &this->vertices[i1];
+  const uint32_t key = edge_hash_key(this, v0, v1);
+
+  for (i = this->edge_hash.buckets[key & this->edge_hash.mask]; i != -1; i = this->edge_hash.next[i]) {
+    line = &this->linedefs[i];
+
+    if ((line->v0 == v0 && line->v1 == v1) || (line->v0 == v1 && line->v1 == v0)) {
+      return line;
+    }
+  }
+
+  return NULL;
+}
+
+/*
+ * Registers the entity with the level, after which its sector and
+ * map cache cell are kept up to date by entity_set_position.
+ */
+void
+level_data_add_entity(level_data *this, entity *ent)
+{
+  ent->level = this;
+  ent->sector = level_data_find_sector(this, ent->position);
+  ent->cell = NULL;
+  ent->cell_prev = ent->cell_next = NULL;
+
+  map_cache_link_entity(&this->cache, ent);
+
+  this->entities_count++;
+}
+
+void
+level_data_remove_entity(level_data *this, entity *ent)
+{
+  if (ent->level != this) {
+    return;
+  }
+
+  map_cache_unlink_entity(&this->cache, ent);
+
+  ent->level = NULL;
+  ent->sector = NULL;
+
+  this->entities_count--;
+}
+
 void
 level_data_update_lights(level_data *this)
 {
-  int i, si, li, segi, side;
-  float sign;
-  light *lite;
+  int i, si, li, segi;
   sector *sect;
   linedef *line;
-  linedef_segment *seg;
-  vec2f pos2d;
 
   for (si = 0; si < this->sectors_count; ++si) {
     sect = &this->sectors[si];
@@ -191,79 +659,778 @@ level_data_update_lights(level_data *this)
     for (li = 0; li < sect->linedefs_count; ++li) {
       line = sect->linedefs[li];
       for (segi = 0; segi < line->segments; ++segi) {
-        line->side[0].segments[segi].lights_count = 0;
+        line->side[0].segments[segi].lights.count = 0;
         if (line->side[1].segments) {
-          line->side[1].segments[segi].lights_count = 0;
+          line->side[1].segments[segi].lights.count = 0;
         }
       }
     }
   }
 
   for (i = 0; i < this->lights_count; ++i) {
-    lite = &this->lights[i];
+    light *lite = level_data_light_at(this, i);
+    update_light_segments(this, lite, entity_world_position(&lite->entity));
+  }
+}
+
+void
+level_data_update_light(level_data *this, light *lite, vec3f previous_position)
+{
+  update_light_segments(this, lite, previous_position);
+}
 
-    pos2d = VEC2F(lite->entity.position.x, lite->entity.position.y);
+/*
+ * Takes the light off the wall segments it could reach from where it was,
+ * then adds it back to the ones it reaches from where it is now. Only
+ * linedefs listed in map cache cells under either light circle are visited.
+ */
+static void
+update_light_segments(level_data *this, light *lite, vec3f previous_position)
+{
+  register size_t i;
+  int segi, side;
+  float sign;
+  sector *sect;
+  linedef *line;
+  linedef_segment *seg;
+  uint32_t *indices = NULL;
+  size_t count, capacity = 0;
+  light_pool *pool = &this->cache.light_pool;
+  const vec2f pos2d = VEC2F(lite->entity.position.x, lite->entity.position.y);
 
-    /* Find all sectors the light circle touches */
-    for (si = 0; si < this->sectors_count; ++si) {
-      sect = &this->sectors[si];
+  count = collect_light_linedefs(&this->cache, VEC2F(previous_position.x, previous_position.y), lite->radius, &indices, 0, &capacity);
+  count = collect_light_linedefs(&this->cache, pos2d, lite->radius, &indices, count, &capacity);
 
-      for (li = 0; li < sect->linedefs_count; ++li) {
-        line = sect->linedefs[li];
-        side = sect==line->side[0].sector?0:1;
-        sign = math_sign(line->v0->point, line->v1->point, pos2d);
+  if (!count) {
+    return;
+  }
 
-        for (segi = 0; segi < line->segments; ++segi) {
-          seg = &line->side[side].segments[segi];
+  /* Linedefs crossing several cells are listed more than once */
+  qsort(indices, count, sizeof(uint32_t), compare_indices);
+
+  for (i = 0; i < count; ++i) {
+    if (i > 0 && indices[i] == indices[i-1]) {
+      continue;
+    }
+
+    line = &this->linedefs[indices[i]];
+    sign = math_sign(line->v0->point, line->v1->point, pos2d);
+
+    for (side = 0; side < 2; ++side) {
+      if (!(sect = line->side[side].sector)) {
+        continue;
+      }
+
+      for (segi = 0; segi < line->segments; ++segi) {
+        seg = &line->side[side].segments[segi];
+
+        light_list_remove(&seg->lights, pool, lite);
 
 #ifdef RAYCASTER_DYNAMIC_SHADOWS
-          /*
-           * In dynamic shadow mode, a surface is lightable when the line simply
-           * intersects the light circle. Pixel perfect ray check is performed
-           * in the renderer later on.
-           */
-          if (math_line_segment_point_distance(seg->p0, seg->p1, pos2d) <= lite->radius) {
-            if ((side == 0 ? (sign < 0) : (sign > 0)) &&
-                seg->lights_count < MAX_LIGHTS_PER_SURFACE &&
-                !linedef_segment_contains_light(seg, lite)
-            ) {
-              seg->lights[seg->lights_count++] = lite;
-            }
+        /*
+         * In dynamic shadow mode, a surface is lightable when the line simply
+         * intersects the light circle. Pixel perfect ray check is performed
+         * in the renderer later on.
+         */
+        if (math_line_segment_point_distance(seg->p0, seg->p1, pos2d) <= lite->radius) {
+          if ((side == 0 ? (sign < 0) : (sign > 0)) &&
+              !linedef_segment_contains_light(seg, pool, lite)
+          ) {
+            light_list_insert(&seg->lights, pool, lite);
           }
+        }
 #else
-          /*
-           * In non-shadowed version, a wall segment is lit when either
-           * vertex has a line of sight to the light.
-           */
-          if ((side == 0 ? (sign < 0) : (sign > 0)) &&
-              seg->lights_count < MAX_LIGHTS_PER_SURFACE &&
-              !linedef_segment_contains_light(seg, lite)
+        /*
+         * In non-shadowed version, a wall segment is lit when either
+         * vertex has a line of sight to the light.
+         */
+        if ((side == 0 ? (sign < 0) : (sign > 0)) &&
+            (!lite->entity.sector || level_data_sectors_visible(this, sect, lite->entity.sector)) &&
+            !linedef_segment_contains_light(seg, pool, lite)
+        ) {
+          vec3f world_pos = entity_world_position(&lite->entity);
+
+          if (!map_cache_intersect_3d(&this->cache, VEC3F(seg->p0.x, seg->p0.y, sect->floor.height), world_pos) ||
+              !map_cache_intersect_3d(&this->cache, VEC3F(seg->p1.x, seg->p1.y, sect->floor.height), world_pos) ||
+              !map_cache_intersect_3d(&this->cache, VEC3F(seg->p0.x, seg->p0.y, sect->ceiling.height), world_pos) ||
+              !map_cache_intersect_3d(&this->cache, VEC3F(seg->p1.x, seg->p1.y, sect->ceiling.height), world_pos)
           ) {
-            vec3f world_pos = entity_world_position(&lite->entity);
-
-            if (!map_cache_intersect_3d(&this->cache, VEC3F(seg->p0.x, seg->p0.y, sect->floor.height), world_pos) ||
-                !map_cache_intersect_3d(&this->cache, VEC3F(seg->p1.x, seg->p1.y, sect->floor.height), world_pos) ||
-                !map_cache_intersect_3d(&this->cache, VEC3F(seg->p0.x, seg->p0.y, sect->ceiling.height), world_pos) ||
-                !map_cache_intersect_3d(&this->cache, VEC3F(seg->p1.x, seg->p1.y, sect->ceiling.height), world_pos)
-            ) {
-              seg->lights[seg->lights_count++] = lite;
-            }
+            light_list_insert(&seg->lights, pool, lite);
           }
+        }
 #endif
+      }
+    }
+  }
+
+  free(indices);
+}
+
+/*
+ * Appends the linedefs listed by map cache cells under the light circle,
+ * growing the list as needed. Gives the new count.
+ */
+static size_t
+collect_light_linedefs(const map_cache *cache, vec2f center, float radius, uint32_t **list, size_t count, size_t *capacity)
+{
+  register int32_t x, y;
+  register uint32_t li;
+  const vec2f local = vec2f_sub(center, cache->origin);
+  const int32_t x0 = (int32_t)math_clamp((local.x - radius) / cache->cell_size, 0, cache->w - 1),
+                y0 = (int32_t)math_clamp((local.y - radius) / cache->cell_size, 0, cache->h - 1),
+                x1 = (int32_t)math_clamp((local.x + radius) / cache->cell_size, 0, cache->w - 1),
+                y1 = (int32_t)math_clamp((local.y + radius) / cache->cell_size, 0, cache->h - 1);
+
+  for (y = y0; y <= y1; ++y) {
+    for (x = x0; x <= x1; ++x) {
+      for (li = cache->cell_offsets[y*cache->w+x]; li < cache->cell_offsets[y*cache->w+x+1]; ++li) {
+        if (count == *capacity) {
+          *capacity = M_MAX(64, *capacity * 2);
+          *list = realloc(*list, *capacity * sizeof(uint32_t));
         }
+
+        (*list)[count++] = cache->cell_linedefs[li];
       }
     }
   }
+
+  return count;
+}
+
+static int
+compare_indices(const void *a, const void *b)
+{
+  const uint32_t ia = *(const uint32_t*)a, ib = *(const uint32_t*)b;
+  return (ia > ib) - (ia < ib);
 }
 
 static bool
-linedef_segment_contains_light(const linedef_segment *this, const light *lt)
+linedef_segment_contains_light(const linedef_segment *this, const light_pool *pool, const light *lt)
 {
   size_t i;
-  for (i = 0; i < this->lights_count; ++i) {
-    if (this->lights[i] == lt) {
+  light **lights = light_list_lights(&this->lights, pool);
+  for (i = 0; i < this->lights.count; ++i) {
+    if (lights[i] == lt) {
       return true;
     }
   }
   return false;
 }
+
+static void*
+arena_take(uint8_t *base, size_t *offset, size_t size)
+{
+  void *ptr;
+  *offset = (*offset + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+  ptr = base ? base + *offset : NULL;
+  *offset += size;
+  return ptr;
+}
+
+/* Copies 'count' words into the arena, or nothing if there are none */
+static uint32_t*
+pack_words(uint8_t *base, size_t *offset, const uint32_t *words, size_t count)
+{
+  uint32_t *packed;
+
+  if (!words) {
+    return NULL;
+  }
+
+  packed = arena_take(base, offset, count * sizeof(uint32_t));
+
+  if (base) {
+    memcpy(packed, words, count * sizeof(uint32_t));
+  }
+
+  return packed;
+}
+
+/*
+ * Lays out the packed level, returning its size. When 'base' is NULL
+ * nothing is written, which is used to size the allocation first.
+ */
+static size_t
+level_data_pack_into(uint8_t *base, const level_data *scratch)
+{
+  register size_t i, j;
+  size_t offset = 0, cell_sectors_count = 0;
+  int side;
+  level_data *level;
+  linedef **lines;
+  linedef_segment *segments;
+  const sector *from_sector;
+  const linedef *from_line;
+  const map_cache_cell *from_cell;
+  map_cache_cell *cell;
+  sector **cell_sectors;
+  uint32_t *sector_visibility, *linedef_visibility_offsets, *linedef_visibility;
+  level_data_hash vertex_hash, edge_hash;
+  const size_t cells_count = scratch->cache.cells ? scratch->cache.w * scratch->cache.h : 0;
+
+  level = arena_take(base, &offset, sizeof(level_data));
+  vertex *vertices = arena_take(base, &offset, scratch->vertices_count * sizeof(vertex));
+  linedef *linedefs = arena_take(base, &offset, scratch->linedefs_count * sizeof(linedef));
+  sector *sectors = arena_take(base, &offset, scratch->sectors_count * sizeof(sector));
+  map_cache_cell *cells = arena_take(base, &offset, cells_count * sizeof(map_cache_cell));
+
+  if (base) {
+    *level = *scratch;
+    level->vertices = vertices;
+    level->linedefs = linedefs;
+    level->sectors = sectors;
+    level->cache.cells = cells_count ? cells : NULL;
+    memcpy(vertices, scratch->vertices, scratch->vertices_count * sizeof(vertex));
+    memcpy(linedefs, scratch->linedefs, scratch->linedefs_count * sizeof(linedef));
+    memcpy(sectors, scratch->sectors, scratch->sectors_count * sizeof(sector));
+    memcpy(cells, scratch->cache.cells, cells_count * sizeof(map_cache_cell));
+  }
+
+  for (i = 0; i < scratch->sectors_count; ++i) {
+    from_sector = &scratch->sectors[i];
+    lines = arena_take(base, &offset, from_sector->linedefs_count * sizeof(linedef*));
+
+    if (base) {
+      for (j = 0; j < from_sector->linedefs_count; ++j) {
+        lines[j] = REMAP(from_sector->linedefs[j], scratch->linedefs, linedefs);
+      }
+      sectors[i].linedefs = lines;
+    }
+  }
+
+  for (i = 0; i < scratch->linedefs_count; ++i) {
+    from_line = &scratch->linedefs[i];
+
+    for (side = 0; side < 2; ++side) {
+      if (!from_line->side[side].segments) {
+        continue;
+      }
+
+      segments = arena_take(base, &offset, from_line->segments * sizeof(linedef_segment));
+
+      if (base) {
+        memcpy(segments, from_line->side[side].segments, from_line->segments * sizeof(linedef_segment));
+        linedefs[i].side[side].segments = segments;
+      }
+    }
+
+    if (base) {
+      linedefs[i].v0 = REMAP(from_line->v0, scratch->vertices, vertices);
+      linedefs[i].v1 = REMAP(from_line->v1, scratch->vertices, vertices);
+      linedefs[i].side[0].sector = REMAP(from_line->side[0].sector, scratch->sectors, sectors);
+      linedefs[i].side[1].sector = REMAP(from_line->side[1].sector, scratch->sectors, sectors);
+    }
+  }
+
+  for (i = 0; i < cells_count; ++i) {
+    cell_sectors_count += scratch->cache.cells[i].sectors_count;
+  }
+
+  /* Cell lists stay contiguous, in cell order */
+  const size_t cell_linedefs_count = cells_count ? scratch->cache.cell_offsets[cells_count] : 0;
+  uint32_t *cell_offsets = arena_take(base, &offset, (cells_count + 1) * sizeof(uint32_t));
+  uint32_t *cell_linedefs = arena_take(base, &offset, cell_linedefs_count * sizeof(uint32_t));
+  map_cache_line *cache_lines = arena_take(base, &offset, scratch->linedefs_count * sizeof(map_cache_line));
+  const size_t blocks_count = cells_count ? scratch->cache.blocks_w * scratch->cache.blocks_h : 0;
+  map_cache_block *blocks = arena_take(base, &offset, blocks_count * sizeof(map_cache_block));
+  cell_sectors = arena_take(base, &offset, cell_sectors_count * sizeof(sector*));
+
+  if (base && cells_count) {
+    level->cache.cell_offsets = cell_offsets;
+    level->cache.cell_linedefs = cell_linedefs;
+    level->cache.lines = cache_lines;
+    level->cache.blocks = blocks;
+    level->cache.sectors = cell_sectors;
+
+    memcpy(cell_offsets, scratch->cache.cell_offsets, (cells_count + 1) * sizeof(uint32_t));
+    memcpy(cell_linedefs, scratch->cache.cell_linedefs, cell_linedefs_count * sizeof(uint32_t));
+    memcpy(cache_lines, scratch->cache.lines, scratch->linedefs_count * sizeof(map_cache_line));
+    memcpy(blocks, scratch->cache.blocks, blocks_count * sizeof(map_cache_block));
+
+    for (i = 0; i < scratch->linedefs_count; ++i) {
+      linedefs[i].cache = &level->cache;
+      linedefs[i].cache_line = REMAP(scratch->linedefs[i].cache_line, scratch->cache.lines, cache_lines);
+    }
+
+    for (i = 0; i < cells_count; ++i) {
+      from_cell = &scratch->cache.cells[i];
+      cell = &cells[i];
+      cell->sectors = cell_sectors;
+      for (j = 0; j < from_cell->sectors_count; ++j) {
+        *cell_sectors++ = REMAP(from_cell->sectors[j], scratch->sectors, sectors);
+      }
+    }
+  }
+
+  sector_visibility = pack_words(base, &offset, scratch->sector_visibility, scratch->sectors_count * LEVEL_DATA_VISIBILITY_STRIDE(scratch->sectors_count));
+  linedef_visibility_offsets = pack_words(base, &offset, scratch->linedef_visibility_offsets, scratch->sectors_count + 1);
+  linedef_visibility = pack_words(
+    base,
+    &offset,
+    scratch->linedef_visibility,
+    scratch->linedef_visibility_offsets ? scratch->linedef_visibility_offsets[scratch->sectors_count] : 0
+  );
+
+  if (base) {
+    level->sector_visibility = sector_visibility;
+    level->linedef_visibility_offsets = linedef_visibility_offsets;
+    level->linedef_visibility = linedef_visibility;
+  }
+
+  /* Hashes are rebuilt at their final size, in the original insert order */
+  hash_layout(&vertex_hash, base, &offset, scratch->vertices_count);
+  hash_layout(&edge_hash, base, &offset, scratch->linedefs_count);
+
+  if (base) {
+    level->vertex_hash = vertex_hash;
+    level->edge_hash = edge_hash;
+
+    for (i = 0; i < scratch->vertices_count; ++i) {
+      hash_insert(&level->vertex_hash, vertex_hash_key((int32_t)floorf(vertices[i].point.x), (int32_t)floorf(vertices[i].point.y)), i);
+    }
+
+    for (i = 0; i < scratch->linedefs_count; ++i) {
+      hash_insert(&level->edge_hash, edge_hash_key(level, linedefs[i].v0, linedefs[i].v1), i);
+    }
+  }
+
+  return offset;
+}
+
+static void
+level_data_free_scratch(level_data *this)
+{
+  register size_t i;
+  int side;
+
+  for (i = 0; i < this->sectors_count; ++i) {
+    free(this->sectors[i].linedefs);
+  }
+
+  for (i = 0; i < this->linedefs_count; ++i) {
+    for (side = 0; side < 2; ++side) {
+      free(this->linedefs[i].side[side].segments);
+    }
+  }
+
+  free(this->vertex_hash.buckets);
+  free(this->sector_visibility);
+  free(this->linedef_visibility_offsets);
+  free(this->linedef_visibility);
+  free(this->cache.cells);
+  free(this->cache.cell_offsets);
+  free(this->cache.cell_linedefs);
+  free(this->cache.lines);
+  free(this->cache.blocks);
+  free(this->cache.sectors);
+  free(this->vertices);
+  free(this->linedefs);
+  free(this->sectors);
+}
+
+/*
+ * Checks a level read from a file while its pointers are still offsets:
+ * every array lies within the 'size' bytes of the level, every pointer
+ * and index refers to an element of the array it should, offset lists
+ * only grow, hash chains end, and nothing added at runtime was saved.
+ */
+static bool
+level_data_check(const level_data *this, size_t size)
+{
+  register size_t i, j;
+  int side;
+  size_t cells_count, cell_sectors_count = 0, blocks_count, hash_size, count;
+  const linedef *line;
+  const sector *sect;
+  const map_cache_cell *cell;
+  const map_cache *cache = &this->cache;
+  const level_data_hash *hash;
+  const uint32_t *offsets, *list;
+  const int32_t *buckets, *next;
+  const linedef_segment *segments;
+  const linedef *const *lines;
+  const sector *const *sectors;
+
+/* Where the array an offset refers to is in memory */
+#define AT(PTR) ((const void*)((const uint8_t*)this + (uintptr_t)(PTR)))
+/* Whether COUNT elements starting at the aligned, non-NULL PTR lie within the level */
+#define IN_LEVEL(PTR, COUNT) ( \
+    (PTR) && (uintptr_t)(PTR) < size && (uintptr_t)(PTR) % ARENA_ALIGNMENT == 0 && \
+    (size_t)(COUNT) <= (size - (uintptr_t)(PTR)) / sizeof(*(PTR)) \
+  )
+/* Whether PTR points at one of the first COUNT elements of ARRAY */
+#define IN_ARRAY(PTR, ARRAY, COUNT) ( \
+    (uintptr_t)(PTR) - (uintptr_t)(ARRAY) < (size_t)(COUNT) * sizeof(*(ARRAY)) && \
+    ((uintptr_t)(PTR) - (uintptr_t)(ARRAY)) % sizeof(*(ARRAY)) == 0 \
+  )
+#define CHECK(CONDITION) do { if (!(CONDITION)) { return false; } } while (0)
+
+  CHECK(!this->lights_count && !this->sprites_count && !this->entities_count);
+  CHECK(!this->light_chunks && !this->sprite_chunks && !cache->light_pool.lights && !cache->light_pool.count);
+  CHECK(IN_LEVEL(this->vertices, this->vertices_count) || !this->vertices_count);
+  CHECK(IN_LEVEL(this->linedefs, this->linedefs_count) || !this->linedefs_count);
+  CHECK(IN_LEVEL(this->sectors, this->sectors_count) || !this->sectors_count);
+
+  cells_count = cache->cells ? (size_t)cache->w * cache->h : 0;
+  CHECK(!cache->cells || cells_count);
+
+  for (i = 0; i < this->sectors_count; ++i) {
+    sect = (const sector*)AT(this->sectors) + i;
+    CHECK(IN_LEVEL(sect->linedefs, sect->linedefs_count) || !sect->linedefs_count);
+
+    lines = AT(sect->linedefs);
+    for (j = 0; j < sect->linedefs_count; ++j) {
+      CHECK(IN_ARRAY(lines[j], this->linedefs, this->linedefs_count));
+    }
+  }
+
+  for (i = 0; i < this->linedefs_count; ++i) {
+    line = (const linedef*)AT(this->linedefs) + i;
+    CHECK(IN_ARRAY(line->v0, this->vertices, this->vertices_count));
+    CHECK(IN_ARRAY(line->v1, this->vertices, this->vertices_count));
+    CHECK(line->side[0].sector);
+
+    for (side = 0; side < 2; ++side) {
+      segments = line->side[side].segments;
+      CHECK(!line->side[side].sector || IN_ARRAY(line->side[side].sector, this->sectors, this->sectors_count));
+      CHECK(!line->side[side].sector == !segments);
+      CHECK(!segments || (line->segments && IN_LEVEL(segments, line->segments)));
+
+      for (j = 0; segments && j < line->segments; ++j) {
+        CHECK(!((const linedef_segment*)AT(segments))[j].lights.capacity);
+      }
+    }
+
+    if (cells_count) {
+      CHECK((uintptr_t)line->cache == offsetof(level_data, cache));
+      CHECK(IN_ARRAY(line->cache_line, cache->lines, this->linedefs_count));
+    }
+  }
+
+  if (cells_count) {
+    blocks_count = (size_t)cache->blocks_w * cache->blocks_h;
+
+    CHECK(isfinite(cache->origin.x) && isfinite(cache->origin.y) && isfinite(cache->cell_size));
+    CHECK(cache->cell_size >= MAP_CACHE_MIN_CELL_SIZE);
+    CHECK(cache->blocks_w == ((cache->w - 1) >> MAP_CACHE_BLOCK_SHIFT) + 1);
+    CHECK(cache->blocks_h == ((cache->h - 1) >> MAP_CACHE_BLOCK_SHIFT) + 1);
+    CHECK(IN_LEVEL(cache->cells, cells_count));
+    CHECK(IN_LEVEL(cache->blocks, blocks_count));
+    CHECK(IN_LEVEL(cache->lines, this->linedefs_count) || !this->linedefs_count);
+    CHECK(IN_LEVEL(cache->cell_offsets, cells_count + 1));
+
+    /* Each cell's linedefs follow the previous cell's, starting at 0 */
+    offsets = AT(cache->cell_offsets);
+    CHECK(offsets[0] == 0);
+    for (i = 0; i < cells_count; ++i) {
+      CHECK(offsets[i] <= offsets[i + 1]);
+    }
+    CHECK(IN_LEVEL(cache->cell_linedefs, offsets[cells_count]) || !offsets[cells_count]);
+
+    list = AT(cache->cell_linedefs);
+    for (i = 0; i < offsets[cells_count]; ++i) {
+      CHECK(list[i] < this->linedefs_count);
+    }
+
+    /* Cell sector lists are contiguous too, so their total bounds them all */
+    for (i = 0; i < cells_count; ++i) {
+      cell_sectors_count += ((const map_cache_cell*)AT(cache->cells))[i].sectors_count;
+    }
+    CHECK(IN_LEVEL(cache->sectors, cell_sectors_count) || !cell_sectors_count);
+
+    for (i = 0; i < cells_count; ++i) {
+      cell = (const map_cache_cell*)AT(cache->cells) + i;
+      CHECK(!cell->lights.capacity && !cell->entities);
+      CHECK(
+        (uintptr_t)cell->sectors - (uintptr_t)cache->sectors <= cell_sectors_count * sizeof(sector*) &&
+        ((uintptr_t)cell->sectors - (uintptr_t)cache->sectors) % sizeof(sector*) == 0 &&
+        cell->sectors_count <= cell_sectors_count - ((uintptr_t)cell->sectors - (uintptr_t)cache->sectors) / sizeof(sector*)
+      );
+
+      sectors = AT(cell->sectors);
+      for (j = 0; j < cell->sectors_count; ++j) {
+        CHECK(IN_ARRAY(sectors[j], this->sectors, this->sectors_count));
+      }
+    }
+  }
+
+  /* Buckets and chains hold element indices, each chain only ever going to earlier ones so it ends */
+  for (hash = &this->vertex_hash; hash <= &this->edge_hash; ++hash) {
+    hash_size = (size_t)hash->mask + 1;
+    CHECK(hash->mask < UINT32_MAX && !(hash->mask & hash_size));
+    CHECK(IN_LEVEL(hash->buckets, hash_size));
+
+    count = (hash == &this->vertex_hash) ? this->vertices_count : this->linedefs_count;
+    CHECK(IN_LEVEL(hash->next, count) || !count);
+
+    buckets = AT(hash->buckets);
+    for (j = 0; j < hash_size; ++j) {
+      CHECK(buckets[j] >= -1 && buckets[j] < (int64_t)count);
+    }
+
+    next = AT(hash->next);
+    for (j = 0; j < count; ++j) {
+      CHECK(next[j] >= -1 && next[j] < (int64_t)j);
+    }
+  }
+
+  CHECK(
+    !this->sector_visibility ||
+    IN_LEVEL(this->sector_visibility, this->sectors_count * LEVEL_DATA_VISIBILITY_STRIDE(this->sectors_count))
+  );
+
+  if (this->linedef_visibility_offsets) {
+    CHECK(IN_LEVEL(this->linedef_visibility_offsets, this->sectors_count + 1));
+
+    offsets = AT(this->linedef_visibility_offsets);
+    CHECK(offsets[0] == 0);
+    for (i = 0; i < this->sectors_count; ++i) {
+      CHECK(offsets[i] <= offsets[i + 1]);
+    }
+    CHECK(IN_LEVEL(this->linedef_visibility, offsets[this->sectors_count]) || !offsets[this->sectors_count]);
+
+    /* Sorted without repeats, so a sector never lists more than every linedef */
+    list = AT(this->linedef_visibility);
+    for (i = 0; i < this->sectors_count; ++i) {
+      for (j = offsets[i]; j < offsets[i + 1]; ++j) {
+        CHECK(list[j] < this->linedefs_count && (j == offsets[i] || list[j - 1] < list[j]));
+      }
+    }
+  } else {
+    CHECK(!this->linedef_visibility);
+  }
+
+#undef AT
+#undef IN_LEVEL
+#undef IN_ARRAY
+#undef CHECK
+
+  return true;
+}
+
+/*
+ * Moves every pointer within the packed level from being relative to
+ * 'from' to being relative to 'to'. NULL stays NULL, which is fine as
+ * nothing points at the start of the level itself.
+ */
+static void
+level_data_relocate(level_data *this, uintptr_t from, uintptr_t to)
+{
+  register size_t i, j;
+  int side;
+  linedef *linedefs;
+  sector *sectors;
+  map_cache_cell *cells;
+  linedef **lines;
+  sector **cell_sectors;
+  size_t cells_count;
+
+/* Where the array a pointer refers to is in memory right now, before or after relocating */
+#define ADDRESS(PTR) ((void*)((uintptr_t)(PTR) - from + (uintptr_t)this))
+#define RELOCATE(PTR) ((PTR) = (PTR) ? (void*)((uintptr_t)(PTR) - from + to) : NULL)
+
+  cells_count = this->cache.cells ? (size_t)this->cache.w * this->cache.h : 0;
+  linedefs = ADDRESS(this->linedefs);
+  sectors = ADDRESS(this->sectors);
+  cells = ADDRESS(this->cache.cells);
+
+  for (i = 0; i < this->sectors_count; ++i) {
+    lines = ADDRESS(sectors[i].linedefs);
+    for (j = 0; j < sectors[i].linedefs_count; ++j) {
+      RELOCATE(lines[j]);
+    }
+    RELOCATE(sectors[i].linedefs);
+  }
+
+  for (i = 0; i < this->linedefs_count; ++i) {
+    RELOCATE(linedefs[i].v0);
+    RELOCATE(linedefs[i].v1);
+    for (side = 0; side < 2; ++side) {
+      RELOCATE(linedefs[i].side[side].sector);
+      RELOCATE(linedefs[i].side[side].segments);
+    }
+    RELOCATE(linedefs[i].cache);
+    RELOCATE(linedefs[i].cache_line);
+  }
+
+  for (i = 0; i < cells_count; ++i) {
+    cell_sectors = ADDRESS(cells[i].sectors);
+    for (j = 0; j < cells[i].sectors_count; ++j) {
+      RELOCATE(cell_sectors[j]);
+    }
+    RELOCATE(cells[i].sectors);
+  }
+
+  RELOCATE(this->vertices);
+  RELOCATE(this->linedefs);
+  RELOCATE(this->sectors);
+  RELOCATE(this->vertex_hash.buckets);
+  RELOCATE(this->vertex_hash.next);
+  RELOCATE(this->edge_hash.buckets);
+  RELOCATE(this->edge_hash.next);
+  RELOCATE(this->sector_visibility);
+  RELOCATE(this->linedef_visibility_offsets);
+  RELOCATE(this->linedef_visibility);
+  RELOCATE(this->cache.cells);
+  RELOCATE(this->cache.blocks);
+  RELOCATE(this->cache.cell_offsets);
+  RELOCATE(this->cache.cell_linedefs);
+  RELOCATE(this->cache.lines);
+  RELOCATE(this->cache.sectors);
+
+#undef ADDRESS
+#undef RELOCATE
+}
+
+static void
+level_file_header_init(level_file_header *this, size_t arena_size, size_t lights_count, size_t sprites_count)
+{
+  *this = (level_file_header) {
+    .magic = LEVEL_FILE_MAGIC,
+    .version = LEVEL_FILE_VERSION,
+    .pointer_size = sizeof(void*),
+    .level_size = sizeof(level_data),
+    .linedef_size = sizeof(linedef),
+    .sector_size = sizeof(sector),
+    .cell_size = sizeof(map_cache_cell),
+    .segment_size = sizeof(linedef_segment),
+    .arena_size = arena_size,
+    .lights_count = lights_count,
+    .sprites_count = sprites_count
+  };
+}
+
+/*
+ * Whether a header was written by a build with this struct layout, with
+ * sizes small enough that adding them up can't overflow.
+ */
+static bool
+level_file_header_valid(const level_file_header *this)
+{
+  level_file_header expected;
+
+  level_file_header_init(&expected, this->arena_size, this->lights_count, this->sprites_count);
+
+  return !memcmp(this, &expected, sizeof(expected))
+      && this->arena_size >= sizeof(level_data)
+      && this->arena_size <= SIZE_MAX / 2
+      && this->lights_count <= UINT32_MAX
+      && this->sprites_count <= UINT32_MAX;
+}
+
+/* Adds back the lights and sprites stored after the level */
+static level_data*
+level_data_add_file_entities(level_data *this, const level_file_header *header, const uint8_t *data)
+{
+  register size_t i;
+  level_file_light file_light;
+  level_file_sprite file_sprite;
+
+  for (i = 0; i < header->lights_count; ++i, data += sizeof(file_light)) {
+    memcpy(&file_light, data, sizeof(file_light));
+    level_data_add_light(
+      this,
+      VEC3F(file_light.position[0], file_light.position[1], file_light.position[2]),
+      file_light.radius,
+      file_light.strength
+    );
+  }
+
+  for (i = 0; i < header->sprites_count; ++i, data += sizeof(file_sprite)) {
+    memcpy(&file_sprite, data, sizeof(file_sprite));
+    level_data_add_sprite(
+      this,
+      VEC3F(file_sprite.position[0], file_sprite.position[1], file_sprite.position[2]),
+      file_sprite.width,
+      file_sprite.height,
+      file_sprite.texture
+    );
+  }
+
+  return this;
+}
+
+/* Returns the element at 'index', allocating a new chunk when it starts one */
+static void*
+chunk_slot(void ***chunks, size_t index, size_t element_size)
+{
+  const size_t chunk = index / LEVEL_DATA_CHUNK_SIZE;
+
+  if (index % LEVEL_DATA_CHUNK_SIZE == 0) {
+    *chunks = realloc(*chunks, (chunk + 1) * sizeof(void*));
+    (*chunks)[chunk] = malloc(LEVEL_DATA_CHUNK_SIZE * element_size);
+  }
+
+  return (uint8_t*)(*chunks)[chunk] + (index % LEVEL_DATA_CHUNK_SIZE) * element_size;
+}
+
+/*
+ * Lays out a hash for 'count' entries, with at most half of the buckets in
+ * use, as one block starting at the returned pointer. Nothing is written
+ * when 'base' is NULL.
+ */
+static void*
+hash_layout(level_data_hash *this, uint8_t *base, size_t *offset, size_t count)
+{
+  size_t buckets = 16;
+
+  while (buckets < count * 2) {
+    buckets <<= 1;
+  }
+
+  int32_t *block = arena_take(base, offset, (buckets + count) * sizeof(int32_t));
+
+  if (base) {
+    this->mask = buckets - 1;
+    this->buckets = block;
+    this->next = block + buckets;
+    memset(this->buckets, 0xFF, buckets * sizeof(int32_t));
+  }
+
+  return block;
+}
+
+static void
+hash_insert(level_data_hash *this, uint32_t key, int32_t index)
+{
+  key &= this->mask;
+  this->next[index] = this->buckets[key];
+  this->buckets[key] = index;
+}
+
+static uint32_t
+vertex_hash_key(int32_t x, int32_t y)
+{
+  return ((uint32_t)x * 73856093u) ^ ((uint32_t)y * 19349663u);
+}
+
+/* Keyed on the unordered pair of vertex indices */
+static uint32_t
+edge_hash_key(const level_data *this, const vertex *v0, const vertex *v1)
+{
+  const uint32_t i0 = (uint32_t)(v0 - this->vertices);
+  const uint32_t i1 = (uint32_t)(v1 - this->vertices);
+
+  return (M_MIN(i0, i1) * 2654435761u) ^ (M_MAX(i0, i1) * 40503u);
+}
+
+/* Index of the vertex exactly at 'point', or -1 */
+static int32_t
+find_vertex_index(const level_data *this, vec2f point)
+{
+  register int32_t i, x, y;
+  const int32_t qx = (int32_t)floorf(point.x);
+  const int32_t qy = (int32_t)floorf(point.y);
+
+  for (y = qy - 1; y <= qy + 1; ++y) {
+    for (x = qx - 1; x <= qx + 1; ++x) {
+      for (i = this->vertex_hash.buckets[vertex_hash_key(x, y) & this->vertex_hash.mask]; i != -1; i = this->vertex_hash.next[i]) {
+        if (VEC2F_EQUAL(this->vertices[i].point, point)) {
+          return i;
+        }
+      }
+    }
+  }
+
+  return -1;
+}
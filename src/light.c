@@ -1,11 +1,96 @@
 #include "light.h"
 #include "level_data.h"
+#include <string.h>
+
+#define LIGHT_LIST_MIN_CAPACITY 4
+
+static void
+light_list_grow(light_list*, light_pool*);
 
 void light_set_position(light *this, vec3f position) {
   vec3f previous_position = entity_world_position(&this->entity);
-  this->entity.position.x = position.x;
-  this->entity.position.y = position.y;
   this->entity.z = position.z;
-  level_data_update_lights(this->entity.level);
+  entity_set_position(&this->entity, VEC2F(position.x, position.y));
+  level_data_update_light(this->entity.level, this, previous_position);
   map_cache_process_light(&this->entity.level->cache, this, previous_position);
 }
+
+void
+light_list_insert(light_list *this, light_pool *pool, light *l)
+{
+  register uint16_t i;
+  light **lights;
+
+  if (this->count == this->capacity) {
+    light_list_grow(this, pool);
+
+    if (this->count == this->capacity) {
+      return;
+    }
+  }
+
+  /* Keep the strongest lights first, so shading can stop early */
+  lights = pool->lights + this->offset;
+
+  for (i = this->count; i > 0 && lights[i-1]->strength < l->strength; --i) {
+    lights[i] = lights[i-1];
+  }
+
+  lights[i] = l;
+  this->count++;
+}
+
+bool
+light_list_remove(light_list *this, light_pool *pool, const light *l)
+{
+  register uint16_t i;
+  light **lights = pool->lights + this->offset;
+
+  for (i = 0; i < this->count; ++i) {
+    if (lights[i] == l) {
+      for (; i < this->count - 1; ++i) {
+        lights[i] = lights[i+1];
+      }
+      this->count--;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void
+light_pool_free(light_pool *this)
+{
+  free(this->lights);
+  *this = (light_pool) { 0 };
+}
+
+/*
+ * The list grows in place when it is the last one in the pool, otherwise
+ * it moves to the end. The slots it leaves behind are not reused.
+ */
+static void
+light_list_grow(light_list *this, light_pool *pool)
+{
+  const uint16_t capacity = this->capacity ? M_MIN(UINT16_MAX, this->capacity * 2) : LIGHT_LIST_MIN_CAPACITY;
+  const bool at_end = this->capacity && this->offset + this->capacity == pool->count;
+  const uint32_t offset = at_end ? this->offset : pool->count;
+
+  if (capacity == this->capacity) {
+    return;
+  }
+
+  if (offset + capacity > pool->capacity) {
+    pool->capacity = M_MAX(offset + capacity, pool->capacity * 2);
+    pool->lights = realloc(pool->lights, pool->capacity * sizeof(light*));
+  }
+
+  if (!at_end && this->count) {
+    memcpy(pool->lights + offset, pool->lights + this->offset, this->count * sizeof(light*));
+  }
+
+  this->offset = offset;
+  this->capacity = capacity;
+  pool->count = offset + capacity;
+}
@@ -1,5 +1,6 @@
 #include "linedef.h"
 #include "sector.h"
+#include "map_cache.h"
 
 void
 linedef_update_floor_ceiling_limits(linedef *this)
@@ -12,6 +13,13 @@ linedef_update_floor_ceiling_limits(linedef *this)
     this->side[0].sector->ceiling.height,
     this->side[1].sector ? this->side[1].sector->ceiling.height : 0
   );
+
+  if (this->cache_line) {
+    this->cache_line->max_floor_height = this->max_floor_height;
+    this->cache_line->min_ceiling_height = this->min_ceiling_height;
+    this->cache_line->solid = !this->side[1].sector;
+    map_cache_update_line_bounds(this->cache, this);
+  }
 }
 
 void
@@ -25,7 +33,7 @@ linedef_create_segments_for_side(linedef *this, int side)
   this->side[side].segments = malloc(this->segments * sizeof(linedef_segment));
   
   for (i = 0, d = 0.f; i < this->segments; ++i, d += seg_len) {
-    this->side[side].segments[i].lights_count = 0;
+    this->side[side].segments[i].lights = (light_list) { 0 };
     this->side[side].segments[i].p0 = vec2f_add(this->v0->point, vec2f_mul(dir, d));
     this->side[side].segments[i].p1 = vec2f_add(this->v0->point, vec2f_mul(dir, math_min(1.f, d + seg_len)));
     // printf("\tSegment %d: (%d, %d) <-> (%d, %d)\n", i, XY(this->side[side].segments[i].p0), XY(this->side[side].segments[i].p1));
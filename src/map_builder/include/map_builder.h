@@ -8,6 +8,8 @@ struct level_data;
 typedef struct {
   size_t polygons_count;
   polygon *polygons;
+  /* Map cache cell size, 0 picks one from the linedefs. Raised if too small for the level */
+  float cell_size;
 } map_builder;
 
 void
@@ -0,0 +1,44 @@
+#ifndef RAYCAST_MAP_BUILDER_MAP_READER_INCLUDED
+#define RAYCAST_MAP_BUILDER_MAP_READER_INCLUDED
+
+#include "types.h"
+#include <stdio.h>
+
+struct level_data;
+
+/*
+ * Text map format. Statements start with a keyword followed by numbers,
+ * and may run over several lines. '#' comments run to the end of a line.
+ * Floor and ceiling heights are integers, textures are non-negative
+ * integers or "none", anything else is rejected with its line.
+ *
+ *   sky TEXTURE
+ *   cell_size SIZE
+ *   polygon FLOOR CEILING BRIGHTNESS UPPER MIDDLE LOWER FLOOR_TEXTURE CEILING_TEXTURE X Y X Y X Y ...
+ *   middle_texture X0 Y0 X1 Y1 TEXTURE
+ *   light X Y Z RADIUS STRENGTH
+ *   sprite X Y Z WIDTH HEIGHT TEXTURE
+ *
+ * Polygons go to the map builder in file order, so later ones cut into
+ * earlier ones. Middle textures, lights and sprites are applied to the
+ * built level, middle textures to the linedef between the two points.
+ */
+
+/* Where reading a map stopped and why, 'message' is NULL if it didn't fail */
+typedef struct map_reader_error {
+  uint32_t line;
+  const char *message;
+} map_reader_error;
+
+/*
+ * Reads a map and builds it. The file is read a token at a time, so
+ * memory use beyond the map builder's own is bounded by the largest
+ * polygon and the number of lights, sprites and middle textures.
+ */
+struct level_data*
+map_reader_read(FILE*, map_reader_error*);
+
+struct level_data*
+map_reader_load(const char*, map_reader_error*);
+
+#endif
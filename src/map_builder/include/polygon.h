@@ -6,6 +6,8 @@
 
 #define VERTICES(...) M_NARG(__VA_ARGS__), (vec2f[]) { __VA_ARGS__ }
 #define POLYGON_CLOCKWISE_WINDING(POLY) (polygon_signed_area(POLY) < 0)
+/* Bounds are widened by this much when testing, so points on or near an edge aren't rejected */
+#define POLYGON_BOUNDS_MARGIN 1.f
 
 typedef struct polygon {
   int32_t     floor_height,
@@ -16,8 +18,16 @@ typedef struct polygon {
               ceiling_texture;
   size_t      vertices_count;
   vec2f       *vertices;
+  /* Cached bounds of the vertices, cleared when a point is inserted or removed */
+  vec2f       bounds_min,
+              bounds_max;
+  bool        bounds_valid;
 } polygon;
 
+/* Recomputes the cached bounds, call it after changing the vertices */
+void
+polygon_update_bounds(polygon*);
+
 bool
 polygon_vertices_contains_point(const polygon*, vec2f);
 
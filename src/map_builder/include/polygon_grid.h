@@ -0,0 +1,57 @@
+#ifndef RAYCAST_MAP_BUILDER_POLYGON_GRID_INCLUDED
+#define RAYCAST_MAP_BUILDER_POLYGON_GRID_INCLUDED
+
+#include "map_builder.h"
+
+/* A polygon, or the edge of it starting at vertex 'edge' */
+typedef struct polygon_grid_ref {
+  uint32_t polygon,
+           edge;
+} polygon_grid_ref;
+
+/*
+ * Uniform grid over the polygons of a map builder. Each cell lists the
+ * edges, or whole polygons, whose bounds touch it, in polygon and edge
+ * order. Bounds are widened by POLYGON_BOUNDS_MARGIN.
+ */
+typedef struct polygon_grid {
+  vec2f origin;
+  float cell_size;
+  int32_t width,
+          height;
+  /* Where each cell's refs start, 'width * height + 1' of them */
+  size_t *offsets;
+  polygon_grid_ref *refs;
+} polygon_grid;
+
+void
+polygon_grid_build_edges(polygon_grid*, map_builder*);
+
+void
+polygon_grid_build_polygons(polygon_grid*, map_builder*);
+
+void
+polygon_grid_free(polygon_grid*);
+
+/* Refs of the cell 'point' falls in. Points off the grid are near nothing and get none */
+M_INLINED const polygon_grid_ref*
+polygon_grid_query(const polygon_grid *this, vec2f point, size_t *count)
+{
+  const float fx = floorf((point.x - this->origin.x) / this->cell_size),
+              fy = floorf((point.y - this->origin.y) / this->cell_size);
+  int32_t x, y;
+
+  if (!(fx >= 0.f && fy >= 0.f && fx < this->width && fy < this->height)) {
+    *count = 0;
+    return NULL;
+  }
+
+  x = (int32_t)fx;
+  y = (int32_t)fy;
+
+  *count = this->offsets[y * this->width + x + 1] - this->offsets[y * this->width + x];
+
+  return &this->refs[this->offsets[y * this->width + x]];
+}
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef RAYCAST_MAP_BUILDER_VISIBILITY_INCLUDED
+#define RAYCAST_MAP_BUILDER_VISIBILITY_INCLUDED
+
+#include "types.h"
+
+struct level_data;
+
+/*
+ * Builds the potentially visible sectors and linedefs of every sector by
+ * flowing through the linedef portal graph. Heights are ignored, so the
+ * sets stay valid when floors and ceilings move at runtime.
+ */
+void
+visibility_build_sector_sets(struct level_data*);
+
+#endif
@@ -1,13 +1,47 @@
 #include "level_data.h"
 #include "map_builder.h"
+#include "visibility.h"
+#include "polygon_grid.h"
 #include <gpc.h>
 #include <stdio.h>
 #include <assert.h>
 
+#ifdef RAYCASTER_PARALLEL_RENDERING
+  #include <omp.h>
+  /* Polygons are clipped on many threads at once, where prints would interleave */
+  #define IF_SERIAL_DEBUG(S) IF_DEBUG(if (!omp_in_parallel()) { S; })
+#else
+  #define IF_SERIAL_DEBUG(S) IF_DEBUG(S)
+#endif
+
 #define XY(V) (int)V.x, (int)V.y
 #define VEC2F_LIST 1
 #define GPC_VERTEX_LIST 2
 
+typedef struct sweep_entry {
+  float min_x;
+  size_t index;
+} sweep_entry;
+
+/* Polygons whose bounds overlap, 'cutter' being the later one */
+typedef struct clip_pair {
+  size_t subject,
+         cutter;
+} clip_pair;
+
+/* Vertex of another polygon lying on edge 'edge' */
+typedef struct colinear_vertex {
+  size_t edge;
+  vec2f point;
+} colinear_vertex;
+
+/* Vertices found on the edges of a polygon, in the order they go into it */
+typedef struct colinear_vertices {
+  colinear_vertex *list;
+  size_t count,
+         capacity;
+} colinear_vertices;
+
 static void
 map_builder_step_find_polygon_intersections(map_builder*);
 
@@ -17,6 +51,21 @@ map_builder_step_configure_back_sectors(map_builder*, level_data*);
 static void
 map_builder_insert_polygon(map_builder*, size_t, int32_t, int32_t, float, texture_ref[], texture_ref, texture_ref, size_t, void*, int);
 
+static void
+clip_polygon(const map_builder*, size_t, const clip_pair*, size_t, map_builder*);
+
+static int
+compare_sweep_entries(const void*, const void*);
+
+static int
+compare_clip_pairs(const void*, const void*);
+
+static void
+add_colinear_vertices(map_builder*);
+
+static void
+find_colinear_vertex(map_builder*, const polygon_grid*, colinear_vertices*, size_t, vec2f);
+
 /*
  * Map data public API
  */
@@ -44,15 +93,14 @@ level_data*
 map_builder_build(map_builder *this)
 {
   int i;
+  size_t max_vertices = 0;
 
-  level_data *level = malloc(sizeof(level_data));
-  level->sectors_count = 0;
-  level->linedefs_count = 0;
-  level->vertices_count = 0;
-  level->lights_count = 0;
-  level->sky_texture = TEXTURE_NONE;
+  /* Built into scratch storage first, then packed into one allocation */
+  level_data scratch = {
+    .sky_texture = TEXTURE_NONE
+  }, *level = &scratch;
 
-  IF_DEBUG(printf("Building level (0x%p) ...\n", (void*)level))
+  IF_DEBUG(printf("Building level ...\n"))
 
   /* ------------ */
  
@@ -60,6 +108,13 @@ map_builder_build(map_builder *this)
  
   map_builder_step_find_polygon_intersections(this);
 
+  /* Each polygon edge adds at most one vertex and one linedef */
+  for (i = 0; i < this->polygons_count; ++i) {
+    max_vertices += this->polygons[i].vertices_count;
+  }
+
+  level_data_init_scratch(&scratch, max_vertices, this->polygons_count);
+
   /* ------------ */
  
   IF_DEBUG(printf("2. Creating sectors and linedefs (from %d polys) ...\n", this->polygons_count));
@@ -76,9 +131,21 @@ map_builder_build(map_builder *this)
 
   /* ------------ */
 
-  IF_DEBUG(printf("4. Prepare map cache ...\n"))
+  IF_DEBUG(printf("4. Build sector visibility ...\n"))
+
+  visibility_build_sector_sets(level);
+
+  /* ------------ */
+
+  IF_DEBUG(printf("5. Prepare map cache ...\n"))
+
+  map_cache_process_level_data(&level->cache, level, this->cell_size);
+
+  /* ------------ */
+
+  IF_DEBUG(printf("6. Pack level data ...\n"))
 
-  map_cache_process_level_data(&level->cache, level);
+  level = level_data_pack(&scratch);
 
   /* ------------ */
 
@@ -94,6 +161,9 @@ map_builder_free(map_builder *this)
   for (i = 0; i < this->polygons_count; ++i) {
     free(this->polygons[i].vertices);
   }
+  free(this->polygons);
+  this->polygons = NULL;
+  this->polygons_count = 0;
 }
 
 /*
@@ -115,30 +185,6 @@ to_gpc_polygon(const polygon *poly, gpc_polygon *gpc_poly)
   free(contour.vertex);
 }
 
-/*
- * Insert all vertices from the second polygon that are co-linear
- * on any line of the first polygon.
- */
-static void
-polygon_add_new_vertices_from(
-  polygon *this,
-  const polygon *other
-) {
-  size_t j,i,i2;
-  for (j = 0; j < other->vertices_count; ++j) {
-    for (i = 0; i < this->vertices_count; ++i) {
-      i2 = (i + 1) % this->vertices_count;
-      if (math_point_on_line_segment(other->vertices[j], this->vertices[i], this->vertices[i2], PRECISION_LOW) &&
-          polygon_vertices_contains_point(this, other->vertices[j]) == false) {
-        IF_DEBUG(printf("\tInserting (%d,%d) of 0x%p between (%d,%d) and (%d,%d) in 0x%p\n",
-          XY(other->vertices[j]), (void*)other, XY(this->vertices[i]), XY(this->vertices[i2]), (void*)this))
-        polygon_insert_point(this, other->vertices[j], this->vertices[i], this->vertices[i2]);
-        break;
-      }
-    }
-  }
-}
-
 static void
 polygon_optimize_lines(polygon *this)
 {
@@ -158,14 +204,135 @@ polygon_optimize_lines(polygon *this)
 static void
 map_builder_step_find_polygon_intersections(map_builder *this)
 {
-  int i, j, ci, vi, external_contours;
+  register size_t i, j, k;
+  const size_t count = this->polygons_count;
+  size_t pairs_count = 0, pairs_capacity = count, pieces_count = 0;
+  sweep_entry *sweep = malloc(count * sizeof(sweep_entry));
+  clip_pair *pairs = malloc(pairs_capacity * sizeof(clip_pair));
+  size_t *pairs_offsets = calloc(count + 1, sizeof(size_t));
+  map_builder *pieces = calloc(count, sizeof(map_builder));
+  polygon *polygons;
+
+  /* Broad phase, sweeping over the bounds in order of their left edge. Bounds are cached before clipping shares them between threads */
+  for (i = 0; i < count; ++i) {
+    polygon_update_bounds(&this->polygons[i]);
+    sweep[i] = (sweep_entry) { this->polygons[i].bounds_min.x, i };
+  }
+
+  qsort(sweep, count, sizeof(sweep_entry), compare_sweep_entries);
+
+  for (i = 0; i < count; ++i) {
+    const polygon *a = &this->polygons[sweep[i].index];
+
+    for (j = i + 1; j < count && sweep[j].min_x <= a->bounds_max.x + POLYGON_BOUNDS_MARGIN; ++j) {
+      const polygon *b = &this->polygons[sweep[j].index];
+
+      if (a->bounds_min.y > b->bounds_max.y + POLYGON_BOUNDS_MARGIN || b->bounds_min.y > a->bounds_max.y + POLYGON_BOUNDS_MARGIN) {
+        continue;
+      }
+
+      if (pairs_count == pairs_capacity) {
+        pairs_capacity *= 2;
+        pairs = realloc(pairs, pairs_capacity * sizeof(clip_pair));
+      }
+
+      /* Later polygons cut earlier ones */
+      pairs[pairs_count++] = (clip_pair) {
+        .subject = M_MIN(sweep[i].index, sweep[j].index),
+        .cutter = M_MAX(sweep[i].index, sweep[j].index)
+      };
+    }
+  }
+
+  qsort(pairs, pairs_count, sizeof(clip_pair), compare_clip_pairs);
+
+  for (k = 0; k < pairs_count; ++k) {
+    pairs_offsets[pairs[k].subject + 1]++;
+  }
+
+  for (i = 0; i < count; ++i) {
+    pairs_offsets[i + 1] += pairs_offsets[i];
+  }
+
+  IF_DEBUG(printf("	%zu pairs of polygons to clip\n", pairs_count))
+
+  /*
+   * What's left of a polygon only depends on itself and the polygons after
+   * it, none of which change until everything is clipped, so every polygon
+   * is clipped on its own
+   */
+#ifdef RAYCASTER_PARALLEL_RENDERING
+  #pragma omp parallel for schedule(dynamic)
+#endif
+  for (j = 0; j < count; ++j) {
+    clip_polygon(this, j, &pairs[pairs_offsets[j]], pairs_offsets[j + 1] - pairs_offsets[j], &pieces[j]);
+  }
+
+  /* Pieces take the place of the polygon they were cut from */
+  for (j = 0; j < count; ++j) {
+    pieces_count += pieces[j].polygons_count;
+  }
+
+  polygons = malloc(pieces_count * sizeof(polygon));
+
+  for (j = 0, k = 0; j < count; ++j) {
+    memcpy(&polygons[k], pieces[j].polygons, pieces[j].polygons_count * sizeof(polygon));
+    k += pieces[j].polygons_count;
+    free(pieces[j].polygons);
+    free(this->polygons[j].vertices);
+  }
+
+  free(this->polygons);
+  this->polygons = polygons;
+  this->polygons_count = pieces_count;
+
+  free(pieces);
+  free(pairs_offsets);
+  free(pairs);
+  free(sweep);
+
+  /* Optimize lines */
+  for (i = 0; i < this->polygons_count; ++i) {
+    polygon_optimize_lines(&this->polygons[i]);
+    polygon_update_bounds(&this->polygons[i]);
+  }
+
+  add_colinear_vertices(this);
+}
+
+/*
+ * Clips polygon 'index' by the later polygons in 'pairs', the same way as
+ * if they were all clipped in order: the polygon and each piece it splits
+ * into are cut by every polygon after it, pieces included. The pieces go
+ * into 'pieces', in order.
+ */
+static void
+clip_polygon(const map_builder *this, size_t index, const clip_pair *pairs, size_t pairs_count, map_builder *pieces)
+{
+  register size_t i, j, k;
+  int ci, vi, external_contours;
+  size_t subjects = 1;
+  bool removed;
   polygon *pi, *pj;
+  texture_ref wall_texture[3];
 
-  for (j = 0; j < this->polygons_count; ++j) {
-    pj = &this->polygons[j];
+  /* The polygon followed by its cutters, which are only read and stay the builder's */
+  pieces->polygons = malloc((pairs_count + 1) * sizeof(polygon));
+  pieces->polygons[0] = this->polygons[index];
+  pieces->polygons[0].vertices = malloc(this->polygons[index].vertices_count * sizeof(vec2f));
+  memcpy(pieces->polygons[0].vertices, this->polygons[index].vertices, this->polygons[index].vertices_count * sizeof(vec2f));
+  pieces->polygons_count = pairs_count + 1;
+
+  for (k = 0; k < pairs_count; ++k) {
+    pieces->polygons[k + 1] = this->polygons[pairs[k].cutter];
+  }
+
+  for (j = 0; j < subjects;) {
+    removed = false;
 
-    for (i = j + 1; i < this->polygons_count;) {
-      pi = &this->polygons[i];
+    for (i = j + 1; i < pieces->polygons_count;) {
+      pj = &pieces->polygons[j];
+      pi = &pieces->polygons[i];
 
       /* Polygon 'pi' is wholly inside 'pj' without sharing an edge */
       if (polygon_contains_polygon(pj, pi, false) || !polygon_overlaps_polygon(pj, pi)) {
@@ -173,7 +340,7 @@ map_builder_step_find_polygon_intersections(map_builder *this)
         continue;
       }
 
-      IF_DEBUG(printf("\tIntersect Polygon %d (0x%p) with Polygon %d (0x%p)\n", i, (void*)pi, j, (void*)pj))
+      IF_SERIAL_DEBUG(printf("\tIntersect Polygon %zu (0x%p) with Polygon %zu (0x%p)\n", i, (void*)pi, j, (void*)pj))
 
       gpc_polygon subject = { 0 }, clip = { 0 }, result = { 0 };
 
@@ -181,33 +348,41 @@ map_builder_step_find_polygon_intersections(map_builder *this)
       to_gpc_polygon(pi, &clip);
       gpc_polygon_clip(GPC_DIFF, &subject, &clip, &result);
 
-      /* TODO: Check if polygon was clipped to nothing (no vertices)? */
-
       /* Read contours */
       for (ci = 0, external_contours = 0; ci < result.num_contours; ++ci) {
-        if (!result.hole[ci]) {
-          if (external_contours++ == 0) {
-            pj->vertices_count = result.contour[ci].num_vertices;
-            pj->vertices = realloc(pj->vertices, pj->vertices_count * sizeof(vec2f));
-            for (vi = 0; vi < result.contour[ci].num_vertices; ++vi) {
-              pj->vertices[vi] = VEC2F(result.contour[ci].vertex[vi].x, result.contour[ci].vertex[vi].y);
-            }
-          } else {
-            /* Create new polygon from the other countour(s) */
-            map_builder_insert_polygon(
-              this,
-              j+1,
-              pj->floor_height,
-              pj->ceiling_height,
-              pj->brightness,
-              pj->wall_texture,
-              pj->floor_texture,
-              pj->ceiling_texture,
-              result.contour[ci].num_vertices,
-              result.contour[ci].vertex,
-              GPC_VERTEX_LIST
-            );
+        if (result.hole[ci]) {
+          continue;
+        }
+
+        /* Inserting pieces moves the polygons */
+        pj = &pieces->polygons[j];
+
+        if (external_contours++ == 0) {
+          pj->vertices_count = result.contour[ci].num_vertices;
+          pj->vertices = realloc(pj->vertices, pj->vertices_count * sizeof(vec2f));
+          for (vi = 0; vi < result.contour[ci].num_vertices; ++vi) {
+            pj->vertices[vi] = VEC2F(result.contour[ci].vertex[vi].x, result.contour[ci].vertex[vi].y);
           }
+          polygon_update_bounds(pj);
+        } else {
+          memcpy(wall_texture, pj->wall_texture, sizeof(wall_texture));
+
+          /* Create new polygon from the other countour(s) */
+          map_builder_insert_polygon(
+            pieces,
+            j+1,
+            pj->floor_height,
+            pj->ceiling_height,
+            pj->brightness,
+            wall_texture,
+            pj->floor_texture,
+            pj->ceiling_texture,
+            result.contour[ci].num_vertices,
+            result.contour[ci].vertex,
+            GPC_VERTEX_LIST
+          );
+
+          subjects++;
         }
       }
 
@@ -215,53 +390,211 @@ map_builder_step_find_polygon_intersections(map_builder *this)
       gpc_free_polygon(&clip);
       gpc_free_polygon(&result);
 
+      /* Clipped away completely, the next subject moves into its place */
+      if (!external_contours) {
+        free(pieces->polygons[j].vertices);
+        memmove(&pieces->polygons[j], &pieces->polygons[j + 1], (pieces->polygons_count - j - 1) * sizeof(polygon));
+        pieces->polygons_count--;
+        subjects--;
+        removed = true;
+        break;
+      }
+
       i += external_contours;
     }
+
+    if (!removed) {
+      ++j;
+    }
   }
 
-  /* Optimize lines */
-  for (i = 0; i < this->polygons_count; ++i) {
-    polygon_optimize_lines(&this->polygons[i]);
+  pieces->polygons_count = subjects;
+}
+
+/*
+ * Splits polygon edges at the vertices of other polygons lying on them.
+ * Vertices only test the edges in their cell of an edge grid, and each
+ * polygon is rebuilt once with all the vertices found on its edges.
+ * Vertices are found in the order they would be inserted one at a time,
+ * testing against the pieces edges were already split into, so they go
+ * in the same places.
+ */
+static void
+add_colinear_vertices(map_builder *this)
+{
+  register size_t j, k;
+  size_t m, n;
+  polygon_grid grid;
+  colinear_vertices *found = calloc(this->polygons_count, sizeof(colinear_vertices)), *fj;
+  polygon *pj;
+  vec2f *vertices;
+
+  polygon_grid_build_edges(&grid, this);
+
+  for (j = 0; j < this->polygons_count; ++j) {
+    pj = &this->polygons[j];
+    fj = &found[j];
+
+    /* Including vertices found on it from the polygons before */
+    for (k = 0, m = 0; k < pj->vertices_count; ++k) {
+      find_colinear_vertex(this, &grid, found, j, pj->vertices[k]);
+
+      for (; m < fj->count && fj->list[m].edge == k; ++m) {
+        find_colinear_vertex(this, &grid, found, j, fj->list[m].point);
+      }
+    }
   }
 
-  /* Add colinear points from other polygons */
+  polygon_grid_free(&grid);
+
   for (j = 0; j < this->polygons_count; ++j) {
     pj = &this->polygons[j];
-    for (i = 0; i < this->polygons_count; ++i) {
-      pi = &this->polygons[i];
-      if (pi == pj) { continue; }
-      polygon_add_new_vertices_from(pi, pj);
+    fj = &found[j];
+
+    if (!fj->count) {
+      continue;
+    }
+
+    vertices = malloc((pj->vertices_count + fj->count) * sizeof(vec2f));
+
+    for (k = 0, n = 0, m = 0; k < pj->vertices_count; ++k) {
+      vertices[n++] = pj->vertices[k];
+
+      for (; m < fj->count && fj->list[m].edge == k; ++m) {
+        vertices[n++] = fj->list[m].point;
+      }
     }
+
+    free(pj->vertices);
+    free(fj->list);
+    pj->vertices = vertices;
+    pj->vertices_count = n;
+    polygon_update_bounds(pj);
   }
+
+  free(found);
 }
 
-/* Check for lines that are wholly inside other sectors */
+/* Adds 'point' of polygon 'index' to the first edge of each other polygon it lies on */
+static void
+find_colinear_vertex(map_builder *this, const polygon_grid *grid, colinear_vertices *found, size_t index, vec2f point)
+{
+  register size_t i, k;
+  size_t refs_count, edge, first, last, m;
+  uint32_t matched = UINT32_MAX;
+  const polygon_grid_ref *refs = polygon_grid_query(grid, point, &refs_count);
+  const polygon *pi;
+  colinear_vertices *fi;
+  vec2f a, b;
+  bool inserted;
+
+  /* Refs come in edge order, so the first one a point lies on is the first edge */
+  for (i = 0; i < refs_count; ++i) {
+    if (refs[i].polygon == index || refs[i].polygon == matched) {
+      continue;
+    }
+
+    pi = &this->polygons[refs[i].polygon];
+    fi = &found[refs[i].polygon];
+    edge = refs[i].edge;
+
+    for (first = 0; first < fi->count && fi->list[first].edge < edge; ++first);
+    for (last = first; last < fi->count && fi->list[last].edge == edge; ++last);
+
+    /* The edge may be split already, test each piece of it */
+    for (k = first, inserted = false; k <= last && !inserted; ++k) {
+      a = k == first ? pi->vertices[edge] : fi->list[k - 1].point;
+      b = k < last ? fi->list[k].point : pi->vertices[edge + 1 == pi->vertices_count ? 0 : edge + 1];
+
+      if (!math_point_on_line_segment(point, a, b, PRECISION_LOW)) {
+        continue;
+      }
+
+      matched = refs[i].polygon;
+      inserted = true;
+
+      if (polygon_vertices_contains_point(pi, point)) {
+        break;
+      }
+
+      for (m = 0; m < fi->count && !VEC2F_EQUAL(fi->list[m].point, point); ++m);
+
+      if (m < fi->count) {
+        break;
+      }
+
+      IF_DEBUG(printf("\tInserting (%d,%d) of polygon %zu between (%d,%d) and (%d,%d) of polygon %u\n",
+        XY(point), index, XY(a), XY(b), refs[i].polygon))
+
+      if (fi->count == fi->capacity) {
+        fi->capacity = fi->capacity ? fi->capacity * 2 : 8;
+        fi->list = realloc(fi->list, fi->capacity * sizeof(colinear_vertex));
+      }
+
+      memmove(&fi->list[k + 1], &fi->list[k], (fi->count - k) * sizeof(colinear_vertex));
+      fi->list[k] = (colinear_vertex) { edge, point };
+      fi->count++;
+    }
+  }
+}
+
+static int
+compare_sweep_entries(const void *a, const void *b)
+{
+  const sweep_entry *ea = (const sweep_entry*)a, *eb = (const sweep_entry*)b;
+  return (ea->min_x > eb->min_x) - (ea->min_x < eb->min_x);
+}
+
+static int
+compare_clip_pairs(const void *a, const void *b)
+{
+  const clip_pair *pa = (const clip_pair*)a, *pb = (const clip_pair*)b;
+
+  if (pa->subject != pb->subject) {
+    return (pa->subject > pb->subject) - (pa->subject < pb->subject);
+  }
+
+  return (pa->cutter > pb->cutter) - (pa->cutter < pb->cutter);
+}
+
+/*
+ * Check for lines that are wholly inside other sectors. Lines go into the
+ * last sector before their own that has both ends inside, found through a
+ * grid of the polygons, and are appended once every line has its back.
+ */
 static void
 map_builder_step_configure_back_sectors(map_builder *this, level_data *level)
 {
-  int i, j, new_count;
-  size_t k;
+  register int32_t i, j, r;
+  size_t k, refs_count, added_count = 0;
+  size_t *sector_added = calloc(level->sectors_count, sizeof(size_t));
+  linedef **added = malloc(level->linedefs_count * sizeof(linedef*)), *line;
+  const polygon_grid_ref *refs;
+  polygon_grid grid;
   sector *front, *back;
-  linedef *line;
+
+  polygon_grid_build_polygons(&grid, this);
 
   for (j = level->sectors_count - 1; j >= 0; --j) {
     front = &level->sectors[j];
 
-    for (i = j - 1; i >= 0; --i) {
-      back = &level->sectors[i];
-     
-      if (back == front) { continue; }
+    for (k = 0; k < front->linedefs_count; ++k) {
+      line = front->linedefs[k];
+
+      if (line->side[0].sector && line->side[1].sector) { continue; }
+
+      /* Polygons holding the first vertex are in its cell, latest first */
+      refs = polygon_grid_query(&grid, line->v0->point, &refs_count);
 
-      new_count = back->linedefs_count;
+      for (r = (int32_t)refs_count - 1; r >= 0; --r) {
+        if ((i = refs[r].polygon) >= j) { continue; }
 
-      for (k = 0; k < front->linedefs_count; ++k) {
-        line = front->linedefs[k];
+        back = &level->sectors[i];
 
-        if (line->side[0].sector && line->side[1].sector) { continue; }
         if (sector_connects_vertices(back, line->v0, line->v1)) { continue; }
-       
+
         if (polygon_is_point_inside(&this->polygons[i], line->v0->point, false) && polygon_is_point_inside(&this->polygons[i], line->v1->point, false)) {
-          IF_DEBUG(printf("\t\tAdd contained line %d (%d,%d) <-> (%d,%d) of sector %d INTO sector %d\n", k, XY(line->v0->point), XY(line->v1->point), j, i))
+          IF_DEBUG(printf("\t\tAdd contained line %zu (%d,%d) <-> (%d,%d) of sector %d INTO sector %d\n", k, XY(line->v0->point), XY(line->v1->point), j, i))
           line->side[1].sector = back;
           line->side[1].texture[0] = line->side[0].texture[0];
           line->side[1].texture[1] = line->side[0].texture[1];
@@ -269,16 +602,32 @@ map_builder_step_configure_back_sectors(map_builder *this, level_data *level)
           /* Clear middle texture by default for two-sided lines */
           line->side[0].texture[1] = TEXTURE_NONE;
           line->side[1].texture[1] = TEXTURE_NONE;
-          back->linedefs = realloc(back->linedefs, sizeof(linedef*) * (new_count+1));
-          back->linedefs[new_count++] = line;
           linedef_update_floor_ceiling_limits(line);
           linedef_create_segments_for_side(line, 1);
+          added[added_count++] = line;
+          sector_added[i]++;
+          break;
         }
       }
+    }
+  }
 
-      back->linedefs_count = new_count;
+  polygon_grid_free(&grid);
+
+  for (i = 0; i < level->sectors_count; ++i) {
+    if (sector_added[i]) {
+      back = &level->sectors[i];
+      back->linedefs = realloc(back->linedefs, (back->linedefs_count + sector_added[i]) * sizeof(linedef*));
     }
   }
+
+  for (k = 0; k < added_count; ++k) {
+    back = added[k]->side[1].sector;
+    back->linedefs[back->linedefs_count++] = added[k];
+  }
+
+  free(added);
+  free(sector_added);
 }
 
 static void
@@ -297,7 +646,7 @@ map_builder_insert_polygon(
 ) {
   size_t i;
 
-  IF_DEBUG(printf("Insert polygon (%d vertices) [%d, %d] at index %d:\n", vertices_count, floor_height, ceiling_height, insert_index))
+  IF_SERIAL_DEBUG(printf("Insert polygon (%d vertices) [%d, %d] at index %d:\n", vertices_count, floor_height, ceiling_height, insert_index))
 
   if (!this->polygons) {
     this->polygons = (polygon*)malloc(sizeof(polygon));
@@ -338,7 +687,9 @@ map_builder_insert_polygon(
     polygon_reverse_vertices(&this->polygons[insert_index]);
   }
 
-  IF_DEBUG(for (i=0; i < vertices_count; ++i) {
+  polygon_update_bounds(&this->polygons[insert_index]);
+
+  IF_SERIAL_DEBUG(for (i=0; i < vertices_count; ++i) {
     printf("\t(%d, %d)\n", XY(this->polygons[insert_index].vertices[i]));
   })
 
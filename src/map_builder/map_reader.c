@@ -0,0 +1,396 @@
+#include "map_reader.h"
+#include "map_builder.h"
+#include "level_data.h"
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+
+#define MAX_TOKEN 64
+#define MAX_HEIGHT (1 << 24) /* Heights are used as floats, which hold integers exactly up to here */
+
+typedef enum {
+  EXTRA_MIDDLE_TEXTURE,
+  EXTRA_LIGHT,
+  EXTRA_SPRITE
+} extra_type;
+
+/* Statement applied to the built level, kept in the order it was read */
+typedef struct extra {
+  extra_type type;
+  uint32_t line;
+  float values[5];
+  texture_ref texture;
+} extra;
+
+typedef struct reader {
+  FILE *file;
+  uint32_t line;
+  /* Whether 'token' holds the next token, not yet taken */
+  bool peeked;
+  char token[MAX_TOKEN];
+  map_reader_error *error;
+  /* Vertices of the polygon being read, reused for every polygon */
+  vec2f *vertices;
+  size_t vertices_capacity;
+  extra *extras;
+  size_t extras_count,
+         extras_capacity;
+} reader;
+
+static bool
+peek_token(reader*);
+
+static bool
+token_is_number(const reader*);
+
+static bool
+read_number(reader*, float*);
+
+static bool
+read_integer(reader*, long, long, int32_t*);
+
+static bool
+read_texture(reader*, texture_ref*);
+
+static bool
+read_polygon(reader*, map_builder*);
+
+static bool
+read_extra(reader*, extra_type, size_t);
+
+static bool
+apply_extras(reader*, struct level_data*);
+
+static bool
+fail(reader*, uint32_t, const char*);
+
+level_data*
+map_reader_read(FILE *file, map_reader_error *error)
+{
+  reader r = {
+    .file = file,
+    .line = 1,
+    .error = error
+  };
+  map_builder builder = { 0 };
+  texture_ref sky = TEXTURE_NONE;
+  level_data *level = NULL;
+
+  error->line = 0;
+  error->message = NULL;
+
+  while (!error->message && peek_token(&r)) {
+    r.peeked = false;
+
+    if (!strcmp(r.token, "polygon")) {
+      read_polygon(&r, &builder);
+    } else if (!strcmp(r.token, "sky")) {
+      read_texture(&r, &sky);
+    } else if (!strcmp(r.token, "cell_size")) {
+      read_number(&r, &builder.cell_size);
+    } else if (!strcmp(r.token, "middle_texture")) {
+      read_extra(&r, EXTRA_MIDDLE_TEXTURE, 4);
+    } else if (!strcmp(r.token, "light")) {
+      read_extra(&r, EXTRA_LIGHT, 5);
+    } else if (!strcmp(r.token, "sprite")) {
+      read_extra(&r, EXTRA_SPRITE, 5);
+    } else {
+      fail(&r, r.line, "Unknown statement");
+    }
+  }
+
+  if (!error->message && !builder.polygons_count) {
+    fail(&r, r.line, "No polygons");
+  }
+
+  if (!error->message) {
+    level = map_builder_build(&builder);
+    level->sky_texture = sky;
+
+    if (!apply_extras(&r, level)) {
+      level_data_free(level);
+      level = NULL;
+    }
+  }
+
+  map_builder_free(&builder);
+  free(r.vertices);
+  free(r.extras);
+
+  return level;
+}
+
+level_data*
+map_reader_load(const char *path, map_reader_error *error)
+{
+  level_data *level;
+  FILE *file = fopen(path, "r");
+
+  if (!file) {
+    error->line = 0;
+    error->message = "Could not open the file";
+    return NULL;
+  }
+
+  level = map_reader_read(file, error);
+  fclose(file);
+
+  return level;
+}
+
+/* Reads the next token into 'token' if there isn't one waiting, false at the end of the file */
+static bool
+peek_token(reader *this)
+{
+  size_t length = 0;
+  int c;
+
+  if (this->peeked) {
+    return true;
+  }
+
+  for (;;) {
+    c = getc(this->file);
+
+    if (c == '#') {
+      while ((c = getc(this->file)) != '\n' && c != EOF);
+    }
+
+    if (c == EOF) {
+      return false;
+    }
+
+    if (c == '\n') {
+      this->line++;
+    } else if (!isspace(c)) {
+      break;
+    }
+  }
+
+  do {
+    if (length == MAX_TOKEN - 1) {
+      return fail(this, this->line, "Token too long");
+    }
+    this->token[length++] = (char)c;
+    c = getc(this->file);
+  } while (c != EOF && c != '#' && !isspace(c));
+
+  /* Left for the next token, so line numbers and comments stay right */
+  if (c != EOF) {
+    ungetc(c, this->file);
+  }
+
+  this->token[length] = '\0';
+  this->peeked = true;
+
+  return true;
+}
+
+/*
+ * Whether all of the token is a finite number. "nan", "inf" and numbers
+ * too large for a float are spotted while parsing, as -ffast-math builds
+ * take isfinite() to always be true.
+ */
+static bool
+token_is_number(const reader *this)
+{
+  char *end;
+  const char *digits = this->token + (this->token[0] == '-' || this->token[0] == '+');
+
+  errno = 0;
+  strtof(this->token, &end);
+
+  return end != this->token && *end == '\0' && errno != ERANGE && !isalpha((unsigned char)*digits);
+}
+
+static bool
+read_number(reader *this, float *value)
+{
+  if (!peek_token(this) || !token_is_number(this)) {
+    return fail(this, this->line, "Expected a number");
+  }
+
+  *value = strtof(this->token, NULL);
+  this->peeked = false;
+
+  return true;
+}
+
+/* Reads a decimal integer within [min, max], rejecting fractions and exponents */
+static bool
+read_integer(reader *this, long min, long max, int32_t *value)
+{
+  char *end;
+  long parsed;
+
+  if (!peek_token(this)) {
+    return fail(this, this->line, "Expected an integer");
+  }
+
+  errno = 0;
+  parsed = strtol(this->token, &end, 10);
+
+  if (end == this->token || *end != '\0') {
+    return fail(this, this->line, "Expected an integer");
+  }
+
+  if (errno == ERANGE || parsed < min || parsed > max) {
+    return fail(this, this->line, "Value out of range");
+  }
+
+  *value = (int32_t)parsed;
+  this->peeked = false;
+
+  return true;
+}
+
+/* Reads "none" or a texture index */
+static bool
+read_texture(reader *this, texture_ref *texture)
+{
+  if (peek_token(this) && !strcmp(this->token, "none")) {
+    *texture = TEXTURE_NONE;
+    this->peeked = false;
+    return true;
+  }
+
+  return read_integer(this, 0, INT32_MAX, texture);
+}
+
+static bool
+read_polygon(reader *this, map_builder *builder)
+{
+  register size_t i;
+  int32_t floor_height, ceiling_height;
+  float brightness;
+  texture_ref wall_texture[3], floor_texture, ceiling_texture;
+  size_t vertices_count = 0;
+  const uint32_t line = this->line;
+
+  if (!read_integer(this, -MAX_HEIGHT, MAX_HEIGHT, &floor_height) ||
+      !read_integer(this, -MAX_HEIGHT, MAX_HEIGHT, &ceiling_height) ||
+      !read_number(this, &brightness)) {
+    return false;
+  }
+
+  for (i = 0; i < 3; ++i) {
+    if (!read_texture(this, &wall_texture[i])) {
+      return false;
+    }
+  }
+
+  if (!read_texture(this, &floor_texture) || !read_texture(this, &ceiling_texture)) {
+    return false;
+  }
+
+  /* Vertices run up to the next statement */
+  while (peek_token(this) && token_is_number(this)) {
+    if (vertices_count == this->vertices_capacity) {
+      this->vertices_capacity = this->vertices_capacity ? this->vertices_capacity * 2 : 64;
+      this->vertices = realloc(this->vertices, this->vertices_capacity * sizeof(vec2f));
+    }
+
+    if (!read_number(this, &this->vertices[vertices_count].x) || !read_number(this, &this->vertices[vertices_count].y)) {
+      return false;
+    }
+
+    vertices_count++;
+  }
+
+  if (this->error->message) {
+    return false;
+  }
+
+  if (vertices_count < 3) {
+    return fail(this, line, "Polygon needs at least 3 vertices");
+  }
+
+  map_builder_add_polygon(
+    builder,
+    floor_height,
+    ceiling_height,
+    brightness,
+    wall_texture,
+    floor_texture,
+    ceiling_texture,
+    vertices_count,
+    this->vertices
+  );
+
+  return true;
+}
+
+/* Reads 'count' numbers, and a texture for middle textures and sprites */
+static bool
+read_extra(reader *this, extra_type type, size_t count)
+{
+  register size_t i;
+  extra e = {
+    .type = type,
+    .line = this->line,
+    .texture = TEXTURE_NONE
+  };
+
+  for (i = 0; i < count; ++i) {
+    if (!read_number(this, &e.values[i])) {
+      return false;
+    }
+  }
+
+  if (type != EXTRA_LIGHT && !read_texture(this, &e.texture)) {
+    return false;
+  }
+
+  if (this->extras_count == this->extras_capacity) {
+    this->extras_capacity = this->extras_capacity ? this->extras_capacity * 2 : 16;
+    this->extras = realloc(this->extras, this->extras_capacity * sizeof(extra));
+  }
+
+  this->extras[this->extras_count++] = e;
+
+  return true;
+}
+
+static bool
+apply_extras(reader *this, level_data *level)
+{
+  register size_t i;
+  const extra *e;
+  linedef *line;
+
+  for (i = 0; i < this->extras_count; ++i) {
+    e = &this->extras[i];
+
+    switch (e->type) {
+    case EXTRA_MIDDLE_TEXTURE:
+      if (!(line = level_data_find_linedef(level, VEC2F(e->values[0], e->values[1]), VEC2F(e->values[2], e->values[3])))) {
+        return fail(this, e->line, "No linedef between the middle texture points");
+      }
+      linedef_set_middle_texture(line, e->texture);
+      break;
+
+    case EXTRA_LIGHT:
+      level_data_add_light(level, VEC3F(e->values[0], e->values[1], e->values[2]), e->values[3], e->values[4]);
+      break;
+
+    case EXTRA_SPRITE:
+      level_data_add_sprite(level, VEC3F(e->values[0], e->values[1], e->values[2]), e->values[3], e->values[4], e->texture);
+      break;
+    }
+  }
+
+  return true;
+}
+
+static bool
+fail(reader *this, uint32_t line, const char *message)
+{
+  if (!this->error->message) {
+    this->error->line = line;
+    this->error->message = message;
+  }
+
+  return false;
+}
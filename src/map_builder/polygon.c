@@ -2,11 +2,41 @@
 #include "maths.h"
 #include <stdio.h>
 
+static void
+get_bounds(const polygon*, vec2f*, vec2f*);
+
+M_INLINED bool
+point_in_bounds(vec2f point, vec2f min, vec2f max)
+{
+  return point.x >= min.x - POLYGON_BOUNDS_MARGIN && point.x <= max.x + POLYGON_BOUNDS_MARGIN &&
+         point.y >= min.y - POLYGON_BOUNDS_MARGIN && point.y <= max.y + POLYGON_BOUNDS_MARGIN;
+}
+
+M_INLINED bool
+bounds_overlap(vec2f min_a, vec2f max_a, vec2f min_b, vec2f max_b)
+{
+  return min_a.x <= max_b.x + POLYGON_BOUNDS_MARGIN && min_b.x <= max_a.x + POLYGON_BOUNDS_MARGIN &&
+         min_a.y <= max_b.y + POLYGON_BOUNDS_MARGIN && min_b.y <= max_a.y + POLYGON_BOUNDS_MARGIN;
+}
+
+M_INLINED bool
+segments_bounds_overlap(vec2f a0, vec2f a1, vec2f b0, vec2f b1)
+{
+  return bounds_overlap(
+    VEC2F(fminf(a0.x, a1.x), fminf(a0.y, a1.y)), VEC2F(fmaxf(a0.x, a1.x), fmaxf(a0.y, a1.y)),
+    VEC2F(fminf(b0.x, b1.x), fminf(b0.y, b1.y)), VEC2F(fmaxf(b0.x, b1.x), fmaxf(b0.y, b1.y))
+  );
+}
+
 bool
 polygon_vertices_contains_point(const polygon *this, vec2f point)
 {
   register size_t i;
 
+  if (this->bounds_valid && !point_in_bounds(point, this->bounds_min, this->bounds_max)) {
+    return false;
+  }
+
   for (i = 0; i < this->vertices_count; ++i) {
     if (VEC2F_EQUAL(this->vertices[i], point)) {
       return true;
@@ -19,14 +49,18 @@ polygon_vertices_contains_point(const polygon *this, vec2f point)
 bool
 polygon_is_point_inside(const polygon *this, vec2f point, bool include_edges)
 {
-  register size_t i;
+  register size_t i, prev;
   int wn = 0;
   vec2f v0, v1;
 
+  if (this->bounds_valid && !point_in_bounds(point, this->bounds_min, this->bounds_max)) {
+    return false;
+  }
+
   /* Winding number algorithm */
-  for (i = 0; i < this->vertices_count; ++i) {
-    v0 = this->vertices[i];
-    v1 = this->vertices[(i+1)%this->vertices_count];
+  for (i = 0, prev = this->vertices_count - 1; i < this->vertices_count; prev = i++) {
+    v0 = this->vertices[prev];
+    v1 = this->vertices[i];
 
     if (math_point_on_line_segment(point, v0, v1, MATHS_EPSILON)) {
       return include_edges;
@@ -53,7 +87,19 @@ polygon_is_point_inside(const polygon *this, vec2f point, bool include_edges)
 bool
 polygon_overlaps_polygon(const polygon *this, const polygon *other)
 {
-  size_t i, j, i2, j2;
+  register size_t i, j, i2, j2;
+  vec2f this_min, this_max, other_min, other_max, region_min, region_max;
+
+  get_bounds(this, &this_min, &this_max);
+  get_bounds(other, &other_min, &other_max);
+
+  if (!bounds_overlap(this_min, this_max, other_min, other_max)) {
+    return false;
+  }
+
+  /* Edges can only cross where both polygons' bounds do */
+  region_min = VEC2F(fmaxf(this_min.x, other_min.x), fmaxf(this_min.y, other_min.y));
+  region_max = VEC2F(fminf(this_max.x, other_max.x), fminf(this_max.y, other_max.y));
 
   for (i = 0; i < other->vertices_count; ++i) {
     if (polygon_vertices_contains_point(this, other->vertices[i])) {
@@ -62,9 +108,15 @@ polygon_overlaps_polygon(const polygon *this, const polygon *other)
     if (polygon_is_point_inside(this, other->vertices[i], true)) {
       return true;
     }
-    i2 = (i + 1) % other->vertices_count;
+    i2 = i + 1 == other->vertices_count ? 0 : i + 1;
+    if (!segments_bounds_overlap(other->vertices[i], other->vertices[i2], region_min, region_max)) {
+      continue;
+    }
     for (j = 0; j < this->vertices_count; ++j) {
-      j2 = (j + 1) % this->vertices_count;
+      j2 = j + 1 == this->vertices_count ? 0 : j + 1;
+      if (!segments_bounds_overlap(other->vertices[i], other->vertices[i2], this->vertices[j], this->vertices[j2])) {
+        continue;
+      }
       if (VEC2F_EQUAL(other->vertices[i],   this->vertices[j])  ||
           VEC2F_EQUAL(other->vertices[i2],  this->vertices[j])  ||
           VEC2F_EQUAL(other->vertices[i],   this->vertices[j2]) ||
@@ -88,6 +140,16 @@ bool
 polygon_contains_polygon(const polygon *this, const polygon *other, bool include_edges)
 {
   size_t i;
+  vec2f this_min, this_max, other_min, other_max;
+
+  get_bounds(this, &this_min, &this_max);
+  get_bounds(other, &other_min, &other_max);
+
+  /* Bounds of 'other' have to fit in those of 'this' */
+  if (other_min.x < this_min.x - POLYGON_BOUNDS_MARGIN || other_max.x > this_max.x + POLYGON_BOUNDS_MARGIN ||
+      other_min.y < this_min.y - POLYGON_BOUNDS_MARGIN || other_max.y > this_max.y + POLYGON_BOUNDS_MARGIN) {
+    return false;
+  }
 
   /* All points of 'other' must be inside 'this' */
   for (i = 0; i < other->vertices_count; ++i) {
@@ -129,6 +191,7 @@ polygon_insert_point(polygon *this, vec2f point, vec2f after, vec2f before)
       }
       this->vertices[i + 1] = point;
       this->vertices_count++;
+      this->bounds_valid = false;
       break;
     }
   }
@@ -145,6 +208,7 @@ polygon_remove_point(polygon *this, vec2f point)
         this->vertices[j] = this->vertices[j+1];
       }
       this->vertices = realloc(this->vertices, (--this->vertices_count)*sizeof(vec2f));
+      this->bounds_valid = false;
       break;
     }
   }
@@ -162,3 +226,32 @@ polygon_reverse_vertices(polygon *this)
     this->vertices[i] = temp_swap;
   }
 }
+
+void
+polygon_update_bounds(polygon *this)
+{
+  this->bounds_valid = false;
+  get_bounds(this, &this->bounds_min, &this->bounds_max);
+  this->bounds_valid = true;
+}
+
+/* Cached bounds if they're still valid, otherwise worked out without caching them */
+static void
+get_bounds(const polygon *this, vec2f *min, vec2f *max)
+{
+  register size_t i;
+
+  if (this->bounds_valid) {
+    *min = this->bounds_min;
+    *max = this->bounds_max;
+    return;
+  }
+
+  *min = VEC2F(FLT_MAX, FLT_MAX);
+  *max = VEC2F(-FLT_MAX, -FLT_MAX);
+
+  for (i = 0; i < this->vertices_count; ++i) {
+    *min = VEC2F(fminf(min->x, this->vertices[i].x), fminf(min->y, this->vertices[i].y));
+    *max = VEC2F(fmaxf(max->x, this->vertices[i].x), fmaxf(max->y, this->vertices[i].y));
+  }
+}
@@ -0,0 +1,133 @@
+#include "polygon_grid.h"
+#include <string.h>
+
+/* Keeps huge levels with tiny polygons from getting a grid bigger than they are */
+#define MAX_GRID_SIZE 1024
+
+static void
+build(polygon_grid*, map_builder*, bool);
+
+static void
+add_ref(polygon_grid*, vec2f, vec2f, polygon_grid_ref, size_t*);
+
+void
+polygon_grid_build_edges(polygon_grid *this, map_builder *builder)
+{
+  build(this, builder, true);
+}
+
+void
+polygon_grid_build_polygons(polygon_grid *this, map_builder *builder)
+{
+  build(this, builder, false);
+}
+
+void
+polygon_grid_free(polygon_grid *this)
+{
+  free(this->offsets);
+  free(this->refs);
+  this->offsets = NULL;
+  this->refs = NULL;
+}
+
+/*
+ * Both kinds of grid are filled the same way: a pass counting the refs
+ * of each cell, then one writing them where the counts put them
+ */
+static void
+build(polygon_grid *this, map_builder *builder, bool edges)
+{
+  register size_t i, j;
+  size_t pass, refs_count = 0, cells_count, *cursor = NULL;
+  vec2f min = VEC2F(FLT_MAX, FLT_MAX), max = VEC2F(-FLT_MAX, -FLT_MAX), size, v0, v1;
+  polygon *poly;
+
+  for (i = 0; i < builder->polygons_count; ++i) {
+    poly = &builder->polygons[i];
+
+    if (!poly->bounds_valid) {
+      polygon_update_bounds(poly);
+    }
+
+    min = VEC2F(fminf(min.x, poly->bounds_min.x), fminf(min.y, poly->bounds_min.y));
+    max = VEC2F(fmaxf(max.x, poly->bounds_max.x), fmaxf(max.y, poly->bounds_max.y));
+    refs_count += edges ? poly->vertices_count : 1;
+  }
+
+  if (!refs_count) {
+    *this = (polygon_grid) { .cell_size = 1.f, .offsets = calloc(1, sizeof(size_t)) };
+    return;
+  }
+
+  /* About one ref per cell if they were spread evenly */
+  this->origin = VEC2F(min.x - POLYGON_BOUNDS_MARGIN, min.y - POLYGON_BOUNDS_MARGIN);
+  size = VEC2F(max.x - min.x + 2.f * POLYGON_BOUNDS_MARGIN, max.y - min.y + 2.f * POLYGON_BOUNDS_MARGIN);
+  this->cell_size = sqrtf(size.x * size.y / refs_count);
+  this->cell_size = fmaxf(this->cell_size, fmaxf(size.x, size.y) / MAX_GRID_SIZE);
+  this->width = M_MAX(1, (int32_t)ceilf(size.x / this->cell_size));
+  this->height = M_MAX(1, (int32_t)ceilf(size.y / this->cell_size));
+
+  cells_count = this->width * this->height;
+  this->offsets = calloc(cells_count + 1, sizeof(size_t));
+  this->refs = NULL;
+
+  for (pass = 0; pass < 2; ++pass) {
+    if (pass == 1) {
+      for (i = 0; i < cells_count; ++i) {
+        this->offsets[i + 1] += this->offsets[i];
+      }
+
+      this->refs = malloc(M_MAX(1, this->offsets[cells_count]) * sizeof(polygon_grid_ref));
+      cursor = malloc(cells_count * sizeof(size_t));
+      memcpy(cursor, this->offsets, cells_count * sizeof(size_t));
+    }
+
+    for (i = 0; i < builder->polygons_count; ++i) {
+      poly = &builder->polygons[i];
+
+      if (!edges) {
+        add_ref(this, poly->bounds_min, poly->bounds_max, (polygon_grid_ref) { i, 0 }, cursor);
+        continue;
+      }
+
+      for (j = 0; j < poly->vertices_count; ++j) {
+        v0 = poly->vertices[j];
+        v1 = poly->vertices[j + 1 == poly->vertices_count ? 0 : j + 1];
+        add_ref(
+          this,
+          VEC2F(fminf(v0.x, v1.x), fminf(v0.y, v1.y)),
+          VEC2F(fmaxf(v0.x, v1.x), fmaxf(v0.y, v1.y)),
+          (polygon_grid_ref) { i, j },
+          cursor
+        );
+      }
+    }
+  }
+
+  free(cursor);
+}
+
+/* Counts the ref in the cells it touches, or writes it there once 'cursor' is given */
+static void
+add_ref(polygon_grid *this, vec2f min, vec2f max, polygon_grid_ref ref, size_t *cursor)
+{
+  register int32_t x, y;
+  const int32_t x0 = M_MAX(0, (int32_t)((min.x - POLYGON_BOUNDS_MARGIN - this->origin.x) / this->cell_size)),
+                y0 = M_MAX(0, (int32_t)((min.y - POLYGON_BOUNDS_MARGIN - this->origin.y) / this->cell_size)),
+                x1 = M_MIN(this->width - 1, (int32_t)((max.x + POLYGON_BOUNDS_MARGIN - this->origin.x) / this->cell_size)),
+                y1 = M_MIN(this->height - 1, (int32_t)((max.y + POLYGON_BOUNDS_MARGIN - this->origin.y) / this->cell_size));
+  size_t cell;
+
+  for (y = y0; y <= y1; ++y) {
+    for (x = x0; x <= x1; ++x) {
+      cell = y * this->width + x;
+
+      if (cursor) {
+        this->refs[cursor[cell]++] = ref;
+      } else {
+        this->offsets[cell + 1]++;
+      }
+    }
+  }
+}
@@ -0,0 +1,418 @@
+#include "visibility.h"
+#include "level_data.h"
+#include <time.h>
+
+#define VISIBILITY_EPSILON 0.01f
+#define MAX_WINDOW_CLIPS 8
+
+/*
+ * Every line of sight leaving a sector starts somewhere inside its convex
+ * hull, so the sets are flowed out of the hull through each of the sector's
+ * portals. Past the next portal, only points inside the wedge of lines
+ * crossing both the hull and the window of the portal we came through can
+ * be seen. Each linedef the wedge reaches is potentially visible, and for
+ * portals the window widens to take the part of them in the wedge in.
+ *
+ * Widening keeps one window per portal side instead of one per path, which
+ * can only make the set larger. Portals are flowed through in the order
+ * they're reached, so near windows are mostly done widening before the
+ * ones behind them are flowed through.
+ */
+
+/* Keeps points where dot(normal, p) - offset is >= 0 */
+typedef struct window_clip {
+  vec2f normal;
+  float offset;
+} window_clip;
+
+typedef struct flow_state {
+  level_data *level;
+  /* Sector row of the sector being flowed out of */
+  uint32_t *row;
+  /* Linedefs it sees so far, as bits (cleared again after each sector) and in the order found */
+  uint32_t *linedefs_seen,
+           *linedefs_found;
+  size_t linedefs_found_count;
+  vec2f *hull;
+  size_t hull_count;
+  /* Window of each linedef side, indexed by linedef * 2 + the side flowed out of */
+  struct flow_window {
+    uint32_t stamp;
+    bool queued;
+    float t0, t1;
+  } *windows;
+  /* Ring of linedef sides waiting to be flowed through */
+  size_t *queue, queue_size, queue_head, queue_count;
+  uint32_t stamp;
+} flow_state;
+
+M_INLINED void
+mark_linedef(flow_state *this, size_t index)
+{
+  if (!(this->linedefs_seen[index >> 5] & (1u << (index & 31)))) {
+    this->linedefs_seen[index >> 5] |= 1u << (index & 31);
+    this->linedefs_found[this->linedefs_found_count++] = (uint32_t)index;
+  }
+}
+
+static size_t
+sector_hull(const sector*, vec2f*);
+
+static int
+compare_points(const void*, const void*);
+
+static int
+compare_indices(const void*, const void*);
+
+static void
+flow(flow_state*, size_t);
+
+static void
+widen_window(flow_state*, const sector*, const linedef*, float, float);
+
+static size_t
+window_clips(const flow_state*, vec2f, vec2f, window_clip*);
+
+static bool
+make_clip(vec2f, vec2f, window_clip*);
+
+static bool
+hull_behind(const flow_state*, const window_clip*);
+
+static bool
+clip_window(const window_clip*, size_t, vec2f, vec2f, float*, float*);
+
+void
+visibility_build_sector_sets(level_data *this)
+{
+  register size_t i, j;
+  const size_t stride = LEVEL_DATA_VISIBILITY_STRIDE(this->sectors_count);
+  size_t max_linedefs = 0, capacity = this->linedefs_count;
+  const sector *sect;
+  const linedef *line;
+  flow_state state = {
+    .level = this,
+    .linedefs_seen = calloc(LEVEL_DATA_VISIBILITY_STRIDE(this->linedefs_count), sizeof(uint32_t)),
+    .linedefs_found = malloc(this->linedefs_count * sizeof(uint32_t)),
+    .windows = calloc(this->linedefs_count * 2, sizeof(*state.windows)),
+    .queue = malloc(this->linedefs_count * 2 * sizeof(size_t)),
+    .queue_size = this->linedefs_count * 2,
+    .stamp = 0
+  };
+
+  IF_DEBUG(clock_t begin = clock());
+
+  for (i = 0; i < this->sectors_count; ++i) {
+    if (this->sectors[i].linedefs_count > max_linedefs) {
+      max_linedefs = this->sectors[i].linedefs_count;
+    }
+  }
+
+  state.hull = malloc(max_linedefs * 4 * sizeof(vec2f));
+
+  free(this->sector_visibility);
+  free(this->linedef_visibility_offsets);
+  free(this->linedef_visibility);
+  this->sector_visibility = calloc(this->sectors_count * stride, sizeof(uint32_t));
+  this->linedef_visibility_offsets = malloc((this->sectors_count + 1) * sizeof(uint32_t));
+  this->linedef_visibility = malloc(capacity * sizeof(uint32_t));
+  this->linedef_visibility_offsets[0] = 0;
+
+  for (i = 0; i < this->sectors_count; ++i) {
+    sect = &this->sectors[i];
+    state.row = &this->sector_visibility[i * stride];
+    state.linedefs_found_count = 0;
+    state.hull_count = sector_hull(sect, state.hull);
+    state.stamp++;
+    state.queue_head = state.queue_count = 0;
+    state.row[i >> 5] |= 1u << (i & 31);
+
+    for (j = 0; j < sect->linedefs_count; ++j) {
+      line = sect->linedefs[j];
+      mark_linedef(&state, line - this->linedefs);
+
+      if (line->side[1].sector) {
+        widen_window(&state, sect, line, 0.f, 1.f);
+      }
+    }
+
+    while (state.queue_count) {
+      j = state.queue[state.queue_head];
+      state.queue_head = (state.queue_head + 1) % state.queue_size;
+      state.queue_count--;
+      flow(&state, j);
+    }
+
+    /* Only the linedefs seen are kept, sorted so rows can be walked in level order */
+    qsort(state.linedefs_found, state.linedefs_found_count, sizeof(uint32_t), compare_indices);
+
+    if (this->linedef_visibility_offsets[i] + state.linedefs_found_count > capacity) {
+      capacity = M_MAX(capacity * 2, this->linedef_visibility_offsets[i] + state.linedefs_found_count);
+      this->linedef_visibility = realloc(this->linedef_visibility, capacity * sizeof(uint32_t));
+    }
+
+    memcpy(&this->linedef_visibility[this->linedef_visibility_offsets[i]], state.linedefs_found, state.linedefs_found_count * sizeof(uint32_t));
+    this->linedef_visibility_offsets[i + 1] = this->linedef_visibility_offsets[i] + state.linedefs_found_count;
+
+    for (j = 0; j < state.linedefs_found_count; ++j) {
+      state.linedefs_seen[state.linedefs_found[j] >> 5] = 0;
+    }
+  }
+
+  free(state.queue);
+  free(state.hull);
+  free(state.windows);
+  free(state.linedefs_found);
+  free(state.linedefs_seen);
+
+  IF_DEBUG(printf(
+    "\tVisibility sets took %f seconds, %u linedef entries\n",
+    ((double)(clock() - begin) / CLOCKS_PER_SEC),
+    this->sectors_count ? this->linedef_visibility_offsets[this->sectors_count] : 0
+  ));
+}
+
+/* Convex hull of the sector's vertices in counter-clockwise order (monotone chain) */
+static size_t
+sector_hull(const sector *sect, vec2f *hull)
+{
+  register size_t i;
+  const size_t points_count = sect->linedefs_count * 2;
+  vec2f *points = hull + points_count;
+  size_t count = 0, lower;
+
+  for (i = 0; i < sect->linedefs_count; ++i) {
+    points[i * 2] = sect->linedefs[i]->v0->point;
+    points[i * 2 + 1] = sect->linedefs[i]->v1->point;
+  }
+
+  qsort(points, points_count, sizeof(vec2f), compare_points);
+
+  for (i = 0; i < points_count; ++i) {
+    while (count >= 2 && math_sign(hull[count - 2], hull[count - 1], points[i]) <= 0.f) {
+      count--;
+    }
+
+    hull[count++] = points[i];
+  }
+
+  for (i = points_count - 1, lower = count + 1; i-- > 0;) {
+    while (count >= lower && math_sign(hull[count - 2], hull[count - 1], points[i]) <= 0.f) {
+      count--;
+    }
+
+    hull[count++] = points[i];
+  }
+
+  /* The last point closes the loop back onto the first */
+  return count - 1;
+}
+
+static int
+compare_points(const void *a, const void *b)
+{
+  const vec2f *p = a, *q = b;
+
+  if (p->x != q->x) {
+    return p->x < q->x ? -1 : 1;
+  }
+
+  return p->y < q->y ? -1 : p->y > q->y ? 1 : 0;
+}
+
+static int
+compare_indices(const void *a, const void *b)
+{
+  const uint32_t p = *(const uint32_t*)a, q = *(const uint32_t*)b;
+  return p < q ? -1 : p > q ? 1 : 0;
+}
+
+/*
+ * Marks the sector behind a linedef side's window and the linedefs of it
+ * the wedge reaches, then widens the windows of the portals among them
+ */
+static void
+flow(flow_state *this, size_t side)
+{
+  register size_t i;
+  struct flow_window *window = &this->windows[side];
+  const linedef *through = &this->level->linedefs[side >> 1];
+  const sector *sect = through->side[!(side & 1)].sector;
+  const vec2f d = vec2f_sub(through->v1->point, through->v0->point);
+  const vec2f pass0 = vec2f_add(through->v0->point, vec2f_mul(d, window->t0));
+  const vec2f pass1 = vec2f_add(through->v0->point, vec2f_mul(d, window->t1));
+  window_clip clips[MAX_WINDOW_CLIPS];
+  const size_t clips_count = window_clips(this, pass0, pass1, clips);
+  const linedef *line;
+  float q0, q1;
+
+  window->queued = false;
+  this->row[(sect - this->level->sectors) >> 5] |= 1u << ((sect - this->level->sectors) & 31);
+
+  for (i = 0; i < sect->linedefs_count; ++i) {
+    line = sect->linedefs[i];
+
+    if (line == through || !clip_window(clips, clips_count, line->v0->point, line->v1->point, &q0, &q1)) {
+      continue;
+    }
+
+    mark_linedef(this, line - this->level->linedefs);
+
+    if (line->side[1].sector) {
+      widen_window(this, sect, line, q0, q1);
+    }
+  }
+}
+
+/* Grows the window of 'line' out of 'from' to take [t0, t1] in, queueing it if it changed */
+static void
+widen_window(flow_state *this, const sector *from, const linedef *line, float t0, float t1)
+{
+  const size_t side = (line - this->level->linedefs) * 2 + (line->side[0].sector == from ? 0 : 1);
+  struct flow_window *window = &this->windows[side];
+
+  if (window->stamp != this->stamp) {
+    window->stamp = this->stamp;
+    window->queued = false;
+  } else {
+    /* Growing by less than a sliver won't let anything new through */
+    if ((math_max(window->t0 - t0, 0.f) + math_max(t1 - window->t1, 0.f)) * math_vec2f_distance(line->v0->point, line->v1->point) <= VISIBILITY_EPSILON) {
+      return;
+    }
+
+    t0 = math_min(t0, window->t0);
+    t1 = math_max(t1, window->t1);
+  }
+
+  window->t0 = t0;
+  window->t1 = t1;
+
+  if (!window->queued) {
+    window->queued = true;
+    this->queue[(this->queue_head + this->queue_count++) % this->queue_size] = side;
+  }
+}
+
+/*
+ * A line of sight crosses the hull and then the window, so whatever it
+ * reaches lies past any line with the whole hull behind it and the window
+ * in front. Those through a hull vertex and a window end narrow it down to
+ * the wedge of lines crossing both, and the window's own line keeps it past
+ * the window. Degenerate cases (shared or collinear points) add no clip,
+ * which only makes the set larger.
+ */
+static size_t
+window_clips(const flow_state *this, vec2f pass0, vec2f pass1, window_clip *clips)
+{
+  register size_t i, j;
+  const vec2f pass[2] = { pass0, pass1 };
+  vec2f prev, next;
+  size_t count = 0;
+  float side, d0, d1;
+
+  for (i = 0; i < this->hull_count; ++i) {
+    prev = this->hull[i ? i - 1 : this->hull_count - 1];
+    next = this->hull[(i + 1) % this->hull_count];
+
+    for (j = 0; j < 2 && count < MAX_WINDOW_CLIPS - 2; ++j) {
+      /* The hull is convex, so it's behind a line through one of its vertices if both neighbours are */
+      side = math_sign(this->hull[i], pass[j], pass[!j]);
+      d0 = math_sign(this->hull[i], pass[j], prev) * side;
+      d1 = math_sign(this->hull[i], pass[j], next) * side;
+
+      if (d0 > 0.f || d1 > 0.f || (d0 == 0.f && d1 == 0.f)) {
+        continue;
+      }
+
+      if (!make_clip(this->hull[i], pass[j], &clips[count])) {
+        continue;
+      }
+
+      side = math_dot2(clips[count].normal, pass[!j]) - clips[count].offset;
+
+      if (fabsf(side) <= VISIBILITY_EPSILON) {
+        continue;
+      }
+
+      if (side < 0.f) {
+        clips[count].normal = vec2f_mul(clips[count].normal, -1.f);
+        clips[count].offset = -clips[count].offset;
+      }
+
+      count++;
+    }
+  }
+
+  if (make_clip(pass0, pass1, &clips[count])) {
+    count += hull_behind(this, &clips[count]);
+
+    make_clip(pass1, pass0, &clips[count]);
+    count += hull_behind(this, &clips[count]);
+  }
+
+  return count;
+}
+
+/* Clip keeping the left of a -> b, unless they're too close together to make one */
+static bool
+make_clip(vec2f a, vec2f b, window_clip *clip)
+{
+  const float length = math_vec2f_distance(a, b);
+
+  if (length < VISIBILITY_EPSILON) {
+    return false;
+  }
+
+  clip->normal = VEC2F((a.y - b.y) / length, (b.x - a.x) / length);
+  clip->offset = math_dot2(clip->normal, a);
+
+  return true;
+}
+
+/* Whether the whole hull is behind the clip, and not all of it on the line */
+static bool
+hull_behind(const flow_state *this, const window_clip *clip)
+{
+  register size_t i;
+  bool off_line = false;
+  float d;
+
+  for (i = 0; i < this->hull_count; ++i) {
+    d = math_dot2(clip->normal, this->hull[i]) - clip->offset;
+
+    if (d > VISIBILITY_EPSILON) {
+      return false;
+    }
+
+    off_line |= d < -VISIBILITY_EPSILON;
+  }
+
+  return off_line;
+}
+
+/* Clips v0 -> v1 against every clip, giving the part that's left as [t0, t1] */
+static bool
+clip_window(const window_clip *clips, size_t count, vec2f v0, vec2f v1, float *t0, float *t1)
+{
+  register size_t i;
+  float d0, d1;
+
+  *t0 = 0.f;
+  *t1 = 1.f;
+
+  for (i = 0; i < count; ++i) {
+    d0 = math_dot2(clips[i].normal, v0) - clips[i].offset;
+    d1 = math_dot2(clips[i].normal, v1) - clips[i].offset;
+
+    if (d0 < 0.f && d1 < 0.f) {
+      return false;
+    } else if (d0 < 0.f) {
+      *t0 = math_max(*t0, d0 / (d0 - d1));
+    } else if (d1 < 0.f) {
+      *t1 = math_min(*t1, d0 / (d0 - d1));
+    }
+  }
+
+  /* What's left of a window that only touches the wedge just grazes a corner */
+  return (*t1 - *t0) * math_vec2f_distance(v0, v1) > VISIBILITY_EPSILON;
+}
@@ -1,6 +1,9 @@
 #include "map_cache.h"
 #include "level_data.h"
 #include <time.h>
+#include <string.h>
+
+#define CELL_EDGE_EPSILON 0.01f
 
 
 /* FORWARD DECLARATIONS */
@@ -11,28 +14,60 @@ collide(const map_cache*, int, int, float, float, float, vec3f, vec3f, vec2f, ve
 static void
 map_cache_add_or_remove_light_at_position(map_cache*, light*, vec3f, bool);
 
+static bool
+line_touches_cell(vec2f, vec2f, vec2f, vec2f);
+
+static void
+add_cell_sector(map_cache*, uint32_t*, int32_t, int32_t, sector*, uint32_t, bool);
+
+static size_t
+collect_cell_sectors(map_cache*, level_data*, uint32_t*, bool);
+
+static void
+rasterize_linedefs(map_cache*, level_data*, uint32_t*, uint32_t*);
+
+static void
+add_cell_linedef(map_cache*, uint32_t*, uint32_t*, int32_t, int32_t, uint32_t);
+
+static void
+widen_block_bounds(map_cache_block*, const map_cache_line*);
+
+static float
+pick_cell_size(const level_data*);
+
+static float
+fit_cell_size(const level_data*, float);
+
 
 /* PUBLIC API */
 
 void
-map_cache_process_level_data(map_cache *this, level_data *data)
+map_cache_process_level_data(map_cache *this, level_data *data, float cell_size)
 {
   register size_t i;
-  int16_t x, y;
-  const int16_t cells_w = (int16_t)math_max(1, ceilf((data->max.x - data->min.x) / CELL_SIZE));
-  const int16_t cells_h = (int16_t)math_max(1, ceilf((data->max.y - data->min.y) / CELL_SIZE));
-  vec2f v0, v1, p0, p1, p2, p3;
-  linedef *line;
+  uint16_t cells_w, cells_h;
+  size_t cells_count;
   map_cache_cell *cell;
+  map_cache_block *block;
+  linedef *line;
+  uint32_t *stamps, *cursors, li;
+  size_t sectors_count;
+
+  this->cell_size = fit_cell_size(data, cell_size > 0.f ? cell_size : pick_cell_size(data));
+  cells_w = (uint16_t)math_max(1, ceilf((data->max.x - data->min.x) / this->cell_size));
+  cells_h = (uint16_t)math_max(1, ceilf((data->max.y - data->min.y) / this->cell_size));
+  cells_count = (size_t)cells_w * cells_h;
 
   IF_DEBUG(printf(
     "\tLevel bounds:\n"
     "\t\tMin: %f, %f\n"
     "\t\tMax: %f, %f\n"
+    "\tCell size: %f\n"
     "\tHorizontal cells: %d\n"
     "\tVertical cells: %d\n",
     data->min.x, data->min.y,
     data->max.x, data->max.y,
+    this->cell_size,
     cells_w,
     cells_h
   ); clock_t begin = clock());
@@ -40,45 +75,90 @@ map_cache_process_level_data(map_cache *this, level_data *data)
   this->w = cells_w;
   this->h = cells_h;
   this->origin = data->min;
-  this->cells = malloc(sizeof(map_cache_cell)*cells_w*cells_h);
-
-  for (y = 0; y < cells_h; ++y) {
-    for (x = 0; x < cells_w; ++x) {
-      cell = &this->cells[y*cells_w + x];
-      cell->count = 0;
-      cell->lights_count = 0;
-
-      p0 = VEC2F(x*CELL_SIZE, y*CELL_SIZE);
-      p1 = VEC2F(x*CELL_SIZE+CELL_SIZE, y*CELL_SIZE);
-      p2 = VEC2F(x*CELL_SIZE+CELL_SIZE, y*CELL_SIZE+CELL_SIZE);
-      p3 = VEC2F(x*CELL_SIZE, y*CELL_SIZE+CELL_SIZE);
-
-      for (i = 0; i < data->linedefs_count; ++i) {
-        line = &data->linedefs[i];
-
-        v0 = vec2f_sub(line->v0->point, this->origin);
-        v1 = vec2f_sub(line->v1->point, this->origin);
-
-        if (math_find_line_intersection(v0, v1, p0, p1, NULL, NULL) ||
-            math_find_line_intersection(v0, v1, p1, p2, NULL, NULL) ||
-            math_find_line_intersection(v0, v1, p2, p3, NULL, NULL) ||
-            math_find_line_intersection(v0, v1, p3, p0, NULL, NULL) ||
-            ((v0.x >= p0.x && v0.y >= p0.y && v0.x < p2.x && v0.y < p2.y) &&
-             (v1.x >= p0.x && v1.y >= p0.y && v1.x < p2.x && v1.y < p2.y))
-        ) {
-          if (cell->count == 0) {
-            cell->linedefs = (linedef**)malloc(sizeof(linedef*));
-          } else {
-            cell->linedefs = (linedef**)realloc(cell->linedefs, (cell->count+1)*sizeof(linedef*));
-          }
-          cell->linedefs[cell->count++] = line;
-        }
-      }
+  this->cells = malloc(sizeof(map_cache_cell)*cells_count);
+
+  for (i = 0; i < cells_count; ++i) {
+    cell = &this->cells[i];
+    cell->lights = (light_list) { 0 };
+    cell->sectors_count = 0;
+    cell->sectors = NULL;
+    cell->entities = NULL;
+  }
+
+  this->lines = malloc(data->linedefs_count * sizeof(map_cache_line));
+
+  for (i = 0; i < data->linedefs_count; ++i) {
+    line = &data->linedefs[i];
+    this->lines[i] = (map_cache_line) {
+      .v0 = line->v0->point,
+      .direction = line->direction,
+      .max_floor_height = line->max_floor_height,
+      .min_ceiling_height = line->min_ceiling_height,
+      .solid = !line->side[1].sector
+    };
+  }
 
-      // printf("Cell %d, %d references %d lines\n", x, y, cell->count);
+  stamps = calloc(cells_count, sizeof(uint32_t));
+
+  /* Linedefs: count the cells each one crosses, then fill in one array */
+  this->cell_offsets = calloc(cells_count + 1, sizeof(uint32_t));
+  rasterize_linedefs(this, data, stamps, NULL);
+
+  for (i = 0; i < cells_count; ++i) {
+    this->cell_offsets[i+1] += this->cell_offsets[i];
+  }
+
+  this->cell_linedefs = malloc(this->cell_offsets[cells_count] * sizeof(uint32_t));
+  cursors = malloc(cells_count * sizeof(uint32_t));
+  memcpy(cursors, this->cell_offsets, cells_count * sizeof(uint32_t));
+  memset(stamps, 0, cells_count*sizeof(uint32_t));
+  rasterize_linedefs(this, data, stamps, cursors);
+  free(cursors);
+
+  /* Coarse blocks and their height bounds */
+  this->blocks_w = ((cells_w - 1) >> MAP_CACHE_BLOCK_SHIFT) + 1;
+  this->blocks_h = ((cells_h - 1) >> MAP_CACHE_BLOCK_SHIFT) + 1;
+  this->blocks = malloc((size_t)this->blocks_w * this->blocks_h * sizeof(map_cache_block));
+
+  for (i = 0; i < (size_t)this->blocks_w * this->blocks_h; ++i) {
+    this->blocks[i] = (map_cache_block) {
+      .count = 0,
+      .max_floor_height = -FLT_MAX,
+      .min_ceiling_height = FLT_MAX
+    };
+  }
+
+  for (i = 0; i < cells_count; ++i) {
+    block = &this->blocks[((i / cells_w) >> MAP_CACHE_BLOCK_SHIFT) * this->blocks_w + ((i % cells_w) >> MAP_CACHE_BLOCK_SHIFT)];
+
+    for (li = this->cell_offsets[i]; li < this->cell_offsets[i+1]; ++li) {
+      widen_block_bounds(block, &this->lines[this->cell_linedefs[li]]);
     }
+
+    block->count += this->cell_offsets[i+1] - this->cell_offsets[i];
+  }
+
+  for (i = 0; i < data->linedefs_count; ++i) {
+    data->linedefs[i].cache = this;
+    data->linedefs[i].cache_line = &this->lines[i];
   }
 
+  /* Point location: count the candidate sectors of each cell, then fill */
+  memset(stamps, 0, cells_count*sizeof(uint32_t));
+  sectors_count = collect_cell_sectors(this, data, stamps, false);
+  this->sectors = malloc(sectors_count * sizeof(sector*));
+
+  for (i = 0, sectors_count = 0; i < cells_count; ++i) {
+    cell = &this->cells[i];
+    cell->sectors = &this->sectors[sectors_count];
+    sectors_count += cell->sectors_count;
+    cell->sectors_count = 0;
+  }
+
+  memset(stamps, 0, cells_count*sizeof(uint32_t));
+  collect_cell_sectors(this, data, stamps, true);
+  free(stamps);
+
   IF_DEBUG(printf("Time taken: %.3fs\n", (double)(clock() - begin) / CLOCKS_PER_SEC))
 }
 
@@ -89,6 +169,96 @@ map_cache_process_light(map_cache *this, light *light, vec3f previous_position)
   map_cache_add_or_remove_light_at_position(this, light, entity_world_position(&light->entity), true);
 }
 
+void
+map_cache_link_entity(map_cache *this, entity *e)
+{
+  map_cache_cell *cell = map_cache_cell_at(this, e->position);
+
+  if (cell == e->cell) {
+    return;
+  }
+
+  map_cache_unlink_entity(this, e);
+
+  if (!cell) {
+    return;
+  }
+
+  e->cell = cell;
+  e->cell_prev = NULL;
+  e->cell_next = cell->entities;
+
+  if (cell->entities) {
+    cell->entities->cell_prev = e;
+  }
+
+  cell->entities = e;
+}
+
+void
+map_cache_unlink_entity(map_cache *this, entity *e)
+{
+  M_UNUSED(this);
+
+  if (!e->cell) {
+    return;
+  }
+
+  if (e->cell_prev) {
+    e->cell_prev->cell_next = e->cell_next;
+  } else {
+    e->cell->entities = e->cell_next;
+  }
+
+  if (e->cell_next) {
+    e->cell_next->cell_prev = e->cell_prev;
+  }
+
+  e->cell = NULL;
+  e->cell_prev = e->cell_next = NULL;
+}
+
+sector*
+map_cache_find_sector(const map_cache *this, vec2f point)
+{
+  register uint16_t i;
+  const map_cache_cell *cell = map_cache_cell_at(this, point);
+
+  if (!cell) {
+    return NULL;
+  }
+
+  for (i = 0; i < cell->sectors_count; ++i) {
+    if (sector_point_inside(cell->sectors[i], point)) {
+      return cell->sectors[i];
+    }
+  }
+
+  return NULL;
+}
+
+/*
+ * Called when the heights of a linedef change. Every block under the
+ * line's bounding box is widened to fit it, which may loosen some blocks
+ * the line doesn't touch, but never makes a block skip a line it shouldn't.
+ */
+void
+map_cache_update_line_bounds(map_cache *this, const linedef *line)
+{
+  register int32_t x, y;
+  const float block_size = this->cell_size * (1 << MAP_CACHE_BLOCK_SHIFT);
+  const int32_t x0 = M_MAX(0, (int32_t)floorf((line->xmin - this->origin.x) / block_size));
+  const int32_t y0 = M_MAX(0, (int32_t)floorf((line->ymin - this->origin.y) / block_size));
+  const int32_t x1 = M_MIN(this->blocks_w - 1, (int32_t)floorf((line->xmax - this->origin.x) / block_size));
+  const int32_t y1 = M_MIN(this->blocks_h - 1, (int32_t)floorf((line->ymax - this->origin.y) / block_size));
+
+  for (y = y0; y <= y1; ++y) {
+    for (x = x0; x <= x1; ++x) {
+      widen_block_bounds(&this->blocks[y * this->blocks_w + x], line->cache_line);
+    }
+  }
+}
+
 bool
 map_cache_intersect_3d(const map_cache *this, vec3f _start, vec3f _end)
 {
@@ -110,15 +280,15 @@ map_cache_intersect_3d(const map_cache *this, vec3f _start, vec3f _end)
   end.x += (dx < 0) ? -0.001f : (dx > 0) ? 0.001f : 0.f;
   end.y += (dy < 0) ? -0.001f : (dy > 0) ? 0.001f : 0.f;
 
-  int ix = (int)floorf(start.x / CELL_SIZE);
-  int iy = (int)floorf(start.y / CELL_SIZE);
+  int ix = (int)floorf(start.x / this->cell_size);
+  int iy = (int)floorf(start.y / this->cell_size);
 
   if (ix < 0 || iy < 0 || ix >= this->w || iy >= this->h) {
     return true;
   }
 
-  const int ix_end = (int)floorf(end.x / CELL_SIZE);
-  const int iy_end = (int)floorf(end.y / CELL_SIZE);
+  const int ix_end = (int)floorf(end.x / this->cell_size);
+  const int iy_end = (int)floorf(end.y / this->cell_size);
 
   if (ix_end < 0 || iy_end < 0 || ix_end >= this->w || iy_end >= this->h) {
     return true;
@@ -126,17 +296,58 @@ map_cache_intersect_3d(const map_cache *this, vec3f _start, vec3f _end)
 
   const int step_x = (dx > 0) ? 1 : (dx < 0) ? -1 : 0;
   const int step_y = (dy > 0) ? 1 : (dy < 0) ? -1 : 0;
-  const float tDeltaX = (step_x != 0) ? CELL_SIZE * fdx : FLT_MAX;
-  const float tDeltaY = (step_y != 0) ? CELL_SIZE * fdy : FLT_MAX;
-  const float x_offset = (step_x > 0) ? (CELL_SIZE * (ix + 1) - start.x) : (start.x - CELL_SIZE * ix);
-  const float y_offset = (step_y > 0) ? (CELL_SIZE * (iy + 1) - start.y) : (start.y - CELL_SIZE * iy);
+  const float tDeltaX = (step_x != 0) ? this->cell_size * fdx : FLT_MAX;
+  const float tDeltaY = (step_y != 0) ? this->cell_size * fdy : FLT_MAX;
+  const float x_offset = (step_x > 0) ? (this->cell_size * (ix + 1) - start.x) : (start.x - this->cell_size * ix);
+  const float y_offset = (step_y > 0) ? (this->cell_size * (iy + 1) - start.y) : (start.y - this->cell_size * iy);
   register float tMaxX = (step_x != 0) ? x_offset * fdx : FLT_MAX;
   register float tMaxY = (step_y != 0) ? y_offset * fdy : FLT_MAX;
   register float t = 0.f;
+  int bx, by, kx, ky;
+  float t_exit_x, t_exit_y, t_exit, z0, z1;
+  const map_cache_block *block;
 
   // printf("Go from (%f, %f) %d, %d to (%f, %f) %d, %d:\n", start.x, start.y, ix, iy, end.x, end.y, ix_end, iy_end);
 
   while (1) {
+    bx = ix >> MAP_CACHE_BLOCK_SHIFT;
+    by = iy >> MAP_CACHE_BLOCK_SHIFT;
+    block = &this->blocks[by * this->blocks_w + bx];
+
+    /* Cells left to cross inside this block along each axis */
+    kx = (step_x > 0) ? ((bx + 1) << MAP_CACHE_BLOCK_SHIFT) - 1 - ix : (step_x < 0) ? ix - (bx << MAP_CACHE_BLOCK_SHIFT) : 0;
+    ky = (step_y > 0) ? ((by + 1) << MAP_CACHE_BLOCK_SHIFT) - 1 - iy : (step_y < 0) ? iy - (by << MAP_CACHE_BLOCK_SHIFT) : 0;
+    t_exit_x = step_x ? tMaxX + kx * tDeltaX : FLT_MAX;
+    t_exit_y = step_y ? tMaxY + ky * tDeltaY : FLT_MAX;
+    t_exit = math_min(1.f, math_min(t_exit_x, t_exit_y));
+    z0 = _start.z + t * dz;
+    z1 = _start.z + t_exit * dz;
+
+    if (!block->count || (math_min(z0, z1) > block->max_floor_height && math_max(z0, z1) < block->min_ceiling_height)) {
+      if ((ix_end >> MAP_CACHE_BLOCK_SHIFT) == bx && (iy_end >> MAP_CACHE_BLOCK_SHIFT) == by) {
+        return false;
+      }
+
+      /* Jump to the first cell of the next block, catching up on the other axis */
+      if (t_exit_x <= t_exit_y) {
+        t = t_exit_x;
+        ix += (kx + 1) * step_x;
+        tMaxX = t_exit_x + tDeltaX;
+        while (step_y && ky-- > 0 && tMaxY < t) { iy += step_y; tMaxY += tDeltaY; }
+      } else {
+        t = t_exit_y;
+        iy += (ky + 1) * step_y;
+        tMaxY = t_exit_y + tDeltaY;
+        while (step_x && kx-- > 0 && tMaxX < t) { ix += step_x; tMaxX += tDeltaX; }
+      }
+
+      if (ix < 0 || iy < 0 || ix >= this->w || iy >= this->h) {
+        return true;
+      }
+
+      continue;
+    }
+
     if (collide(this, ix, iy, _start.z + t * dz, _start.z + ((tMaxX < tMaxY) ? tMaxX : tMaxY) * dz, dz, _start, _end, ray_start_xy, ray_direction_xy)) {
       return true;
     }
@@ -165,18 +376,13 @@ map_cache_intersect_3d(const map_cache *this, vec3f _start, vec3f _end)
 M_INLINED bool
 collide(const map_cache *this, int x, int y, float current_z, float next_z, float dz, vec3f start, vec3f end, vec2f start_xy, vec2f ray_dir)
 {
-  const map_cache_cell *cell = &this->cells[y*this->w+x];
-
-  if (cell->count == 0) {
-    return false;
-  }
-
-  register size_t li;
+  register uint32_t li = this->cell_offsets[y*this->w+x];
+  const uint32_t last = this->cell_offsets[y*this->w+x+1];
   float det, z;
-  linedef *line;
+  const map_cache_line *line;
 
-  for (li = 0; li < cell->count; ++li) {
-    line = cell->linedefs[li];
+  for (; li < last; ++li) {
+    line = &this->lines[this->cell_linedefs[li]];
 
     if (dz < 0) {
       if (line->max_floor_height < next_z && line->min_ceiling_height > current_z) {
@@ -188,8 +394,8 @@ collide(const map_cache *this, int x, int y, float current_z, float next_z, floa
       }
     }
 
-    if (math_find_line_intersection_cached(start_xy, line->v0->point, ray_dir, line->direction, NULL, &det, NULL) && det > MATHS_EPSILON) {
-      if (!line->side[1].sector) {
+    if (math_find_line_intersection_cached(start_xy, line->v0, ray_dir, line->direction, NULL, &det, NULL) && det > MATHS_EPSILON) {
+      if (line->solid) {
         return true;
       }
 
@@ -208,22 +414,21 @@ static void
 map_cache_add_or_remove_light_at_position(map_cache *this, light *l, vec3f position, bool add)
 {
   uint16_t x, y;
-  uint8_t i,j;
   map_cache_cell *cell;
 
   const vec2f light_pos_local = VEC2F(
-    math_max(0, l->entity.position.x - this->origin.x),
-    math_max(0, l->entity.position.y - this->origin.y)
+    math_max(0, position.x - this->origin.x),
+    math_max(0, position.y - this->origin.y)
   );
 
   /* Find all cells this light touches */
   const vec2u cell_min = VEC2U(
-    M_MAX(0, (light_pos_local.x - l->radius) / CELL_SIZE),
-    M_MAX(0, (light_pos_local.y - l->radius) / CELL_SIZE)
+    M_MAX(0, (light_pos_local.x - l->radius) / this->cell_size),
+    M_MAX(0, (light_pos_local.y - l->radius) / this->cell_size)
   );
   const vec2u cell_max = VEC2U(
-    M_MIN(this->w - 1, (light_pos_local.x + l->radius) / CELL_SIZE),
-    M_MIN(this->h - 1, (light_pos_local.y + l->radius) / CELL_SIZE)
+    M_MIN(this->w - 1, (light_pos_local.x + l->radius) / this->cell_size),
+    M_MIN(this->h - 1, (light_pos_local.y + l->radius) / this->cell_size)
   );
 
   for (y = cell_min.y; y <= cell_max.y; ++y) {
@@ -231,20 +436,269 @@ map_cache_add_or_remove_light_at_position(map_cache *this, light *l, vec3f posit
       cell = &this->cells[y*this->w+x];
 
       if (add) {
-        if (cell->lights_count < MAX_LIGHTS_PER_SURFACE) {
-          cell->lights[cell->lights_count++] = l;
-        }
+        light_list_insert(&cell->lights, &this->light_pool, l);
       } else {
-        for (i = 0; i < cell->lights_count; ++i) {
-          if (cell->lights[i] == l) {
-            for (j = i; j < cell->lights_count-1; ++j) {
-              cell->lights[j] = cell->lights[j+1];
-            }
-            cell->lights_count --;
-            break;
+        light_list_remove(&cell->lights, &this->light_pool, l);
+      }
+    }
+  }
+}
+
+static bool
+line_touches_cell(vec2f v0, vec2f v1, vec2f p0, vec2f p2)
+{
+  const vec2f p1 = VEC2F(p2.x, p0.y);
+  const vec2f p3 = VEC2F(p0.x, p2.y);
+
+  return
+    math_find_line_intersection(v0, v1, p0, p1, NULL, NULL) ||
+    math_find_line_intersection(v0, v1, p1, p2, NULL, NULL) ||
+    math_find_line_intersection(v0, v1, p2, p3, NULL, NULL) ||
+    math_find_line_intersection(v0, v1, p3, p0, NULL, NULL) ||
+    ((v0.x >= p0.x && v0.y >= p0.y && v0.x < p2.x && v0.y < p2.y) &&
+     (v1.x >= p0.x && v1.y >= p0.y && v1.x < p2.x && v1.y < p2.y));
+}
+
+static void
+add_cell_sector(map_cache *this, uint32_t *stamps, int32_t x, int32_t y, sector *sect, uint32_t stamp, bool fill)
+{
+  map_cache_cell *cell = &this->cells[y*this->w+x];
+
+  stamps[y*this->w+x] = stamp;
+
+  if (fill) {
+    cell->sectors[cell->sectors_count] = sect;
+  }
+
+  cell->sectors_count++;
+}
+
+/*
+ * A sector is a candidate for every cell its linedefs touch. Cells inside
+ * the sector's bounds that none of its linedefs touch are either wholly
+ * inside or wholly outside it, which a single test at the cell center
+ * decides. Sectors are visited in level order, so each cell's list keeps
+ * the order of a linear scan. When not filling, only counts are updated.
+ */
+static size_t
+collect_cell_sectors(map_cache *this, level_data *data, uint32_t *stamps, bool fill)
+{
+  register size_t si, li;
+  register int32_t x, y;
+  size_t total = 0;
+  sector *sect;
+  linedef *line;
+  vec2f min, max, v0, v1, p0;
+  int32_t x0, y0, x1, y1;
+
+  for (si = 0; si < data->sectors_count; ++si) {
+    sect = &data->sectors[si];
+
+    if (!sect->linedefs_count) {
+      continue;
+    }
+
+    min = VEC2F(FLT_MAX, FLT_MAX);
+    max = VEC2F(-FLT_MAX, -FLT_MAX);
+
+    for (li = 0; li < sect->linedefs_count; ++li) {
+      line = sect->linedefs[li];
+      v0 = vec2f_sub(line->v0->point, this->origin);
+      v1 = vec2f_sub(line->v1->point, this->origin);
+
+      min = VEC2F(math_min(min.x, math_min(v0.x, v1.x)), math_min(min.y, math_min(v0.y, v1.y)));
+      max = VEC2F(math_max(max.x, math_max(v0.x, v1.x)), math_max(max.y, math_max(v0.y, v1.y)));
+
+      x0 = M_MAX(0, (int32_t)floorf(math_min(v0.x, v1.x) / this->cell_size));
+      y0 = M_MAX(0, (int32_t)floorf(math_min(v0.y, v1.y) / this->cell_size));
+      x1 = M_MIN(this->w - 1, (int32_t)floorf(math_max(v0.x, v1.x) / this->cell_size));
+      y1 = M_MIN(this->h - 1, (int32_t)floorf(math_max(v0.y, v1.y) / this->cell_size));
+
+      for (y = y0; y <= y1; ++y) {
+        for (x = x0; x <= x1; ++x) {
+          if (stamps[y*this->w+x] == si + 1) {
+            continue;
           }
+
+          p0 = VEC2F(x*this->cell_size, y*this->cell_size);
+
+          if (line_touches_cell(v0, v1, p0, VEC2F(p0.x+this->cell_size, p0.y+this->cell_size))) {
+            add_cell_sector(this, stamps, x, y, sect, si + 1, fill);
+            total++;
+          }
+        }
+      }
+    }
+
+    x0 = M_MAX(0, (int32_t)floorf(min.x / this->cell_size));
+    y0 = M_MAX(0, (int32_t)floorf(min.y / this->cell_size));
+    x1 = M_MIN(this->w - 1, (int32_t)floorf(max.x / this->cell_size));
+    y1 = M_MIN(this->h - 1, (int32_t)floorf(max.y / this->cell_size));
+
+    for (y = y0; y <= y1; ++y) {
+      for (x = x0; x <= x1; ++x) {
+        if (stamps[y*this->w+x] == si + 1) {
+          continue;
+        }
+
+        p0 = VEC2F(this->origin.x + (x+0.5f)*this->cell_size, this->origin.y + (y+0.5f)*this->cell_size);
+
+        if (sector_point_inside(sect, p0)) {
+          add_cell_sector(this, stamps, x, y, sect, si + 1, fill);
+          total++;
         }
       }
     }
   }
+
+  return total;
+}
+
+/* Counts the entry when there are no 'cursors' to fill it in */
+static void
+add_cell_linedef(map_cache *this, uint32_t *stamps, uint32_t *cursors, int32_t x, int32_t y, uint32_t index)
+{
+  const int32_t cell = y*this->w+x;
+
+  if (x < 0 || y < 0 || x >= this->w || y >= this->h || stamps[cell] == index + 1) {
+    return;
+  }
+
+  stamps[cell] = index + 1;
+
+  if (cursors) {
+    this->cell_linedefs[cursors[cell]++] = index;
+  } else {
+    this->cell_offsets[cell+1]++;
+  }
+}
+
+/*
+ * Walk each linedef through the grid from cell to cell. To stay
+ * conservative, the neighbouring cell is added too wherever the part of
+ * the line inside a cell comes within CELL_EDGE_EPSILON of that cell's
+ * edge, which covers lines running along cell edges and through corners.
+ */
+static void
+rasterize_linedefs(map_cache *this, level_data *data, uint32_t *stamps, uint32_t *cursors)
+{
+  register size_t i, steps;
+  linedef *line;
+  vec2f v0, v1, d, a, b;
+  float t0, t1, t_max_x, t_max_y, t_delta_x, t_delta_y, lo, hi;
+  int32_t x, y, x_end, y_end, step_x, step_y;
+
+  for (i = 0; i < data->linedefs_count; ++i) {
+    line = &data->linedefs[i];
+
+    v0 = vec2f_sub(line->v0->point, this->origin);
+    v1 = vec2f_sub(line->v1->point, this->origin);
+    d = vec2f_sub(v1, v0);
+
+    x = M_CLAMP((int32_t)floorf(v0.x / this->cell_size), 0, this->w - 1);
+    y = M_CLAMP((int32_t)floorf(v0.y / this->cell_size), 0, this->h - 1);
+    x_end = M_CLAMP((int32_t)floorf(v1.x / this->cell_size), 0, this->w - 1);
+    y_end = M_CLAMP((int32_t)floorf(v1.y / this->cell_size), 0, this->h - 1);
+
+    step_x = (d.x > 0) ? 1 : (d.x < 0) ? -1 : 0;
+    step_y = (d.y > 0) ? 1 : (d.y < 0) ? -1 : 0;
+    t_delta_x = step_x ? this->cell_size / fabsf(d.x) : FLT_MAX;
+    t_delta_y = step_y ? this->cell_size / fabsf(d.y) : FLT_MAX;
+    t_max_x = step_x ? ((step_x > 0 ? (x + 1) * this->cell_size - v0.x : v0.x - x * this->cell_size) / fabsf(d.x)) : FLT_MAX;
+    t_max_y = step_y ? ((step_y > 0 ? (y + 1) * this->cell_size - v0.y : v0.y - y * this->cell_size) / fabsf(d.y)) : FLT_MAX;
+    t0 = 0.f;
+
+    for (steps = abs(x_end - x) + abs(y_end - y) + 1; steps; --steps) {
+      t1 = math_min(1.f, math_min(t_max_x, t_max_y));
+
+      /* Part of the line inside this cell */
+      a = vec2f_add(v0, vec2f_mul(d, t0));
+      b = vec2f_add(v0, vec2f_mul(d, t1));
+
+      add_cell_linedef(this, stamps, cursors, x, y, i);
+
+      lo = math_min(a.x, b.x); hi = math_max(a.x, b.x);
+      if (lo - x * this->cell_size < CELL_EDGE_EPSILON) { add_cell_linedef(this, stamps, cursors, x - 1, y, i); }
+      if ((x + 1) * this->cell_size - hi < CELL_EDGE_EPSILON) { add_cell_linedef(this, stamps, cursors, x + 1, y, i); }
+
+      lo = math_min(a.y, b.y); hi = math_max(a.y, b.y);
+      if (lo - y * this->cell_size < CELL_EDGE_EPSILON) { add_cell_linedef(this, stamps, cursors, x, y - 1, i); }
+      if ((y + 1) * this->cell_size - hi < CELL_EDGE_EPSILON) { add_cell_linedef(this, stamps, cursors, x, y + 1, i); }
+
+      if (x == x_end && y == y_end) {
+        break;
+      }
+
+      t0 = t1;
+
+      if (t_max_x < t_max_y) {
+        t_max_x += t_delta_x;
+        x = M_CLAMP(x + step_x, 0, this->w - 1);
+      } else {
+        t_max_y += t_delta_y;
+        y = M_CLAMP(y + step_y, 0, this->h - 1);
+      }
+    }
+
+    /* In case rounding made the walk miss its last cell */
+    add_cell_linedef(this, stamps, cursors, x_end, y_end, i);
+  }
+}
+
+/* Solid lines block at any height, so they make the block's bounds unusable */
+static void
+widen_block_bounds(map_cache_block *this, const map_cache_line *line)
+{
+  if (line->solid) {
+    this->max_floor_height = FLT_MAX;
+    this->min_ceiling_height = -FLT_MAX;
+  } else {
+    this->max_floor_height = math_max(this->max_floor_height, line->max_floor_height);
+    this->min_ceiling_height = math_min(this->min_ceiling_height, line->min_ceiling_height);
+  }
+}
+
+/*
+ * A linedef of length L covers about 1 + (4/pi)*L/s cells of size s, and the
+ * level covers area/s^2 cells. Solves E*s^2 + E*(4/pi)*L*s = N*area for s so
+ * that the E linedefs spread to N per cell on average.
+ */
+static float
+pick_cell_size(const level_data *data)
+{
+  register size_t i;
+  const float area = (data->max.x - data->min.x) * (data->max.y - data->min.y);
+  float length = 0.f, a, b, c;
+
+  if (!data->linedefs_count || area <= 0.f) {
+    return MAP_CACHE_MAX_CELL_SIZE;
+  }
+
+  for (i = 0; i < data->linedefs_count; ++i) {
+    length += data->linedefs[i].length;
+  }
+
+  a = (float)data->linedefs_count;
+  b = (4.f / M_PI) * length;
+  c = -(float)MAP_CACHE_LINEDEFS_PER_CELL * area;
+
+  return math_clamp((-b + sqrtf(b * b - 4.f * a * c)) / (2.f * a), MAP_CACHE_MIN_CELL_SIZE, MAP_CACHE_MAX_CELL_SIZE);
+}
+
+/*
+ * Raises a picked or requested cell size until the grid stays under
+ * MAP_CACHE_MAX_CELLS and each side can be counted in 16 bits
+ */
+static float
+fit_cell_size(const level_data *data, float cell_size)
+{
+  const float area = (data->max.x - data->min.x) * (data->max.y - data->min.y);
+
+  return math_max(
+    math_max(cell_size, MAP_CACHE_MIN_CELL_SIZE),
+    math_max(
+      sqrtf(math_max(area, 0.f) / MAP_CACHE_MAX_CELLS),
+      math_max(data->max.x - data->min.x, data->max.y - data->min.y) / (UINT16_MAX - 1)
+    )
+  );
 }
@@ -18,6 +18,8 @@
 
 #define MAX_SECTOR_HISTORY 64
 #define MAX_LINE_HITS_PER_COLUMN 48
+#define COLUMN_CHUNK_WIDTH 16
+#define SPRITE_CHUNK_WIDTH 16
 
 void (*texture_sampler)(texture_ref, float, float, texture_coordinates_func, uint8_t, uint8_t*, uint8_t*);
 
@@ -29,8 +31,12 @@ void (*texture_sampler)(texture_ref, float, float, texture_coordinates_func, uin
 #endif
 
 /* Common frame info all column renderers can share */
-typedef struct {
-  level_data *level;
+typedef struct frame_info {
+  const level_data *level;
+  renderer_view *view;
+  /* This view's frame in the renderer's packed buffers */
+  pixel_type *buffer;
+  depth_type *depth, *column_depth;
   vec2f view_position,
         far_left,
         far_right;
@@ -67,10 +73,11 @@ typedef struct {
         ray_end,
         ray_direction,
         ray_direction_unit;
-  float theta_inverse, top_limit, bottom_limit;
+  float theta_inverse, top_limit, bottom_limit, far_distance;
   uint32_t index, sector_depth, buffer_stride;
   pixel_type *buffer_start;
-  bool finished;
+  depth_type *depth_start;
+  bool finished, has_gaps;
 } column_info;
 
 #define DIMMING_DISTANCE 4096.f
@@ -85,9 +92,18 @@ static const float LIGHT_STEP_DISTANCE_INVERSE = 1.f / (DIMMING_DISTANCE / 4);
 static const float DIMMING_DISTANCE_INVERSE = 1.f / DIMMING_DISTANCE;
 #endif
 
+static void
+draw_views(const renderer*, renderer_view*, const struct camera *const*, frame_info*, size_t);
+
+static void
+begin_view(const renderer*, renderer_view*, const struct camera*, size_t, frame_info*);
+
+static void
+draw_columns(const renderer*, const frame_info*, const struct camera*, int32_t, int32_t);
+
 #ifdef RAYCASTER_PRERENDER_VISCHECK
   static void
-  refresh_sector_visibility(renderer*, const frame_info*, sector*);
+  refresh_visible_linedefs(renderer_view*, const frame_info*, const sector*);
 #endif
 
 static void
@@ -106,7 +122,34 @@ static void
 draw_column(const renderer*, const frame_info*, column_info*, const ray_intersection*);
 
 static void
-draw_sky_segment(const renderer *this, const frame_info*, const column_info*, uint32_t, uint32_t);
+draw_sky_segment(const renderer *this, const frame_info*, column_info*, uint32_t, uint32_t);
+
+static void
+collect_visible_sprites(const renderer*, const frame_info*, const struct camera*);
+
+static void
+draw_sprite_chunk(const renderer*, const frame_info*, int32_t);
+
+static void
+collect_visible_lights(const renderer*, const frame_info*, const struct camera*);
+
+M_INLINED void init_light_tiles(renderer_view *this, vec2i size) {
+  this->lights.tiles_w = (size.x + LIGHT_TILE_SIZE - 1) / LIGHT_TILE_SIZE;
+  this->lights.tiles_h = (size.y + LIGHT_TILE_SIZE - 1) / LIGHT_TILE_SIZE;
+
+  if ((size_t)(this->lights.tiles_w * this->lights.tiles_h) > this->lights.tiles_capacity) {
+    this->lights.tiles_capacity = this->lights.tiles_w * this->lights.tiles_h;
+    this->lights.tiles = realloc(this->lights.tiles, this->lights.tiles_capacity * sizeof(light_tile));
+  }
+}
+
+M_INLINED void allocate_frames(renderer *this, size_t frames_count) {
+  const size_t frame_size = this->buffer_size.x * this->buffer_size.y;
+  this->frames_count = frames_count;
+  this->buffer = realloc(this->buffer, frames_count * frame_size * sizeof(pixel_type));
+  this->depth = realloc(this->depth, frames_count * frame_size * sizeof(depth_type));
+  this->column_depth = realloc(this->column_depth, frames_count * this->buffer_size.x * sizeof(depth_type));
+}
 
 M_INLINED void init_depth_values(renderer *this) {
   register size_t y, h = this->buffer_size.y;
@@ -122,7 +165,13 @@ renderer_init(
   vec2i size
 ) {
   this->buffer_size = size;
-  this->buffer = malloc(size.x * size.y * sizeof(pixel_type));
+  this->buffer = NULL;
+  this->depth = NULL;
+  this->column_depth = NULL;
+  this->batch_views = NULL;
+  this->batch_frames = NULL;
+  this->batch_views_count = 0;
+  allocate_frames(this, 1);
   init_depth_values(this);
 }
 
@@ -132,7 +181,7 @@ renderer_resize(
   vec2i new_size
 ) {
   this->buffer_size = new_size;
-  this->buffer = realloc(this->buffer, new_size.x * new_size.y * sizeof(pixel_type));
+  allocate_frames(this, this->frames_count);
   free((float*)this->depth_values);
   init_depth_values(this);
 }
@@ -144,43 +193,223 @@ renderer_destroy(renderer *this)
     free(this->buffer);
     this->buffer = NULL;
   }
+  if (this->depth) {
+    free(this->depth);
+    this->depth = NULL;
+  }
+  if (this->depth_values) {
+    free((float*)this->depth_values);
+    this->depth_values = NULL;
+  }
+  if (this->column_depth) {
+    free(this->column_depth);
+    this->column_depth = NULL;
+  }
+  while (this->batch_views_count) {
+    renderer_view_destroy(&this->batch_views[--this->batch_views_count]);
+  }
+  free(this->batch_views);
+  free(this->batch_frames);
+  this->batch_views = NULL;
+  this->batch_frames = NULL;
+  this->frames_count = 0;
+}
+
+void
+renderer_view_init(renderer_view *this)
+{
+  this->sprites.list = NULL;
+  this->sprites.sort_buffer = NULL;
+  this->sprites.count = this->sprites.capacity = 0;
+  this->lights.visible = NULL;
+  this->lights.tiles = NULL;
+  this->lights.list = NULL;
+  this->lights.visible_count = this->lights.visible_capacity = this->lights.list_capacity = this->lights.tiles_capacity = 0;
+  this->lights.tiles_w = this->lights.tiles_h = 0;
+#ifdef RAYCASTER_PRERENDER_VISCHECK
+  this->visible.in_view = this->visible.candidates = NULL;
+  this->visible.lines = NULL;
+  this->visible.ranges = NULL;
+  this->visible.linedefs_capacity = this->visible.sectors_capacity = 0;
+  this->visible.frame = 0;
+#endif
+}
+
+void
+renderer_view_destroy(renderer_view *this)
+{
+  free(this->sprites.list);
+  free(this->sprites.sort_buffer);
+  this->sprites.list = this->sprites.sort_buffer = NULL;
+  this->sprites.count = this->sprites.capacity = 0;
+  free(this->lights.visible);
+  free(this->lights.tiles);
+  free(this->lights.list);
+  this->lights.visible = NULL;
+  this->lights.tiles = NULL;
+  this->lights.list = NULL;
+  this->lights.visible_count = this->lights.visible_capacity = this->lights.list_capacity = this->lights.tiles_capacity = 0;
+#ifdef RAYCASTER_PRERENDER_VISCHECK
+  free(this->visible.in_view);
+  free(this->visible.candidates);
+  free(this->visible.lines);
+  free(this->visible.ranges);
+  this->visible.in_view = this->visible.candidates = NULL;
+  this->visible.lines = NULL;
+  this->visible.ranges = NULL;
+  this->visible.linedefs_capacity = this->visible.sectors_capacity = 0;
+#endif
 }
 
 void
 renderer_draw(
   renderer *this,
-  camera *camera
+  renderer_view *view,
+  const camera *camera
 ) {
-  int32_t x;
   frame_info info;
 
-  assert(this->buffer);
-  memset(this->buffer, 0, this->buffer_size.x * this->buffer_size.y * sizeof(pixel_type));
-  
-  this->tick++;
-
-  int32_t half_h = this->buffer_size.y >> 1;
-  sector *root_sector = camera->entity.sector;
-
-  info.level = camera->entity.level;
-  info.view_position = camera->entity.position;
-  info.far_left = vec2f_add(camera->entity.position, vec2f_mul(vec2f_sub(camera->entity.direction, camera->plane), RENDERER_DRAW_DISTANCE));
-  info.far_right = vec2f_add(camera->entity.position, vec2f_mul(vec2f_add(camera->entity.direction, camera->plane), RENDERER_DRAW_DISTANCE));
-  info.half_w = this->buffer_size.x >> 1;
-  info.pitch_offset = (int32_t)floorf(camera->pitch * half_h);
-  info.half_h = half_h + info.pitch_offset;
-  info.unit_size = (this->buffer_size.x >> 1) / camera->fov;
-  info.view_z = camera->entity.z;
-  info.sky_texture = info.level->sky_texture;
+  assert(this->buffer && this->depth);
 
-#ifdef RAYCASTER_PRERENDER_VISCHECK
-  refresh_sector_visibility(this, &info, root_sector);
+  draw_views(this, view, &camera, &info, 1);
+
+#if defined(RAYCASTER_DEBUG) && !defined(RAYCASTER_PARALLEL_RENDERING)
+  renderer_step = NULL;
 #endif
+}
+
+/*
+ * Draws each camera into its own frame, all of them in one parallel
+ * region (see draw_views).
+ */
+void
+renderer_draw_batch(
+  renderer *this,
+  camera **cameras,
+  size_t count
+) {
+  if (count > this->frames_count) {
+    allocate_frames(this, count);
+  }
+
+  if (count > this->batch_views_count) {
+    this->batch_views = realloc(this->batch_views, count * sizeof(renderer_view));
+    this->batch_frames = realloc(this->batch_frames, count * sizeof(frame_info));
+
+    for (; this->batch_views_count < count; ++this->batch_views_count) {
+      renderer_view_init(&this->batch_views[this->batch_views_count]);
+    }
+  }
+
+  assert(this->buffer && this->depth);
+
+  draw_views(this, this->batch_views, (const camera *const*)cameras, this->batch_frames, count);
+
+#if defined(RAYCASTER_DEBUG) && !defined(RAYCASTER_PARALLEL_RENDERING)
+  renderer_step = NULL;
+#endif
+}
+
+/*
+ * Draws view i of 'count' into frame i. Threads first set up whole views,
+ * then share out (view, chunk of columns) pairs, so a batch of small views
+ * and a single large one both keep every thread busy. Sprites go last, as
+ * they are clipped against the columns drawn before them.
+ */
+static void
+draw_views(
+  const renderer *this,
+  renderer_view *views,
+  const camera *const *cameras,
+  frame_info *frames,
+  size_t count
+) {
+  int32_t i, x;
+  const int32_t columns_chunks = (this->buffer_size.x + COLUMN_CHUNK_WIDTH - 1) / COLUMN_CHUNK_WIDTH;
+  const int32_t sprite_chunks = (this->buffer_size.x + SPRITE_CHUNK_WIDTH - 1) / SPRITE_CHUNK_WIDTH;
+
+#ifdef RAYCASTER_PARALLEL_RENDERING
+  #pragma omp parallel private(i, x)
+#endif
+  {
+#ifdef RAYCASTER_PARALLEL_RENDERING
+    #pragma omp for schedule(dynamic)
+#endif
+    for (i = 0; i < (int32_t)count; ++i) {
+      begin_view(this, &views[i], cameras[i], i, &frames[i]);
+    }
 
 #ifdef RAYCASTER_PARALLEL_RENDERING
-  #pragma omp parallel for
+    #pragma omp for schedule(dynamic)
 #endif
-  for (x = 0; x < this->buffer_size.x; ++x) {
+    for (i = 0; i < (int32_t)count * columns_chunks; ++i) {
+      x = (i % columns_chunks) * COLUMN_CHUNK_WIDTH;
+      draw_columns(this, &frames[i / columns_chunks], cameras[i / columns_chunks], x, M_MIN(this->buffer_size.x, x + COLUMN_CHUNK_WIDTH));
+    }
+
+#ifdef RAYCASTER_PARALLEL_RENDERING
+    #pragma omp for schedule(dynamic)
+#endif
+    for (i = 0; i < (int32_t)count * sprite_chunks; ++i) {
+      if (views[i / sprite_chunks].sprites.count) {
+        draw_sprite_chunk(this, &frames[i / sprite_chunks], i % sprite_chunks);
+      }
+    }
+  }
+}
+
+/* Clears the view's frame and finds the lines, lights and sprites it sees */
+static void
+begin_view(
+  const renderer *this,
+  renderer_view *view,
+  const camera *camera,
+  size_t frame,
+  frame_info *info
+) {
+  const size_t frame_size = this->buffer_size.x * this->buffer_size.y;
+  const int32_t half_h = this->buffer_size.y >> 1;
+
+  info->buffer = this->buffer + frame * frame_size;
+  info->depth = this->depth + frame * frame_size;
+  info->column_depth = this->column_depth + frame * this->buffer_size.x;
+
+  memset(info->buffer, 0, frame_size * sizeof(pixel_type));
+  memset(info->depth, 0xFF, frame_size * sizeof(depth_type));
+
+  info->level = camera->entity.level;
+  info->view = view;
+  info->view_position = camera->entity.position;
+  info->far_left = vec2f_add(camera->entity.position, vec2f_mul(vec2f_sub(camera->entity.direction, camera->plane), RENDERER_DRAW_DISTANCE));
+  info->far_right = vec2f_add(camera->entity.position, vec2f_mul(vec2f_add(camera->entity.direction, camera->plane), RENDERER_DRAW_DISTANCE));
+  info->half_w = this->buffer_size.x >> 1;
+  info->pitch_offset = (int32_t)floorf(camera->pitch * half_h);
+  info->half_h = half_h + info->pitch_offset;
+  info->unit_size = (this->buffer_size.x >> 1) / camera->fov;
+  info->view_z = camera->entity.z;
+  info->sky_texture = info->level->sky_texture;
+
+#ifdef RAYCASTER_PRERENDER_VISCHECK
+  refresh_visible_linedefs(view, info, camera->entity.sector);
+#endif
+
+  init_light_tiles(view, this->buffer_size);
+  collect_visible_lights(this, info, camera);
+  collect_visible_sprites(this, info, camera);
+}
+
+/* Casts and draws columns [x_start, x_end) of a view */
+static void
+draw_columns(
+  const renderer *this,
+  const frame_info *info,
+  const camera *camera,
+  int32_t x_start,
+  int32_t x_end
+) {
+  int32_t x;
+
+  for (x = x_start; x < x_end; ++x) {
     const float cam_x = ((x << 1) / (float)this->buffer_size.x) - 1;
     const vec2f ray = VEC2F(
       camera->entity.direction.x + (camera->plane.x * cam_x),
@@ -203,70 +432,181 @@ renderer_draw(
       .theta_inverse = 1.f / math_dot2(camera->entity.direction, ray),
       .top_limit = 0.f,
       .bottom_limit = this->buffer_size.y,
-      .buffer_start = &this->buffer[x],
-      .finished = false
+      .buffer_start = &info->buffer[x],
+      .depth_start = &info->depth[x],
+      .finished = false,
+      .has_gaps = false
     };
 
-    find_sector_intersections(this, &info, &column, root_sector);
-    draw_column(this, &info, &column, column.intersections.head);
-  }
+    find_sector_intersections(this, info, &column, camera->entity.sector);
+    draw_column(this, info, &column, column.intersections.head);
 
-#if defined(RAYCASTER_DEBUG) && !defined(RAYCASTER_PARALLEL_RENDERING)
-  renderer_step = NULL;
-#endif
+    info->column_depth[x] = (column.finished && !column.has_gaps)
+      ? renderer_depth_from_distance(column.far_distance)
+      : RENDERER_DEPTH_MAX;
+  }
 }
 
 /* ----- */
 
 #ifdef RAYCASTER_PRERENDER_VISCHECK
 
+/*
+ * Lists the linedef sides rays get tested against this frame: those in map
+ * cache cells the view triangle overlaps, narrowed down to the ones
+ * potentially visible from the camera's sector and facing the camera.
+ * Blocks without linedefs or outside the view are skipped whole. The list
+ * is grouped by the sector each side faces into, so a column only walks
+ * the lines of the sectors it passes through.
+ */
 static void
-refresh_sector_visibility(
-  renderer *this,
+refresh_visible_linedefs(
+  renderer_view *this,
   const frame_info *info,
-  sector *sect
+  const sector *root
 ) {
-  register size_t i;
-  float sign;
+  register int32_t x, y;
+  register uint32_t li;
+  int32_t bx, by, x0, y0, x1, y1;
+  const level_data *level = info->level;
+  const map_cache *cache = &level->cache;
+  const size_t words = LEVEL_DATA_VISIBILITY_STRIDE(level->linedefs_count);
+  size_t potentially_visible_count = 0;
+  const uint32_t *potentially_visible = level_data_visible_linedefs(level, root, &potentially_visible_count);
+  const vec2f view_min = VEC2F(
+    fminf(fminf(info->view_position.x, info->far_left.x), info->far_right.x),
+    fminf(fminf(info->view_position.y, info->far_left.y), info->far_right.y)
+  );
+  const vec2f view_max = VEC2F(
+    fmaxf(fmaxf(info->view_position.x, info->far_left.x), info->far_right.x),
+    fmaxf(fmaxf(info->view_position.y, info->far_left.y), info->far_right.y)
+  );
+  vec2f min, max;
+  size_t i, index, candidates_count = 0;
+  uint32_t bits, sides, total = 0;
   uint8_t side;
-  linedef *line;
-  sector *back_sector;
+  const linedef *line;
+  visible_range *range;
+  float sign;
 
-  sect->last_visibility_check_tick = this->tick;
+  if (level->linedefs_count > this->visible.linedefs_capacity) {
+    this->visible.linedefs_capacity = level->linedefs_count;
+    this->visible.in_view = realloc(this->visible.in_view, words * sizeof(uint32_t));
+    this->visible.candidates = realloc(this->visible.candidates, level->linedefs_count * sizeof(uint32_t));
+    this->visible.lines = realloc(this->visible.lines, level->linedefs_count * 2 * sizeof(linedef*));
+  }
 
-  if (!sect->visible_linedefs) {
-    sect->visible_linedefs = malloc(sect->linedefs_count * sizeof(linedef*));
+  /* Ranges from earlier frames stay, their frame tells them apart */
+  if (level->sectors_count > this->visible.sectors_capacity) {
+    this->visible.ranges = realloc(this->visible.ranges, level->sectors_count * sizeof(visible_range));
+    memset(this->visible.ranges + this->visible.sectors_capacity, 0, (level->sectors_count - this->visible.sectors_capacity) * sizeof(visible_range));
+    this->visible.sectors_capacity = level->sectors_count;
   }
-  sect->visible_linedefs_count = 0;
 
-  for (i = 0; i < sect->linedefs_count; ++i) {
-    line = sect->linedefs[i];
-    side = line->side[0].sector == sect ? 0 : 1;
-    sign = math_sign(line->v0->point, line->v1->point, info->view_position);
+  this->visible.frame++;
 
-    if ((side == 0 && sign > 0) || (side == 1 && sign < 0)) {
-      continue;
+  if (!cache->cells) {
+    memset(this->visible.in_view, 0xFF, words * sizeof(uint32_t));
+  } else {
+    memset(this->visible.in_view, 0, words * sizeof(uint32_t));
+
+    x0 = (int32_t)math_clamp(floorf((view_min.x - cache->origin.x) / cache->cell_size), 0, cache->w - 1);
+    y0 = (int32_t)math_clamp(floorf((view_min.y - cache->origin.y) / cache->cell_size), 0, cache->h - 1);
+    x1 = (int32_t)math_clamp(floorf((view_max.x - cache->origin.x) / cache->cell_size), 0, cache->w - 1);
+    y1 = (int32_t)math_clamp(floorf((view_max.y - cache->origin.y) / cache->cell_size), 0, cache->h - 1);
+
+    for (by = y0 >> MAP_CACHE_BLOCK_SHIFT; by <= y1 >> MAP_CACHE_BLOCK_SHIFT; ++by) {
+      for (bx = x0 >> MAP_CACHE_BLOCK_SHIFT; bx <= x1 >> MAP_CACHE_BLOCK_SHIFT; ++bx) {
+        min = vec2f_add(cache->origin, vec2f_mul(VEC2F(bx, by), cache->cell_size * (1 << MAP_CACHE_BLOCK_SHIFT)));
+        max = vec2f_add(min, VEC2F(cache->cell_size * (1 << MAP_CACHE_BLOCK_SHIFT), cache->cell_size * (1 << MAP_CACHE_BLOCK_SHIFT)));
+
+        if (!cache->blocks[by * cache->blocks_w + bx].count ||
+            !math_triangle_overlaps_box(info->view_position, info->far_left, info->far_right, min, max)) {
+          continue;
+        }
+
+        for (y = M_MAX(by << MAP_CACHE_BLOCK_SHIFT, y0); y <= M_MIN(((by + 1) << MAP_CACHE_BLOCK_SHIFT) - 1, y1); ++y) {
+          for (x = M_MAX(bx << MAP_CACHE_BLOCK_SHIFT, x0); x <= M_MIN(((bx + 1) << MAP_CACHE_BLOCK_SHIFT) - 1, x1); ++x) {
+            min = vec2f_add(cache->origin, vec2f_mul(VEC2F(x, y), cache->cell_size));
+            max = vec2f_add(min, VEC2F(cache->cell_size, cache->cell_size));
+
+            if (!math_triangle_overlaps_box(info->view_position, info->far_left, info->far_right, min, max)) {
+              continue;
+            }
+
+            for (li = cache->cell_offsets[y * cache->w + x]; li < cache->cell_offsets[y * cache->w + x + 1]; ++li) {
+              this->visible.in_view[cache->cell_linedefs[li] >> 5] |= 1u << (cache->cell_linedefs[li] & 31);
+            }
+          }
+        }
+      }
     }
+  }
 
-    if (line->v0->last_visibility_check_tick != this->tick) {
-      line->v0->last_visibility_check_tick = this->tick;
-      line->v0->visible = math_point_in_triangle(line->v0->point, info->view_position, info->far_left, info->far_right);
+  /* In view and potentially visible from the camera's sector, in level order */
+  if (potentially_visible) {
+    for (i = 0; i < potentially_visible_count; ++i) {
+      index = potentially_visible[i];
+
+      if ((this->visible.in_view[index >> 5] >> (index & 31)) & 1) {
+        this->visible.candidates[candidates_count++] = index;
+      }
+    }
+  } else {
+    for (i = 0; i < words; ++i) {
+      for (bits = this->visible.in_view[i], index = i << 5; bits && index < level->linedefs_count; bits >>= 1, ++index) {
+        if (bits & 1) {
+          this->visible.candidates[candidates_count++] = index;
+        }
+      }
     }
+  }
+
+  /*
+   * A side the camera is behind can only be hit from the wrong way round.
+   * The sides left are counted per sector, then each sector gets its range
+   * of the list when its first side is placed.
+   */
+  for (i = 0; i < candidates_count; ++i) {
+    line = &level->linedefs[this->visible.candidates[i]];
+    sign = math_sign(line->v0->point, line->v1->point, info->view_position);
+    sides = (sign <= 0 ? 1 : 0) | (sign >= 0 && line->side[1].sector && line->side[1].sector != line->side[0].sector ? 2 : 0);
+    this->visible.candidates[i] = (this->visible.candidates[i] << 2) | sides;
+
+    for (side = 0; side < 2; ++side) {
+      if (!(sides & (1 << side))) {
+        continue;
+      }
 
-    if (line->v1->last_visibility_check_tick != this->tick) {
-      line->v1->last_visibility_check_tick = this->tick;
-      line->v1->visible = math_point_in_triangle(line->v1->point, info->view_position, info->far_left, info->far_right);
+      range = &this->visible.ranges[line->side[side].sector - level->sectors];
+
+      if (range->frame != this->visible.frame) {
+        range->frame = this->visible.frame;
+        range->offset = UINT32_MAX;
+        range->count = 0;
+      }
+
+      range->count++;
     }
+  }
+
+  for (i = 0; i < candidates_count; ++i) {
+    line = &level->linedefs[this->visible.candidates[i] >> 2];
 
-    if (line->v0->visible || line->v1->visible
-      || math_find_line_intersection(line->v0->point, line->v1->point, info->view_position, info->far_left, NULL, NULL)
-      || math_find_line_intersection(line->v0->point, line->v1->point, info->view_position, info->far_right, NULL, NULL)) {
-      sect->visible_linedefs[sect->visible_linedefs_count++] = line;
-      back_sector = line->side[0].sector == sect ? line->side[1].sector : line->side[0].sector;
+    for (side = 0; side < 2; ++side) {
+      if (!(this->visible.candidates[i] & (1 << side))) {
+        continue;
+      }
+
+      range = &this->visible.ranges[line->side[side].sector - level->sectors];
 
-      if (back_sector && back_sector->last_visibility_check_tick != this->tick) {
-        refresh_sector_visibility(this, info, back_sector);
+      if (range->offset == UINT32_MAX) {
+        range->offset = total;
+        total += range->count;
+        range->count = 0;
       }
+
+      this->visible.lines[range->offset + range->count++] = (linedef*)line;
     }
   }
 }
@@ -318,13 +658,17 @@ find_sector_intersections(
   sector *back_sector;
 
 #ifdef RAYCASTER_PRERENDER_VISCHECK
-  for (i = 0; i < sect->visible_linedefs_count && column->intersections.count < MAX_LINE_HITS_PER_COLUMN; ++i) {
-    line = sect->visible_linedefs[i];
+  const visible_range *range = &info->view->visible.ranges[sect - info->level->sectors];
+  const size_t lines_count = range->frame == info->view->visible.frame ? range->count : 0;
+  linedef **lines = lines_count ? info->view->visible.lines + range->offset : NULL;
 #else
-  for (i = 0; i < sect->linedefs_count && column->intersections.count < MAX_LINE_HITS_PER_COLUMN; ++i) {
-    line = sect->linedefs[i];
+  const size_t lines_count = sect->linedefs_count;
+  linedef **lines = sect->linedefs;
 #endif
 
+  for (i = 0; i < lines_count && column->intersections.count < MAX_LINE_HITS_PER_COLUMN; ++i) {
+    line = lines[i];
+
     if (math_find_line_intersection_cached(line->v0->point, column->ray_start, line->direction, column->ray_direction, &point, &line_det, &ray_det)) {
       planar_distance = ray_det * RENDERER_DRAW_DISTANCE;
       point_distance = planar_distance * column->theta_inverse;
@@ -423,6 +767,7 @@ draw_column(
     );
 
     column->finished = true;
+    column->far_distance = intersection->planar_distance;
   } else {
     /* Draw top and bottom segments of the wall and the sector behind */
     const float top_segment = (sect->ceiling.height - back_sector->ceiling.height) * depth_scale_factor;
@@ -508,6 +853,8 @@ draw_column(
 
     if ((int)column->top_limit == (int)column->bottom_limit || back_sector->floor.height == back_sector->ceiling.height) {
       column->finished = true;
+      column->far_distance = intersection->planar_distance;
+      column->has_gaps |= (int)column->top_limit < (int)column->bottom_limit;
       return;
     }
 
@@ -561,6 +908,11 @@ calculate_horizontal_surface_light(const sector *sect, vec3f pos, bool is_floor,
   for (i = 0; i < num_lights; ++i) {
     lt = lights[i];
 
+    /* Lights come strongest first, so the rest can't make this any brighter */
+    if (lt->strength <= v) {
+      break;
+    }
+
     /* Too far off the floor or ceiling */
     if ((dz = is_floor ? (lt->entity.z - sect->floor.height) : (sect->ceiling.height - lt->entity.z)) && (dz < 0.f)) {
       continue;
@@ -573,6 +925,11 @@ calculate_horizontal_surface_light(const sector *sect, vec3f pos, bool is_floor,
     }
 
 #ifdef RAYCASTER_DYNAMIC_SHADOWS
+    /* No ray needed when the sectors can't see each other */
+    if (lt->entity.sector && !level_data_sectors_visible(lt->entity.level, sect, lt->entity.sector)) {
+      continue;
+    }
+
     v = !map_cache_intersect_3d(&lt->entity.level->cache, pos, world_pos)
       ? math_max(v, lt->strength * math_min(1.f, dz / VERTICAL_FADE_DIST) * (1.f - (dsq * lt->radius_sq_inverse)))
       : v;
@@ -607,6 +964,11 @@ calculate_vertical_surface_light(const sector *sect, vec3f pos, size_t num_light
 
   for (i = 0; i < num_lights; ++i) {
     lt = lights[i];
+
+    if (lt->strength <= v) {
+      break;
+    }
+
     world_pos = entity_world_position(&lt->entity);
 
     if ((dsq = math_vec3_distance_squared(pos, world_pos)) > lt->radius_sq) {
@@ -614,6 +976,10 @@ calculate_vertical_surface_light(const sector *sect, vec3f pos, size_t num_light
     }
 
 #ifdef RAYCASTER_DYNAMIC_SHADOWS
+    if (lt->entity.sector && !level_data_sectors_visible(lt->entity.level, sect, lt->entity.sector)) {
+      continue;
+    }
+
     v = !map_cache_intersect_3d(&lt->entity.level->cache, pos, world_pos)
       ? math_max(v, lt->strength * (1.f - (dsq * lt->radius_sq_inverse)))
       : v;
@@ -662,7 +1028,12 @@ draw_wall_segment(
   float view_z_scaled,
   texture_ref texture
 ) {
-  if (from >= to || texture == TEXTURE_NONE) {
+  if (from >= to) {
+    return;
+  }
+
+  if (texture == TEXTURE_NONE) {
+    column->has_gaps |= !column->finished;
     return;
   }
 
@@ -671,10 +1042,13 @@ draw_wall_segment(
   const float texture_x     = intersection->determinant * intersection->line->length;
   const uint16_t segment    = (uint16_t)floorf((intersection->line->segments - 1) * intersection->determinant);
   uint32_t *p               = column->buffer_start + (from*column->buffer_stride);
+  depth_type *d             = column->depth_start + (from*column->buffer_stride);
+  const depth_type depth    = renderer_depth_from_distance(intersection->planar_distance);
   uint8_t rgb[3];
   uint8_t mask;
-  uint8_t lights_count      = intersection->line->side[intersection->side].segments[segment].lights_count;
-  struct light **lights     = intersection->line->side[intersection->side].segments[segment].lights;
+  const light_list *list    = &intersection->line->side[intersection->side].segments[segment].lights;
+  uint16_t lights_count     = list->count;
+  struct light **lights     = light_list_lights(list, &info->level->cache.light_pool);
   register float light      = !lights_count ? calculate_basic_brightness(
       sect->brightness,
 #if RAYCASTER_LIGHT_STEPS > 0
@@ -688,10 +1062,12 @@ draw_wall_segment(
   int32_t temp[4];
 #endif
 
-  for (y = from; y < to; ++y, p += column->buffer_stride, texture_y += texture_step) {
+  for (y = from; y < to; ++y, p += column->buffer_stride, d += column->buffer_stride, texture_y += texture_step) {
     texture_sampler(texture, texture_x, texture_y, &texture_coordinates_scaled, 1 + intersection->distance_steps, &rgb[0], &mask);
  
-    if (!mask) { continue; } /* Transparent */
+    if (!mask) { column->has_gaps |= !column->finished; continue; } /* Transparent */
+
+    *d = depth;
 
     light = lights_count ?
       calculate_vertical_surface_light(
@@ -717,6 +1093,28 @@ draw_wall_segment(
   }
 }
 
+/*
+ * Lights for a floor or ceiling pixel: none when its screen tile has none,
+ * otherwise the shorter of the tile's list and the map cache cell's.
+ */
+M_INLINED uint32_t
+horizontal_surface_lights(const renderer *this, const frame_info *info, const light_tile *tile, vec2f position, struct light ***lights)
+{
+  const map_cache_cell *cell;
+
+  if (!tile->count) {
+    return 0;
+  }
+
+  if ((cell = map_cache_cell_at(&info->level->cache, position)) && cell->lights.count < tile->count) {
+    *lights = light_list_lights(&cell->lights, &info->level->cache.light_pool);
+    return cell->lights.count;
+  }
+
+  *lights = info->view->lights.list + tile->offset;
+  return tile->count;
+}
+
 static void
 draw_floor_segment(
   const renderer *this,
@@ -728,37 +1126,46 @@ draw_floor_segment(
   uint32_t from,
   uint32_t to
 ) {
+  if (from >= to) {
+    return;
+  }
+
   /* Camera below the floor */
-  if (from >= to || info->view_z < sect->floor.height || sect->floor.texture == TEXTURE_NONE) {
+  if (info->view_z < sect->floor.height || sect->floor.texture == TEXTURE_NONE) {
+    column->has_gaps = true;
     return;
   }
 
   register uint32_t y, yz;
-  register float light=-1, distance, weight, wx, wy;
+  register float light=-1, distance, planar_distance, weight, wx, wy;
   uint32_t *p = column->buffer_start + (from*column->buffer_stride);
-  uint8_t rgb[3], lights_count;
-  map_cache_cell *cell;
+  depth_type *d = column->depth_start + (from*column->buffer_stride);
+  uint8_t rgb[3];
+  const light_tile *tiles = &info->view->lights.tiles[column->index / LIGHT_TILE_SIZE];
+  struct light **lights;
+  uint32_t lights_count;
 
 #ifdef RAYCASTER_SIMD_PIXEL_LIGHTING
   int32_t temp[4];
 #endif
 
-  for (y = from, yz = from - info->half_h; y < to; ++y, p += column->buffer_stride) {
-    distance = (distance_from_view * this->depth_values[yz++]) * column->theta_inverse;
+  for (y = from, yz = from - info->half_h; y < to; ++y, p += column->buffer_stride, d += column->buffer_stride) {
+    planar_distance = distance_from_view * this->depth_values[yz++];
+    distance = planar_distance * column->theta_inverse;
     weight = math_min(1.f, distance * intersection->point_distance_inverse);
     wx = (weight * intersection->point.x) + ((1-weight) * column->ray_start.x);
     wy = (weight * intersection->point.y) + ((1-weight) * column->ray_start.y);
-    cell = map_cache_cell_at(&info->level->cache, VEC2F(wx, wy));
-    lights_count = cell ? cell->lights_count : 0;
 
     texture_sampler(sect->floor.texture, wx, wy, &texture_coordinates_scaled, 1 + (uint8_t)(distance * LIGHT_STEP_DISTANCE_INVERSE), &rgb[0], NULL);
 
+    lights_count = horizontal_surface_lights(this, info, &tiles[(y / LIGHT_TILE_SIZE) * info->view->lights.tiles_w], VEC2F(wx, wy), &lights);
+
     light = lights_count ? calculate_horizontal_surface_light(
       sect,
       VEC3F(wx, wy, sect->floor.height),
       true,
       lights_count,
-      cell ? cell->lights : NULL,
+      lights,
 #if RAYCASTER_LIGHT_STEPS > 0
       distance * LIGHT_STEP_DISTANCE_INVERSE
 #else
@@ -780,6 +1187,8 @@ draw_floor_segment(
     *p = 0xFF000000|((uint8_t)math_min((rgb[0]*light),255)<<16)|((uint8_t)math_min((rgb[1]*light),255)<<8)|(uint8_t)math_min((rgb[2]*light),255);
 #endif
 
+    *d = renderer_depth_from_distance(planar_distance);
+
     INSERT_RENDER_BREAKPOINT
   } 
 }
@@ -795,37 +1204,46 @@ draw_ceiling_segment(
   uint32_t from,
   uint32_t to
 ) {
+  if (from >= to) {
+    return;
+  }
+
   /* Camera above the ceiling */
-  if (from >= to || info->view_z > sect->ceiling.height) {
+  if (info->view_z > sect->ceiling.height) {
+    column->has_gaps = true;
     return;
   }
 
   register uint32_t y, yz;
-  register float light=-1, distance, weight, wx, wy;
+  register float light=-1, distance, planar_distance, weight, wx, wy;
   uint32_t *p = column->buffer_start + (from*column->buffer_stride);
-  uint8_t rgb[3], lights_count;
-  map_cache_cell *cell;
+  depth_type *d = column->depth_start + (from*column->buffer_stride);
+  uint8_t rgb[3];
+  const light_tile *tiles = &info->view->lights.tiles[column->index / LIGHT_TILE_SIZE];
+  struct light **lights;
+  uint32_t lights_count;
 
 #ifdef RAYCASTER_SIMD_PIXEL_LIGHTING
   int32_t temp[4];
 #endif
 
-  for (y = from, yz = info->half_h - from - 1; y < to; ++y, p += column->buffer_stride) {
-    distance = (distance_from_view * this->depth_values[yz--]) * column->theta_inverse;
+  for (y = from, yz = info->half_h - from - 1; y < to; ++y, p += column->buffer_stride, d += column->buffer_stride) {
+    planar_distance = distance_from_view * this->depth_values[yz--];
+    distance = planar_distance * column->theta_inverse;
     weight = math_min(1.f, distance * intersection->point_distance_inverse);
     wx = (weight * intersection->point.x) + ((1-weight) * column->ray_start.x);
     wy = (weight * intersection->point.y) + ((1-weight) * column->ray_start.y);
-    cell = map_cache_cell_at(&info->level->cache, VEC2F(wx, wy));
-    lights_count = cell ? cell->lights_count : 0;
 
     texture_sampler(sect->ceiling.texture, wx, wy, &texture_coordinates_scaled, 1 + (uint8_t)(distance * LIGHT_STEP_DISTANCE_INVERSE), &rgb[0], NULL);
 
+    lights_count = horizontal_surface_lights(this, info, &tiles[(y / LIGHT_TILE_SIZE) * info->view->lights.tiles_w], VEC2F(wx, wy), &lights);
+
     light = lights_count ? calculate_horizontal_surface_light(
       sect,
       VEC3F(wx, wy, sect->ceiling.height),
       false,
       lights_count,
-      cell ? cell->lights : NULL,
+      lights,
 #if RAYCASTER_LIGHT_STEPS > 0
       distance * LIGHT_STEP_DISTANCE_INVERSE
 #else
@@ -847,14 +1265,23 @@ draw_ceiling_segment(
     *p = 0xFF000000|((uint8_t)math_min((rgb[0]*light),255)<<16)|((uint8_t)math_min((rgb[1]*light),255)<<8)|(uint8_t)math_min((rgb[2]*light),255);
 #endif
 
+    *d = renderer_depth_from_distance(planar_distance);
+
     INSERT_RENDER_BREAKPOINT
   }
 }
 
 static void
-draw_sky_segment(const renderer *this, const frame_info *info, const column_info *column, uint32_t from, uint32_t to)
+draw_sky_segment(const renderer *this, const frame_info *info, column_info *column, uint32_t from, uint32_t to)
 {
-  if (from == to || info->sky_texture == TEXTURE_NONE) {
+  if (from >= to) {
+    return;
+  }
+
+  /* Sky is infinitely far, so anything can show in front of it */
+  column->has_gaps = true;
+
+  if (info->sky_texture == TEXTURE_NONE) {
     return;
   }
 
@@ -873,3 +1300,364 @@ draw_sky_segment(const renderer *this, const frame_info *info, const column_info
     INSERT_RENDER_BREAKPOINT
   }
 }
+
+/*
+ * Before the columns are drawn, every light is projected to the rows and
+ * columns its sphere can cover, and listed in the screen tiles it overlaps.
+ * Floors and ceilings shade a pixel with its tile's short list, and take the
+ * plain sector brightness without any lookup where the list is empty.
+ */
+
+static void
+project_light(const renderer *this, const frame_info *info, const camera *cam, float inverse_det, light *lt)
+{
+  register size_t i;
+  const vec2f delta = vec2f_sub(lt->entity.position, info->view_position);
+  const float depth = (delta.x * cam->plane.y - delta.y * cam->plane.x) * inverse_det;
+  const float lateral = (cam->entity.direction.x * delta.y - cam->entity.direction.y * delta.x) * inverse_det;
+  /* How far the radius can move the depth and the lateral offset */
+  const float depth_reach = lt->radius * math_length(cam->plane) * fabsf(inverse_det);
+  const float lateral_reach = lt->radius * math_length(cam->entity.direction) * fabsf(inverse_det);
+  const float near = depth - depth_reach;
+  const float far = depth + depth_reach;
+  int32_t x_start = 0, x_end = this->buffer_size.x, y_start = 0, y_end = this->buffer_size.y;
+
+  if (far < 1.f || near >= RENDERER_DRAW_DISTANCE) {
+    return;
+  }
+
+  /* Lights around the camera can reach any pixel */
+  if (near >= 1.f) {
+    const float near_inverse = 1.f / near;
+    const float far_inverse = 1.f / far;
+    const float left = lateral - lateral_reach;
+    const float right = lateral + lateral_reach;
+    const float above = info->view_z - (lt->entity.z + lt->radius);
+    const float below = info->view_z - (lt->entity.z - lt->radius);
+
+    /* Both ratios are monotonic, so their extremes are at the corners */
+    x_start = M_MAX(x_start, (int32_t)floorf(info->half_w * (1.f + math_min(left * near_inverse, left * far_inverse))) - 1);
+    x_end = M_MIN(x_end, (int32_t)ceilf(info->half_w * (1.f + math_max(right * near_inverse, right * far_inverse))) + 2);
+    y_start = M_MAX(y_start, (int32_t)floorf(info->half_h + info->unit_size * math_min(above * near_inverse, above * far_inverse)) - 2);
+    y_end = M_MIN(y_end, (int32_t)ceilf(info->half_h + info->unit_size * math_max(below * near_inverse, below * far_inverse)) + 2);
+  }
+
+  if (x_start >= x_end || y_start >= y_end) {
+    return;
+  }
+
+  if (info->view->lights.visible_count == info->view->lights.visible_capacity) {
+    info->view->lights.visible_capacity = info->view->lights.visible_capacity ? info->view->lights.visible_capacity * 2 : 64;
+    info->view->lights.visible = realloc(info->view->lights.visible, info->view->lights.visible_capacity * sizeof(visible_light));
+  }
+
+  /* Keep the strongest first, so every tile list comes out sorted */
+  for (i = info->view->lights.visible_count++; i > 0 && info->view->lights.visible[i-1].light->strength < lt->strength; --i) {
+    info->view->lights.visible[i] = info->view->lights.visible[i-1];
+  }
+
+  info->view->lights.visible[i] = (visible_light) {
+    .light = lt,
+    .x_start = x_start,
+    .x_end = x_end,
+    .y_start = y_start,
+    .y_end = y_end
+  };
+}
+
+static void
+collect_visible_lights(const renderer *this, const frame_info *info, const camera *cam)
+{
+  register size_t i;
+  register int32_t tx, ty;
+  uint32_t offset;
+  light_tile *tile;
+  const visible_light *vl;
+  const level_data *level = info->level;
+  const int32_t tiles_count = info->view->lights.tiles_w * info->view->lights.tiles_h;
+  const float inverse_det = 1.f / (cam->entity.direction.x * cam->plane.y - cam->entity.direction.y * cam->plane.x);
+
+  info->view->lights.visible_count = 0;
+  memset(info->view->lights.tiles, 0, tiles_count * sizeof(light_tile));
+
+  for (i = 0; i < level->lights_count; ++i) {
+    project_light(this, info, cam, inverse_det, level_data_light_at(level, i));
+  }
+
+  if (!info->view->lights.visible_count) {
+    return;
+  }
+
+  /* Count, then fill each tile's range of the shared list */
+  for (i = 0; i < info->view->lights.visible_count; ++i) {
+    vl = &info->view->lights.visible[i];
+
+    for (ty = vl->y_start / LIGHT_TILE_SIZE; ty <= (vl->y_end - 1) / LIGHT_TILE_SIZE; ++ty) {
+      for (tx = vl->x_start / LIGHT_TILE_SIZE; tx <= (vl->x_end - 1) / LIGHT_TILE_SIZE; ++tx) {
+        info->view->lights.tiles[ty * info->view->lights.tiles_w + tx].count++;
+      }
+    }
+  }
+
+  for (tx = 0, offset = 0; tx < tiles_count; ++tx) {
+    info->view->lights.tiles[tx].offset = offset;
+    offset += info->view->lights.tiles[tx].count;
+    info->view->lights.tiles[tx].count = 0;
+  }
+
+  if (offset > info->view->lights.list_capacity) {
+    info->view->lights.list_capacity = offset;
+    info->view->lights.list = realloc(info->view->lights.list, offset * sizeof(light*));
+  }
+
+  for (i = 0; i < info->view->lights.visible_count; ++i) {
+    vl = &info->view->lights.visible[i];
+
+    for (ty = vl->y_start / LIGHT_TILE_SIZE; ty <= (vl->y_end - 1) / LIGHT_TILE_SIZE; ++ty) {
+      for (tx = vl->x_start / LIGHT_TILE_SIZE; tx <= (vl->x_end - 1) / LIGHT_TILE_SIZE; ++tx) {
+        tile = &info->view->lights.tiles[ty * info->view->lights.tiles_w + tx];
+        info->view->lights.list[tile->offset + tile->count++] = vl->light;
+      }
+    }
+  }
+}
+
+/*
+ * Sprites are drawn after all columns are done, so they can be depth
+ * tested against what the main pass wrote. Candidates come from the map
+ * cache cells touching the view triangle, get projected and sorted back
+ * to front, and are then drawn in parallel chunks of columns.
+ */
+
+M_INLINED bool
+box_outside_edge(vec2f a, vec2f b, float inside, vec2f min, vec2f max)
+{
+  return math_sign(a, b, min) * inside < 0.f
+      && math_sign(a, b, max) * inside < 0.f
+      && math_sign(a, b, VEC2F(min.x, max.y)) * inside < 0.f
+      && math_sign(a, b, VEC2F(max.x, min.y)) * inside < 0.f;
+}
+
+static void
+project_sprite(const renderer *this, const frame_info *info, const camera *cam, float inverse_det, const sprite *spr)
+{
+  const vec2f delta = vec2f_sub(spr->entity.position, info->view_position);
+  const float depth = (delta.x * cam->plane.y - delta.y * cam->plane.x) * inverse_det;
+
+  if (depth < 1.f || depth >= RENDERER_DRAW_DISTANCE) {
+    return;
+  }
+
+  const float depth_inverse = 1.f / depth;
+  const float lateral = (cam->entity.direction.x * delta.y - cam->entity.direction.y * delta.x) * inverse_det;
+  const float scale = info->unit_size * depth_inverse;
+  const float screen_x = this->buffer_size.x * 0.5f * (1.f + lateral * depth_inverse);
+  const float screen_left = screen_x - spr->width * 0.5f * scale;
+  const float screen_top = info->half_h - (spr->entity.z + spr->height - info->view_z) * scale;
+  const float screen_bottom = info->half_h - (spr->entity.z - info->view_z) * scale;
+  const int32_t x_start = M_MAX(0, (int32_t)ceilf(screen_left));
+  const int32_t x_end = M_MIN(this->buffer_size.x, (int32_t)ceilf(screen_left + spr->width * scale));
+  const int32_t y_start = M_MAX(0, (int32_t)ceilf(screen_top));
+  const int32_t y_end = M_MIN(this->buffer_size.y, (int32_t)ceilf(screen_bottom));
+
+  if (x_start >= x_end || y_start >= y_end) {
+    return;
+  }
+
+  if (info->view->sprites.count == info->view->sprites.capacity) {
+    info->view->sprites.capacity = info->view->sprites.capacity ? info->view->sprites.capacity * 2 : 64;
+    info->view->sprites.list = realloc(info->view->sprites.list, info->view->sprites.capacity * sizeof(visible_sprite));
+    info->view->sprites.sort_buffer = realloc(info->view->sprites.sort_buffer, info->view->sprites.capacity * sizeof(visible_sprite));
+  }
+
+  const float point_distance = math_length(delta);
+  const map_cache_cell *cell = spr->entity.cell;
+  float brightness;
+
+#if RAYCASTER_LIGHT_STEPS > 0
+  const uint8_t falloff = (uint8_t)(point_distance * LIGHT_STEP_DISTANCE_INVERSE);
+#else
+  const float falloff = point_distance * DIMMING_DISTANCE_INVERSE;
+#endif
+
+  if (!spr->entity.sector) {
+    brightness = calculate_basic_brightness(1.f, falloff);
+  } else if (cell && cell->lights.count) {
+    brightness = calculate_vertical_surface_light(
+      spr->entity.sector,
+      VEC3F(spr->entity.position.x, spr->entity.position.y, spr->entity.z + spr->height * 0.5f),
+      cell->lights.count,
+      light_list_lights(&cell->lights, &spr->entity.level->cache.light_pool),
+      falloff
+    );
+  } else {
+    brightness = calculate_basic_brightness(spr->entity.sector->brightness, falloff);
+  }
+
+  info->view->sprites.list[info->view->sprites.count++] = (visible_sprite) {
+    .sprite = spr,
+    .screen_left = screen_left,
+    .screen_top = screen_top,
+    .screen_width_inverse = 1.f / (spr->width * scale),
+    .screen_height_inverse = 1.f / (screen_bottom - screen_top),
+    .light = brightness,
+    .x_start = x_start,
+    .x_end = x_end,
+    .y_start = y_start,
+    .y_end = y_end,
+    .depth = renderer_depth_from_distance(depth),
+    .mip_level = 1 + (uint8_t)(point_distance * LIGHT_STEP_DISTANCE_INVERSE)
+  };
+}
+
+/* Back to front, two 8-bit LSD radix passes over the 16-bit depth */
+static void
+sort_visible_sprites(renderer_view *this)
+{
+  size_t i, shift, counts[256];
+  visible_sprite *src = this->sprites.list, *dst = this->sprites.sort_buffer, *swap;
+
+  for (shift = 0; shift < 16; shift += 8) {
+    memset(counts, 0, sizeof(counts));
+
+    for (i = 0; i < this->sprites.count; ++i) {
+      counts[((RENDERER_DEPTH_MAX - src[i].depth) >> shift) & 0xFF]++;
+    }
+
+    for (i = 1; i < 256; ++i) {
+      counts[i] += counts[i-1];
+    }
+
+    for (i = this->sprites.count; i > 0; --i) {
+      dst[--counts[((RENDERER_DEPTH_MAX - src[i-1].depth) >> shift) & 0xFF]] = src[i-1];
+    }
+
+    swap = src; src = dst; dst = swap;
+  }
+
+  /* Even number of passes, so the sorted result is back in the list */
+}
+
+static void
+collect_visible_sprites(const renderer *this, const frame_info *info, const camera *cam)
+{
+  int32_t x, y;
+  const level_data *level = info->level;
+  const map_cache *cache = &level->cache;
+  const map_cache_cell *cell;
+  const entity *e;
+
+  info->view->sprites.count = 0;
+
+  if (!level->sprites_count || !cache->cells) {
+    return;
+  }
+
+  /* Sprites can reach out of their cell by half their width */
+  const float margin = level->sprites_max_width * 0.5f;
+  const float inside = math_sign(info->view_position, info->far_left, info->far_right);
+  const float inverse_det = 1.f / (cam->entity.direction.x * cam->plane.y - cam->entity.direction.y * cam->plane.x);
+  const vec2f tri_min = VEC2F(
+    math_min(info->view_position.x, math_min(info->far_left.x, info->far_right.x)) - margin - cache->origin.x,
+    math_min(info->view_position.y, math_min(info->far_left.y, info->far_right.y)) - margin - cache->origin.y
+  );
+  const vec2f tri_max = VEC2F(
+    math_max(info->view_position.x, math_max(info->far_left.x, info->far_right.x)) + margin - cache->origin.x,
+    math_max(info->view_position.y, math_max(info->far_left.y, info->far_right.y)) + margin - cache->origin.y
+  );
+  const int32_t x0 = M_MAX(0, (int32_t)floorf(tri_min.x / cache->cell_size));
+  const int32_t y0 = M_MAX(0, (int32_t)floorf(tri_min.y / cache->cell_size));
+  const int32_t x1 = M_MIN(cache->w - 1, (int32_t)floorf(tri_max.x / cache->cell_size));
+  const int32_t y1 = M_MIN(cache->h - 1, (int32_t)floorf(tri_max.y / cache->cell_size));
+
+  for (y = y0; y <= y1; ++y) {
+    for (x = x0; x <= x1; ++x) {
+      cell = &cache->cells[y * cache->w + x];
+
+      if (!cell->entities) {
+        continue;
+      }
+
+      const vec2f cell_min = VEC2F(cache->origin.x + x * cache->cell_size - margin, cache->origin.y + y * cache->cell_size - margin);
+      const vec2f cell_max = VEC2F(cell_min.x + cache->cell_size + 2 * margin, cell_min.y + cache->cell_size + 2 * margin);
+
+      if (box_outside_edge(info->view_position, info->far_left, inside, cell_min, cell_max) ||
+          box_outside_edge(info->far_left, info->far_right, inside, cell_min, cell_max) ||
+          box_outside_edge(info->far_right, info->view_position, inside, cell_min, cell_max)) {
+        continue;
+      }
+
+      for (e = cell->entities; e; e = e->cell_next) {
+        if (e->type == ENTITY_SPRITE) {
+          project_sprite(this, info, cam, inverse_det, (const sprite*)e->data);
+        }
+      }
+    }
+  }
+
+  sort_visible_sprites(info->view);
+}
+
+static void
+draw_sprite_column(const renderer *this, const frame_info *info, const visible_sprite *vs, int32_t x)
+{
+  register int32_t y;
+  const sprite *spr = vs->sprite;
+  const float texture_x = (x - vs->screen_left) * vs->screen_width_inverse;
+  register float texture_y = (vs->y_start - vs->screen_top) * vs->screen_height_inverse;
+  uint32_t *p = &info->buffer[vs->y_start * this->buffer_size.x + x];
+  depth_type *d = &info->depth[vs->y_start * this->buffer_size.x + x];
+  const float light = vs->light;
+  uint8_t rgb[3], mask;
+
+#ifdef RAYCASTER_SIMD_PIXEL_LIGHTING
+  int32_t temp[4];
+#endif
+
+  for (y = vs->y_start; y < vs->y_end; ++y, p += this->buffer_size.x, d += this->buffer_size.x, texture_y += vs->screen_height_inverse) {
+    if (*d < vs->depth) { continue; } /* Occluded */
+
+    texture_sampler(spr->texture, texture_x, texture_y, &texture_coordinates_normalized, vs->mip_level, &rgb[0], &mask);
+
+    if (!mask) { continue; } /* Transparent */
+
+#ifdef RAYCASTER_SIMD_PIXEL_LIGHTING
+    _mm_storeu_si128((__m128i*)temp, _mm_cvtps_epi32(_mm_min_ps(_mm_mul_ps(_mm_set_ps(0, rgb[2], rgb[1], rgb[0]), _mm_set1_ps(light)), _mm_set1_ps(255.0f))));
+    *p = 0xFF000000 | (temp[0] << 16) | (temp[1] << 8) | temp[2];
+#else
+    *p = 0xFF000000|((uint8_t)math_min((rgb[0]*light),255)<<16)|((uint8_t)math_min((rgb[1]*light),255)<<8)|(uint8_t)math_min((rgb[2]*light),255);
+#endif
+
+    *d = vs->depth;
+
+    INSERT_RENDER_BREAKPOINT
+  }
+}
+
+/* Draws the parts of the view's sprites that fall in a chunk of columns */
+static void
+draw_sprite_chunk(const renderer *this, const frame_info *info, int32_t chunk)
+{
+  size_t i;
+  int32_t x;
+  const visible_sprite *vs;
+  const int32_t chunk_start = chunk * SPRITE_CHUNK_WIDTH;
+  const int32_t chunk_end = M_MIN(this->buffer_size.x, chunk_start + SPRITE_CHUNK_WIDTH);
+
+  for (i = 0; i < info->view->sprites.count; ++i) {
+    vs = &info->view->sprites.list[i];
+
+    if (vs->x_end <= chunk_start || vs->x_start >= chunk_end) {
+      continue;
+    }
+
+    for (x = M_MAX(vs->x_start, chunk_start); x < M_MIN(vs->x_end, chunk_end); ++x) {
+      /* Column is fully covered by something nearer */
+      if (vs->depth >= info->column_depth[x]) {
+        continue;
+      }
+
+      draw_sprite_column(this, info, vs, x);
+    }
+  }
+}
@@ -0,0 +1,7 @@
+#include "sprite.h"
+#include "level_data.h"
+
+void sprite_set_position(sprite *this, vec3f position) {
+  this->entity.z = position.z;
+  entity_set_position(&this->entity, VEC2F(position.x, position.y));
+}
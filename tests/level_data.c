@@ -4,9 +4,20 @@
 #include "level_data.h"
 #include "map_cache.h"
 #include <time.h>
+#include <stddef.h>
+#include <string.h>
 
 static level_data*
-create_level();
+create_level(float cell_size);
+
+static vec2f
+grid_vertex(int x, int y, int size);
+
+static bool
+segment_touches_box(vec2f, vec2f, vec2f, vec2f);
+
+static level_data*
+load_patched(const char*, const uint8_t*, size_t, size_t, const void*, size_t);
 
 TEST_GROUP(level_data);
 
@@ -19,7 +30,7 @@ TEST_TEAR_DOWN(level_data) {}
 
 TEST(level_data, intersect_3d)
 {
-  level_data *level = create_level();
+  level_data *level = create_level(0.f);
 
   map_cache_intersect_3d(
     &level->cache,
@@ -34,20 +45,584 @@ TEST(level_data, intersect_3d)
   );
 }
 
+TEST(level_data, map_cache_covers_linedefs)
+{
+  register size_t i, k;
+  int32_t x, y;
+  level_data *level = create_level(0.f);
+  const map_cache *cache = &level->cache;
+  const linedef *line;
+  vec2f v0, v1, p0;
+  bool found;
+
+  /* Every cell a linedef touches must list it */
+  for (i = 0; i < level->linedefs_count; ++i) {
+    line = &level->linedefs[i];
+    v0 = vec2f_sub(line->v0->point, cache->origin);
+    v1 = vec2f_sub(line->v1->point, cache->origin);
+
+    for (y = 0; y < cache->h; ++y) {
+      for (x = 0; x < cache->w; ++x) {
+        p0 = VEC2F(x * cache->cell_size, y * cache->cell_size);
+
+        if (!segment_touches_box(v0, v1, p0, VEC2F(p0.x + cache->cell_size, p0.y + cache->cell_size))) {
+          continue;
+        }
+
+        for (k = cache->cell_offsets[y * cache->w + x], found = false; k < cache->cell_offsets[y * cache->w + x + 1] && !found; ++k) {
+          found = cache->cell_linedefs[k] == i;
+        }
+
+        TEST_ASSERT_TRUE(found);
+      }
+    }
+  }
+
+  level_data_free(level);
+}
+
+TEST(level_data, intersect_3d_matches_brute_force)
+{
+  register int i;
+  register size_t k;
+  level_data *level = create_level(0.f);
+  const map_cache_line *line;
+  vec3f start, end;
+  vec2f dir;
+  float det, z;
+  bool expected;
+
+  for (i = 0; i < 20000; ++i) {
+    /* Halfway through, move some floors and ceilings */
+    if (i == 10000) {
+      for (k = 0; k < level->sectors_count; k += 7) {
+        level->sectors[k].floor.height = rand() % 512;
+        level->sectors[k].ceiling.height = 512 + rand() % 512;
+        sector_update_floor_ceiling_limits(&level->sectors[k]);
+      }
+    }
+
+    start = VEC3F(rand() % 3800 + 0.5f, rand() % 3800 + 0.25f, rand() % 1024);
+    end = VEC3F(rand() % 3800 + 0.75f, rand() % 3800 + 0.5f, rand() % 1024);
+    dir = VEC2F(end.x - start.x, end.y - start.y);
+
+    for (k = 0, expected = false; k < level->linedefs_count && !expected; ++k) {
+      line = &level->cache.lines[k];
+
+      if (math_find_line_intersection_cached(VEC2F(start.x, start.y), line->v0, dir, line->direction, NULL, &det, NULL) && det > MATHS_EPSILON) {
+        z = start.z + (end.z - start.z) * det;
+        expected = line->solid || z < line->max_floor_height || z > line->min_ceiling_height;
+      }
+    }
+
+    TEST_ASSERT_EQUAL(expected, map_cache_intersect_3d(&level->cache, start, end));
+  }
+
+  level_data_free(level);
+}
+
+TEST(level_data, sector_visibility_matches_rays)
+{
+  register int i;
+  level_data *level = create_level(0.f);
+  const sector *a, *b;
+  vec3f start, end;
+
+  /* Whatever a clear ray connects must be in the visible set */
+  for (i = 0; i < 20000; ++i) {
+    start = VEC3F(rand() % 3800 + 0.5f, rand() % 3800 + 0.25f, 200);
+    end = VEC3F(rand() % 3800 + 0.75f, rand() % 3800 + 0.5f, 200);
+    a = level_data_find_sector(level, VEC2F(start.x, start.y));
+    b = level_data_find_sector(level, VEC2F(end.x, end.y));
+
+    if (a && b && !map_cache_intersect_3d(&level->cache, start, end)) {
+      TEST_ASSERT_TRUE(level_data_sectors_visible(level, a, b));
+    }
+  }
+
+  level_data_free(level);
+}
+
+TEST(level_data, map_cache_lines_follow_heights)
+{
+  register size_t i;
+  level_data *level = create_level(0.f);
+  sector *sect = &level->sectors[40];
+  const linedef *line;
+
+  sect->floor.height = 512;
+  sect->ceiling.height = 640;
+  sector_update_floor_ceiling_limits(sect);
+
+  for (i = 0; i < sect->linedefs_count; ++i) {
+    line = sect->linedefs[i];
+    TEST_ASSERT_EQUAL_PTR(&level->cache.lines[line - level->linedefs], line->cache_line);
+    TEST_ASSERT_EQUAL_FLOAT(line->max_floor_height, line->cache_line->max_floor_height);
+    TEST_ASSERT_EQUAL_FLOAT(line->min_ceiling_height, line->cache_line->min_ceiling_height);
+    TEST_ASSERT_EQUAL(!line->side[1].sector, line->cache_line->solid);
+  }
+
+  level_data_free(level);
+}
+
+TEST(level_data, find_sector)
+{
+  register int i;
+  register size_t j;
+  level_data *level = create_level(0.f);
+  sector *expected;
+  vec2f point;
+
+  for (i = 0; i < 5000; ++i) {
+    point = VEC2F(-200 + (rand() % 4400) + 0.5f, -200 + (rand() % 4400) + 0.25f);
+
+    for (j = 0, expected = NULL; j < level->sectors_count; ++j) {
+      if (sector_point_inside(&level->sectors[j], point)) {
+        expected = &level->sectors[j];
+        break;
+      }
+    }
+
+    TEST_ASSERT_EQUAL_PTR(expected, level_data_find_sector(level, point));
+  }
+
+  level_data_free(level);
+}
+
+TEST(level_data, find_linedef)
+{
+  register size_t i;
+  level_data *level = create_level(0.f);
+  const vec2f a = grid_vertex(3, 4, 128), b = grid_vertex(4, 4, 128);
+  linedef *line = level_data_find_linedef(level, a, b), *expected = NULL;
+
+  for (i = 0; i < level->linedefs_count; ++i) {
+    if ((VEC2F_EQUAL(level->linedefs[i].v0->point, a) && VEC2F_EQUAL(level->linedefs[i].v1->point, b)) ||
+        (VEC2F_EQUAL(level->linedefs[i].v0->point, b) && VEC2F_EQUAL(level->linedefs[i].v1->point, a))) {
+      expected = &level->linedefs[i];
+    }
+  }
+
+  TEST_ASSERT_NOT_NULL(line);
+  TEST_ASSERT_EQUAL_PTR(expected, line);
+  TEST_ASSERT_EQUAL_PTR(line, level_data_find_linedef(level, b, a));
+  TEST_ASSERT_NULL(level_data_find_linedef(level, a, grid_vertex(4, 5, 128)));
+  TEST_ASSERT_NULL(level_data_find_linedef(level, a, VEC2F(-5000, -5000)));
+
+  for (i = 0; i < level->linedefs_count; ++i) {
+    TEST_ASSERT_EQUAL_PTR(&level->linedefs[i], level_data_find_linedef(level, level->linedefs[i].v0->point, level->linedefs[i].v1->point));
+  }
+
+  level_data_free(level);
+}
+
+TEST(level_data, entity_sector_tracking)
+{
+  register int i;
+  level_data *level = create_level(0.f);
+  entity ent = { .position = VEC2F(1000, 1000), .type = ENTITY_SPRITE };
+  vec2f step;
+
+  level_data_add_entity(level, &ent);
+
+  TEST_ASSERT_EQUAL(1, level->entities_count);
+  TEST_ASSERT_EQUAL_PTR(level_data_find_sector(level, ent.position), ent.sector);
+
+  for (i = 0; i < 2000; ++i) {
+    step = VEC2F((rand() % 2001 - 1000) * 0.25f, (rand() % 2001 - 1000) * 0.25f);
+    entity_set_position(&ent, VEC2F(
+      math_clamp(ent.position.x + step.x, 100.f, 3700.f),
+      math_clamp(ent.position.y + step.y, 100.f, 3700.f)
+    ));
+    TEST_ASSERT_EQUAL_PTR(level_data_find_sector(level, ent.position), ent.sector);
+  }
+
+  level_data_remove_entity(level, &ent);
+
+  TEST_ASSERT_EQUAL(0, level->entities_count);
+  TEST_ASSERT_NULL(ent.cell);
+
+  level_data_free(level);
+}
+
+TEST(level_data, vertex_welding)
+{
+  register size_t i;
+  level_data scratch = { 0 };
+  vertex *v;
+
+  /* Pairs under a unit apart, in buckets next to each other on x, y, the diagonal and around 0 */
+  const vec2f welded[][2] = {
+    { VEC2F(9.75f, 5.5f), VEC2F(10.25f, 5.5f) },
+    { VEC2F(5.5f, 19.75f), VEC2F(5.5f, 20.25f) },
+    { VEC2F(29.8f, 29.8f), VEC2F(30.3f, 30.3f) },
+    { VEC2F(40.3f, 39.8f), VEC2F(39.8f, 40.3f) },
+    { VEC2F(-0.25f, -0.25f), VEC2F(0.25f, 0.25f) }
+  };
+
+  /* Pairs a unit or more apart, in buckets next to each other */
+  const vec2f distinct[][2] = {
+    { VEC2F(50.5f, 5.5f), VEC2F(51.5f, 5.5f) },
+    { VEC2F(5.5f, 60.5f), VEC2F(5.5f, 61.5f) },
+    { VEC2F(70.5f, 70.5f), VEC2F(71.25f, 71.25f) },
+    { VEC2F(80.f, 81.f), VEC2F(81.f, 80.f) }
+  };
+
+  const size_t welded_count = sizeof(welded) / sizeof(welded[0]),
+               distinct_count = sizeof(distinct) / sizeof(distinct[0]);
+
+  level_data_init_scratch(&scratch, 32, 1);
+
+  for (i = 0; i < welded_count; ++i) {
+    v = level_data_get_vertex(&scratch, welded[i][0]);
+    TEST_ASSERT_EQUAL_PTR(v, level_data_get_vertex(&scratch, welded[i][1]));
+    TEST_ASSERT_TRUE(VEC2F_EQUAL(welded[i][0], v->point));
+  }
+
+  for (i = 0; i < distinct_count; ++i) {
+    v = level_data_get_vertex(&scratch, distinct[i][0]);
+    TEST_ASSERT_TRUE(v != level_data_get_vertex(&scratch, distinct[i][1]));
+  }
+
+  TEST_ASSERT_EQUAL(welded_count + 2 * distinct_count, scratch.vertices_count);
+
+  level_data_free(level_data_pack(&scratch));
+}
+
+TEST(level_data, runtime_pools)
+{
+  register int i;
+  level_data *level = create_level(0.f);
+  sprite *first = level_data_add_sprite(level, VEC3F(500, 500, 0), 32, 32, TEXTURE_NONE);
+  light *lite = level_data_add_light(level, VEC3F(700, 700, 64), 128, 1.f);
+
+  for (i = 1; i < 5000; ++i) {
+    level_data_add_sprite(level, VEC3F(100 + (i % 60) * 60, 100 + (i / 60) * 40, 0), 32, 32, TEXTURE_NONE);
+  }
+
+  TEST_ASSERT_EQUAL(5000, level->sprites_count);
+  TEST_ASSERT_EQUAL(5001, level->entities_count);
+  TEST_ASSERT_EQUAL_PTR(first, level_data_sprite_at(level, 0));
+  TEST_ASSERT_EQUAL_PTR(lite, level_data_light_at(level, 0));
+  TEST_ASSERT_EQUAL_PTR(level_data_find_sector(level, VEC2F(500, 500)), first->entity.sector);
+  TEST_ASSERT_EQUAL_PTR(level_data_find_sector(level, VEC2F(700, 700)), lite->entity.sector);
+
+  for (i = 0; i < 5000; ++i) {
+    TEST_ASSERT_EQUAL_PTR(level, level_data_sprite_at(level, i)->entity.level);
+  }
+
+  level_data_free(level);
+}
+TEST(level_data, light_lists)
+{
+  register int i, k;
+  int n, total, *counts;
+  level_data *level = create_level(0.f);
+  const light_pool *pool = &level->cache.light_pool;
+  const map_cache_cell *cell = map_cache_cell_at(&level->cache, VEC2F(1000, 1000));
+  light *moved = NULL, **lights;
+
+  for (i = 0; i < 200; ++i) {
+    moved = level_data_add_light(level, VEC3F(1000 + (i % 20) - 10, 1000 + (i / 20) - 10, 64), 64, 0.1f + (rand() % 90) * 0.01f);
+  }
+
+  /* Every light is kept, strongest first */
+  TEST_ASSERT_EQUAL(200, cell->lights.count);
+  lights = light_list_lights(&cell->lights, pool);
+  for (i = 1; i < cell->lights.count; ++i) {
+    TEST_ASSERT_TRUE(lights[i-1]->strength >= lights[i]->strength);
+  }
+
+  light_set_position(moved, VEC3F(3000, 3000, 64));
+
+  TEST_ASSERT_EQUAL(199, cell->lights.count);
+  lights = light_list_lights(&cell->lights, pool);
+  for (i = 0; i < cell->lights.count; ++i) {
+    TEST_ASSERT_TRUE(lights[i] != moved);
+  }
+
+  cell = map_cache_cell_at(&level->cache, VEC2F(3000, 3000));
+  TEST_ASSERT_EQUAL(1, cell->lights.count);
+  TEST_ASSERT_EQUAL_PTR(moved, light_list_lights(&cell->lights, pool)[0]);
+
+  /* Moved across the level and back, only nearby segments are revisited */
+  light_set_position(moved, VEC3F(1500, 1200, 64));
+  light_set_position(moved, VEC3F(2990, 3000, 64));
+
+  /* A full rebuild ends up with the same lists */
+  for (i = 0, n = 0; i < level->linedefs_count; ++i) {
+    n += 2 * level->linedefs[i].segments;
+  }
+
+  counts = malloc(n * sizeof(int));
+
+  for (i = 0, n = 0, total = 0; i < level->linedefs_count; ++i) {
+    for (k = 0; k < level->linedefs[i].segments; ++k, n += 2) {
+      counts[n] = level->linedefs[i].side[0].segments[k].lights.count;
+      counts[n+1] = level->linedefs[i].side[1].segments ? level->linedefs[i].side[1].segments[k].lights.count : 0;
+      total += counts[n] + counts[n+1];
+    }
+  }
+
+  TEST_ASSERT_TRUE(total > 0);
+  level_data_update_lights(level);
+
+  for (i = 0, n = 0; i < level->linedefs_count; ++i) {
+    for (k = 0; k < level->linedefs[i].segments; ++k, n += 2) {
+      TEST_ASSERT_EQUAL(counts[n], level->linedefs[i].side[0].segments[k].lights.count);
+      TEST_ASSERT_EQUAL(counts[n+1], level->linedefs[i].side[1].segments ? level->linedefs[i].side[1].segments[k].lights.count : 0);
+    }
+  }
+
+  free(counts);
+
+  level_data_free(level);
+}
+
+TEST(level_data, map_cache_cell_size)
+{
+  register size_t i, k, n;
+  const float sizes[] = { 0.f, 50.f, 300.f };
+  level_data *level;
+  const map_cache *cache;
+  const map_cache_cell *cell;
+  const linedef *line;
+  bool found;
+
+  for (i = 0; i < 3; ++i) {
+    level = create_level(sizes[i]);
+    cache = &level->cache;
+
+    if (sizes[i] > 0.f) {
+      TEST_ASSERT_EQUAL_FLOAT(sizes[i], cache->cell_size);
+    } else {
+      TEST_ASSERT_TRUE(cache->cell_size >= MAP_CACHE_MIN_CELL_SIZE && cache->cell_size <= MAP_CACHE_MAX_CELL_SIZE);
+    }
+
+    TEST_ASSERT_EQUAL((uint16_t)ceilf((level->max.x - level->min.x) / cache->cell_size), cache->w);
+    TEST_ASSERT_EQUAL((uint16_t)ceilf((level->max.y - level->min.y) / cache->cell_size), cache->h);
+
+    /* The cell under the middle of a linedef must list it */
+    for (k = 0; k < level->linedefs_count; ++k) {
+      line = &level->linedefs[k];
+      cell = map_cache_cell_at(cache, vec2f_mul(vec2f_add(line->v0->point, line->v1->point), 0.5f));
+      TEST_ASSERT_NOT_NULL(cell);
+
+      for (n = cache->cell_offsets[cell - cache->cells], found = false; n < cache->cell_offsets[cell - cache->cells + 1] && !found; ++n) {
+        found = cache->cell_linedefs[n] == k;
+      }
+
+      TEST_ASSERT_TRUE(found);
+    }
+
+    level_data_free(level);
+  }
+}
+
+TEST(level_data, map_cache_cell_size_fits_grid)
+{
+  register size_t i;
+  const float sizes[] = { 0.f, 1.f };
+  map_builder builder;
+  level_data *level;
+  const map_cache *cache;
+  const map_cache_cell *cell;
+
+  /* Far too long for 16-bit cell counts, with either size */
+  for (i = 0; i < 2; ++i) {
+    builder = (map_builder) { .cell_size = sizes[i] };
+    map_builder_add_polygon(&builder, 0, 128, 1.f, WALLTEX(1), 2, 3, VERTICES(
+      VEC2F(0, 0), VEC2F(2000000, 0), VEC2F(2000000, 16), VEC2F(0, 16)
+    ));
+
+    level = map_builder_build(&builder);
+    map_builder_free(&builder);
+    cache = &level->cache;
+
+    TEST_ASSERT_TRUE(ceilf((level->max.x - level->min.x) / cache->cell_size) <= UINT16_MAX);
+    TEST_ASSERT_EQUAL((uint16_t)ceilf((level->max.x - level->min.x) / cache->cell_size), cache->w);
+
+    /* The far end still lands in the last column */
+    cell = map_cache_cell_at(cache, VEC2F(1999999, 8));
+    TEST_ASSERT_NOT_NULL(cell);
+    TEST_ASSERT_EQUAL(cache->w - 1, (cell - cache->cells) % cache->w);
+
+    level_data_free(level);
+  }
+
+  /* An explicit size below the minimum is raised to it */
+  builder = (map_builder) { .cell_size = 1.f };
+  map_builder_add_polygon(&builder, 0, 128, 1.f, WALLTEX(1), 2, 3, VERTICES(
+    VEC2F(0, 0), VEC2F(100, 0), VEC2F(100, 100), VEC2F(0, 100)
+  ));
+
+  level = map_builder_build(&builder);
+  map_builder_free(&builder);
+
+  TEST_ASSERT_EQUAL_FLOAT(MAP_CACHE_MIN_CELL_SIZE, level->cache.cell_size);
+  TEST_ASSERT_EQUAL((uint16_t)ceilf(100.f / MAP_CACHE_MIN_CELL_SIZE), level->cache.w);
+
+  level_data_free(level);
+}
+
+TEST(level_data, save_and_load)
+{
+  register size_t i, k;
+  const char *path = "level_data_test.rcl";
+  level_data *level = create_level(0.f), *loaded;
+  vec3f start, end;
+  vec2f point;
+
+  level_data_add_light(level, VEC3F(700, 700, 64), 300, 1.f);
+  level_data_add_sprite(level, VEC3F(500, 500, 0), 32, 64, 3);
+  level->sky_texture = 5;
+
+  TEST_ASSERT_TRUE(level_data_save(level, path));
+  loaded = level_data_load(path);
+  remove(path);
+
+  TEST_ASSERT_NOT_NULL(loaded);
+  TEST_ASSERT_EQUAL(level->vertices_count, loaded->vertices_count);
+  TEST_ASSERT_EQUAL(level->linedefs_count, loaded->linedefs_count);
+  TEST_ASSERT_EQUAL(level->sectors_count, loaded->sectors_count);
+  TEST_ASSERT_EQUAL(1, loaded->lights_count);
+  TEST_ASSERT_EQUAL(1, loaded->sprites_count);
+  TEST_ASSERT_EQUAL(5, loaded->sky_texture);
+  TEST_ASSERT_EQUAL_MEMORY(level->vertices, loaded->vertices, level->vertices_count * sizeof(vertex));
+  TEST_ASSERT_EQUAL_MEMORY(level->cache.cell_linedefs, loaded->cache.cell_linedefs, level->cache.cell_offsets[level->cache.w * level->cache.h] * sizeof(uint32_t));
+
+  /* Pointers lead to the same elements of the loaded level */
+  for (i = 0; i < level->linedefs_count; ++i) {
+    TEST_ASSERT_EQUAL(level->linedefs[i].v0 - level->vertices, loaded->linedefs[i].v0 - loaded->vertices);
+    TEST_ASSERT_EQUAL(level->linedefs[i].v1 - level->vertices, loaded->linedefs[i].v1 - loaded->vertices);
+    TEST_ASSERT_EQUAL_PTR(&loaded->cache, loaded->linedefs[i].cache);
+    TEST_ASSERT_EQUAL_PTR(&loaded->cache.lines[i], loaded->linedefs[i].cache_line);
+
+    for (k = 0; k < level->linedefs[i].segments; ++k) {
+      TEST_ASSERT_EQUAL(level->linedefs[i].side[0].segments[k].lights.count, loaded->linedefs[i].side[0].segments[k].lights.count);
+    }
+  }
+
+  for (i = 0; i < level->sectors_count; ++i) {
+    for (k = 0; k < level->sectors[i].linedefs_count; ++k) {
+      TEST_ASSERT_EQUAL(level->sectors[i].linedefs[k] - level->linedefs, loaded->sectors[i].linedefs[k] - loaded->linedefs);
+    }
+  }
+
+  for (i = 0; i < 2000; ++i) {
+    point = VEC2F(rand() % 3800 + 0.5f, rand() % 3800 + 0.5f);
+    TEST_ASSERT_EQUAL(level_data_find_sector(level, point) - level->sectors, level_data_find_sector(loaded, point) - loaded->sectors);
+
+    start = VEC3F(rand() % 3800 + 0.5f, rand() % 3800 + 0.25f, rand() % 1024);
+    end = VEC3F(rand() % 3800 + 0.75f, rand() % 3800 + 0.5f, rand() % 1024);
+    TEST_ASSERT_EQUAL(map_cache_intersect_3d(&level->cache, start, end), map_cache_intersect_3d(&loaded->cache, start, end));
+  }
+
+  /* The loaded level still changes like a built one */
+  TEST_ASSERT_NOT_NULL(level_data_get_vertex(loaded, level->vertices[0].point));
+  TEST_ASSERT_EQUAL_PTR(&loaded->linedefs[0], level_data_find_linedef(loaded, loaded->linedefs[0].v0->point, loaded->linedefs[0].v1->point));
+  loaded->sectors[0].floor.height = 64;
+  sector_update_floor_ceiling_limits(&loaded->sectors[0]);
+
+  level_data_free(loaded);
+  level_data_free(level);
+
+  TEST_ASSERT_NULL(level_data_load(path));
+}
+
+TEST(level_data, load_rejects_corrupt_level)
+{
+  const char *path = "level_data_bad.rcl";
+  level_data *level = create_level(0.f), *loaded;
+  const level_data *saved;
+  uint8_t *file_data;
+  size_t file_size, arena_size, linedefs, cell_offsets, cell_linedefs, cells_count;
+  uint64_t value;
+  uint32_t index, offsets[3];
+  uint16_t cells_w = UINT16_MAX;
+  FILE *file;
+
+  TEST_ASSERT_TRUE(level_data_save(level, path));
+  level_data_free(level);
+
+  file = fopen(path, "rb");
+  TEST_ASSERT_NOT_NULL(file);
+  fseek(file, 0, SEEK_END);
+  file_size = (size_t)ftell(file);
+  fseek(file, 0, SEEK_SET);
+  file_data = malloc(file_size);
+  TEST_ASSERT_EQUAL(1, fread(file_data, file_size, 1, file));
+  fclose(file);
+
+  /* No lights or sprites, so the level runs to the end of the file */
+  arena_size = file_size - LEVEL_FILE_HEADER_SIZE;
+  memcpy(&linedefs, file_data + LEVEL_FILE_HEADER_SIZE + offsetof(level_data, linedefs), sizeof(linedefs));
+
+  loaded = load_patched(path, file_data, file_size, 0, &value, 0);
+  TEST_ASSERT_NOT_NULL(loaded);
+  level_data_free(loaded);
+
+  value = arena_size;
+  TEST_ASSERT_NULL(load_patched(path, file_data, file_size, offsetof(level_data, sectors), &value, sizeof(void*)));
+
+  value = arena_size / sizeof(sector);
+  TEST_ASSERT_NULL(load_patched(path, file_data, file_size, offsetof(level_data, sectors_count), &value, sizeof(size_t)));
+
+  value = arena_size / sizeof(linedef);
+  TEST_ASSERT_NULL(load_patched(path, file_data, file_size, offsetof(level_data, linedefs_count), &value, sizeof(size_t)));
+
+  TEST_ASSERT_NULL(load_patched(path, file_data, file_size, offsetof(level_data, cache.w), &cells_w, sizeof(cells_w)));
+
+  value = arena_size + 64;
+  TEST_ASSERT_NULL(load_patched(path, file_data, file_size, linedefs + offsetof(linedef, v0), &value, sizeof(void*)));
+
+  /* Offsets and indices that stay within the file but not within their arrays */
+  saved = (const level_data*)(file_data + LEVEL_FILE_HEADER_SIZE);
+  cells_count = saved->cache.w * saved->cache.h;
+  cell_offsets = (uintptr_t)saved->cache.cell_offsets;
+  cell_linedefs = (uintptr_t)saved->cache.cell_linedefs;
+  memcpy(offsets, file_data + LEVEL_FILE_HEADER_SIZE + cell_offsets, sizeof(offsets));
+  TEST_ASSERT_GREATER_THAN(1, cells_count);
+  TEST_ASSERT_GREATER_THAN(0, offsets[2]);
+
+  index = saved->linedefs_count;
+  TEST_ASSERT_NULL(load_patched(path, file_data, file_size, cell_linedefs, &index, sizeof(index)));
+
+  index = offsets[2] + 1;
+  TEST_ASSERT_NULL(load_patched(path, file_data, file_size, cell_offsets + sizeof(uint32_t), &index, sizeof(index)));
+
+  remove(path);
+  free(file_data);
+}
+
 TEST_GROUP_RUNNER(level_data)
 {
   RUN_TEST_CASE(level_data, intersect_3d);
+  RUN_TEST_CASE(level_data, map_cache_covers_linedefs);
+  RUN_TEST_CASE(level_data, intersect_3d_matches_brute_force);
+  RUN_TEST_CASE(level_data, sector_visibility_matches_rays);
+  RUN_TEST_CASE(level_data, map_cache_lines_follow_heights);
+  RUN_TEST_CASE(level_data, find_sector);
+  RUN_TEST_CASE(level_data, find_linedef);
+  RUN_TEST_CASE(level_data, entity_sector_tracking);
+  RUN_TEST_CASE(level_data, vertex_welding);
+  RUN_TEST_CASE(level_data, runtime_pools);
+  RUN_TEST_CASE(level_data, light_lists);
+  RUN_TEST_CASE(level_data, map_cache_cell_size);
+  RUN_TEST_CASE(level_data, map_cache_cell_size_fits_grid);
+  RUN_TEST_CASE(level_data, save_and_load);
+  RUN_TEST_CASE(level_data, load_rejects_corrupt_level);
 }
 
 static level_data*
-create_level()
+create_level(float cell_size)
 {
   const int w = 32;
   const int h = 32;
   const int size = 128;
   register int x, y, c, f;
 
-  map_builder builder = { 0 };
+  map_builder builder = { .cell_size = cell_size };
 
   for (y = 0; y < h; ++y) {
     for (x = 0; x < w; ++x) {
@@ -59,22 +634,78 @@ create_level()
       }
 
       map_builder_add_polygon(&builder, f, c, 1.f, WALLTEX(TEXTURE_NONE), TEXTURE_NONE, TEXTURE_NONE, VERTICES(
-        VEC2F(-100+x*size, -100+y*size),
-        VEC2F(-100+x*size + size, -100+y*size),
-        VEC2F(-100+x*size + size, -100+y*size + size),
-        VEC2F(-100+x*size, -100+y*size + size)
+        grid_vertex(x, y, size),
+        grid_vertex(x + 1, y, size),
+        grid_vertex(x + 1, y + 1, size),
+        grid_vertex(x, y + 1, size)
       ));
     }
   }
 
   level_data *level = map_builder_build(&builder);
-
-  for (x = 0; x < level->vertices_count; ++x) {
-    level->vertices[x].point.x += (-24 + rand() % 48);
-    level->vertices[x].point.y += (-24 + rand() % 48);
-  }
   
   map_builder_free(&builder);
 
   return level;
 }
+
+/* Grid corner with a jitter derived from its coordinates, so neighbours agree */
+static vec2f
+grid_vertex(int x, int y, int size)
+{
+  const uint32_t hash = ((uint32_t)x * 73856093u) ^ ((uint32_t)y * 19349663u);
+
+  return VEC2F(
+    -100 + x*size + (int)(hash % 48) - 24,
+    -100 + y*size + (int)((hash >> 8) % 48) - 24
+  );
+}
+
+/* Loads the file after writing 'size' bytes of 'value' at 'offset' into its level */
+static level_data*
+load_patched(const char *path, const uint8_t *file_data, size_t file_size, size_t offset, const void *value, size_t size)
+{
+  uint8_t *patched = malloc(file_size);
+  FILE *file = fopen(path, "wb");
+
+  memcpy(patched, file_data, file_size);
+  memcpy(patched + LEVEL_FILE_HEADER_SIZE + offset, value, size);
+  TEST_ASSERT_NOT_NULL(file);
+  TEST_ASSERT_EQUAL(1, fwrite(patched, file_size, 1, file));
+  fclose(file);
+  free(patched);
+
+  return level_data_load(path);
+}
+
+/*
+ * Clips the segment to the box one slab at a time (Liang-Barsky), so it
+ * checks the map cache without sharing any of its code
+ */
+static bool
+segment_touches_box(vec2f v0, vec2f v1, vec2f min, vec2f max)
+{
+  register int i;
+  const float d[2] = { v1.x - v0.x, v1.y - v0.y },
+              start[2] = { v0.x, v0.y },
+              lo[2] = { min.x, min.y },
+              hi[2] = { max.x, max.y };
+  float t0 = 0.f, t1 = 1.f, ta, tb;
+
+  for (i = 0; i < 2; ++i) {
+    if (d[i] == 0.f) {
+      if (start[i] < lo[i] || start[i] > hi[i]) {
+        return false;
+      }
+
+      continue;
+    }
+
+    ta = (lo[i] - start[i]) / d[i];
+    tb = (hi[i] - start[i]) / d[i];
+    t0 = fmaxf(t0, fminf(ta, tb));
+    t1 = fminf(t1, fmaxf(ta, tb));
+  }
+
+  return t0 <= t1;
+}
@@ -9,6 +9,7 @@ static void run_all_tests(void)
   RUN_TEST_GROUP(sector);
   RUN_TEST_GROUP(map_builder);
   RUN_TEST_GROUP(level_data);
+  RUN_TEST_GROUP(renderer);
 }
 
 int main(int argc, const char *argv[])
@@ -2,6 +2,15 @@
 #include "fixture.h"
 #include "map_builder.h"
 #include "level_data.h"
+#include "map_reader.h"
+#include "polygon_grid.h"
+#include <stdio.h>
+
+static level_data*
+read_map_text(const char*, map_reader_error*);
+
+static bool
+list_contains(const uint32_t*, size_t, uint32_t);
 
 TEST_GROUP(map_builder);
 
@@ -45,7 +54,7 @@ TEST(map_builder, convex_polygon)
   TEST_ASSERT_TRUE(sector_point_inside(&level->sectors[0], VEC2F(50, 75)));
   TEST_ASSERT_FALSE(sector_point_inside(&level->sectors[0], VEC2F(-10, -10)));
 
-  free(level);
+  level_data_free(level);
   map_builder_free(&builder);
 }
 
@@ -83,7 +92,7 @@ TEST(map_builder, concave_polygon)
   TEST_ASSERT_FALSE(sector_point_inside(&level->sectors[0], VEC2F(50, 75)));
   TEST_ASSERT_TRUE(sector_point_inside(&level->sectors[0], VEC2F(10, 10)));
 
-  free(level);
+  level_data_free(level);
   map_builder_free(&builder);
 }
 
@@ -122,7 +131,7 @@ TEST(map_builder, neighbouring_sectors)
   TEST_ASSERT_EQUAL_PTR(&level->sectors[1], level->sectors[1].linedefs[0]->side[1].sector);
   TEST_ASSERT_EQUAL_PTR(level->sectors[0].linedefs[2], level->sectors[1].linedefs[0]);
 
-  free(level);
+  level_data_free(level);
   map_builder_free(&builder);
 }
 
@@ -164,7 +173,7 @@ TEST(map_builder, fully_contained_sector)
   TEST_ASSERT_FALSE(sector_point_inside(&level->sectors[0], VEC2F(50, 50)));
   TEST_ASSERT_TRUE(sector_point_inside(&level->sectors[1], VEC2F(50, 50)));
 
-  free(level);
+  level_data_free(level);
   map_builder_free(&builder);
 }
 
@@ -234,7 +243,7 @@ TEST(map_builder, fully_contained_sector_sharing_linedef)
   TEST_ASSERT_EQUAL_PTR(&level->sectors[1], level->sectors[0].linedefs[1]->side[1].sector);
   TEST_ASSERT_EQUAL_PTR(&level->sectors[1], level->sectors[0].linedefs[2]->side[1].sector);
 
-  free(level);
+  level_data_free(level);
   map_builder_free(&builder);
 }
 
@@ -284,7 +293,7 @@ TEST(map_builder, intersecting_sectors)
 
   TEST_ASSERT_FALSE(sector_connects_vertices(&level->sectors[0], &level->vertices[3], &level->vertices[1]));
 
-  free(level);
+  level_data_free(level);
   map_builder_free(&builder);
 }
 
@@ -311,7 +320,7 @@ TEST(map_builder, polygon_splitting)
 
   TEST_ASSERT_EQUAL_INT(3, level->sectors_count);
 
-  free(level);
+  level_data_free(level);
   map_builder_free(&builder);
 }
 
@@ -331,10 +340,265 @@ TEST(map_builder, optimize_polygon)
 
   TEST_ASSERT_EQUAL_INT(4, level->vertices_count);
 
-  free(level);
+  level_data_free(level);
+  map_builder_free(&builder);
+}
+
+TEST(map_builder, sector_visibility)
+{
+  size_t i;
+  map_builder builder = { 0 };
+
+  /* Room, corridor going east, corridor turning north, room at the end */
+  map_builder_add_polygon(&builder, 0, 128, 1, WALLTEX(TEXTURE_NONE), TEXTURE_NONE, TEXTURE_NONE, VERTICES(
+    VEC2F(0, 0), VEC2F(100, 0), VEC2F(100, 100), VEC2F(0, 100)
+  ));
+  map_builder_add_polygon(&builder, 0, 128, 1, WALLTEX(TEXTURE_NONE), TEXTURE_NONE, TEXTURE_NONE, VERTICES(
+    VEC2F(100, 40), VEC2F(200, 40), VEC2F(200, 60), VEC2F(100, 60)
+  ));
+  map_builder_add_polygon(&builder, 0, 128, 1, WALLTEX(TEXTURE_NONE), TEXTURE_NONE, TEXTURE_NONE, VERTICES(
+    VEC2F(180, 60), VEC2F(200, 60), VEC2F(200, 300), VEC2F(180, 300)
+  ));
+  map_builder_add_polygon(&builder, 0, 128, 1, WALLTEX(TEXTURE_NONE), TEXTURE_NONE, TEXTURE_NONE, VERTICES(
+    VEC2F(150, 300), VEC2F(300, 300), VEC2F(300, 400), VEC2F(150, 400)
+  ));
+
+  level_data *level = map_builder_build(&builder);
+  const sector *room = level_data_find_sector(level, VEC2F(50, 50));
+  const sector *east = level_data_find_sector(level, VEC2F(150, 50));
+  const sector *north = level_data_find_sector(level, VEC2F(190, 200));
+  const sector *end = level_data_find_sector(level, VEC2F(250, 350));
+
+  TEST_ASSERT_NOT_NULL(level->sector_visibility);
+  TEST_ASSERT_TRUE(level_data_sectors_visible(level, room, room));
+  TEST_ASSERT_TRUE(level_data_sectors_visible(level, room, east));
+  TEST_ASSERT_TRUE(level_data_sectors_visible(level, room, north));
+  TEST_ASSERT_TRUE(level_data_sectors_visible(level, east, end));
+  TEST_ASSERT_FALSE(level_data_sectors_visible(level, room, end));
+  TEST_ASSERT_FALSE(level_data_sectors_visible(level, end, room));
+
+  /* The far end of the east corridor is in view from the room, the end room's back wall isn't */
+  size_t lines_count = 0;
+  const uint32_t *lines = level_data_visible_linedefs(level, room, &lines_count);
+  const size_t corridor_end = level_data_find_linedef(level, VEC2F(200, 40), VEC2F(200, 60)) - level->linedefs;
+  const size_t back_wall = level_data_find_linedef(level, VEC2F(300, 400), VEC2F(150, 400)) - level->linedefs;
+
+  TEST_ASSERT_NOT_NULL(lines);
+  TEST_ASSERT_TRUE(list_contains(lines, lines_count, corridor_end));
+  TEST_ASSERT_FALSE(list_contains(lines, lines_count, back_wall));
+
+  /* Lists are sorted so the renderer walks them in level order */
+  for (i = 1; i < lines_count; ++i) {
+    TEST_ASSERT_LESS_THAN_UINT32(lines[i], lines[i - 1]);
+  }
+
+  level_data_free(level);
+  map_builder_free(&builder);
+}
+
+TEST(map_builder, pieces_are_clipped_by_later_polygons)
+{
+  map_builder builder = { 0 };
+
+  map_builder_add_polygon(&builder, 0, 128, 1, WALLTEX(TEXTURE_NONE), TEXTURE_NONE, TEXTURE_NONE, VERTICES(
+    VEC2F(0, 0), VEC2F(500, 0), VEC2F(500, 100), VEC2F(0, 100)
+  ));
+
+  /* Splits the first one in two */
+  map_builder_add_polygon(&builder, 16, 112, 1, WALLTEX(TEXTURE_NONE), TEXTURE_NONE, TEXTURE_NONE, VERTICES(
+    VEC2F(225, -250), VEC2F(325, -250), VEC2F(325, 250), VEC2F(225, 250)
+  ));
+
+  /* Cuts into the right piece */
+  map_builder_add_polygon(&builder, 32, 96, 1, WALLTEX(TEXTURE_NONE), TEXTURE_NONE, TEXTURE_NONE, VERTICES(
+    VEC2F(450, 25), VEC2F(550, 25), VEC2F(550, 75), VEC2F(450, 75)
+  ));
+
+  level_data *level = map_builder_build(&builder);
+
+  TEST_ASSERT_EQUAL_INT(4, level->sectors_count);
+  TEST_ASSERT_EQUAL_INT(0, level_data_find_sector(level, VEC2F(100, 50))->floor.height);
+  TEST_ASSERT_EQUAL_INT(0, level_data_find_sector(level, VEC2F(400, 50))->floor.height);
+  TEST_ASSERT_EQUAL_INT(16, level_data_find_sector(level, VEC2F(275, 50))->floor.height);
+  TEST_ASSERT_EQUAL_INT(32, level_data_find_sector(level, VEC2F(475, 50))->floor.height);
+
+  level_data_free(level);
   map_builder_free(&builder);
 }
 
+TEST(map_builder, partly_shared_edge_is_split)
+{
+  map_builder builder = { 0 };
+
+  map_builder_add_polygon(&builder, 0, 100, 1, WALLTEX(TEXTURE_NONE), TEXTURE_NONE, TEXTURE_NONE, VERTICES(
+    VEC2F(0, 0), VEC2F(0, 100), VEC2F(100, 100), VEC2F(100, 0)
+  ));
+
+  /* Touches the middle of the first one's right edge */
+  map_builder_add_polygon(&builder, 10, 90, 1, WALLTEX(TEXTURE_NONE), TEXTURE_NONE, TEXTURE_NONE, VERTICES(
+    VEC2F(100, 25), VEC2F(100, 75), VEC2F(200, 75), VEC2F(200, 25)
+  ));
+
+  level_data *level = map_builder_build(&builder);
+
+  TEST_ASSERT_EQUAL_INT(6, builder.polygons[0].vertices_count);
+  TEST_ASSERT_EQUAL_INT(4, builder.polygons[1].vertices_count);
+  TEST_ASSERT_EQUAL(8, level->vertices_count);
+  TEST_ASSERT_EQUAL(9, level->linedefs_count);
+  TEST_ASSERT_NOT_NULL(level_data_find_linedef(level, VEC2F(100, 25), VEC2F(100, 75)));
+  TEST_ASSERT_EQUAL_PTR(level_data_find_sector(level, VEC2F(150, 50)), level_data_find_linedef(level, VEC2F(100, 25), VEC2F(100, 75))->side[1].sector);
+
+  level_data_free(level);
+  map_builder_free(&builder);
+}
+
+TEST(map_builder, edge_grid_query)
+{
+  register size_t i;
+  map_builder builder = { 0 };
+  polygon_grid grid;
+  const polygon_grid_ref *refs;
+  size_t count;
+  bool found[2] = { false, false };
+
+  map_builder_add_polygon(&builder, 0, 100, 1, WALLTEX(TEXTURE_NONE), TEXTURE_NONE, TEXTURE_NONE, VERTICES(
+    VEC2F(0, 0), VEC2F(0, 100), VEC2F(100, 100), VEC2F(100, 0)
+  ));
+
+  map_builder_add_polygon(&builder, 0, 100, 1, WALLTEX(TEXTURE_NONE), TEXTURE_NONE, TEXTURE_NONE, VERTICES(
+    VEC2F(100, 0), VEC2F(100, 100), VEC2F(200, 100), VEC2F(200, 0)
+  ));
+
+  polygon_grid_build_edges(&grid, &builder);
+
+  /* Both polygons have an edge through the point */
+  refs = polygon_grid_query(&grid, VEC2F(100, 50), &count);
+
+  for (i = 0; i < count; ++i) {
+    found[refs[i].polygon] = true;
+
+    if (i > 0) {
+      TEST_ASSERT_TRUE(refs[i].polygon > refs[i - 1].polygon || (refs[i].polygon == refs[i - 1].polygon && refs[i].edge > refs[i - 1].edge));
+    }
+  }
+
+  TEST_ASSERT_TRUE(found[0]);
+  TEST_ASSERT_TRUE(found[1]);
+
+  polygon_grid_query(&grid, VEC2F(1000, 1000), &count);
+  TEST_ASSERT_EQUAL(0, count);
+
+  polygon_grid_free(&grid);
+  map_builder_free(&builder);
+}
+
+TEST(map_builder, nested_sectors_back_onto_innermost)
+{
+  register size_t i;
+  map_builder builder = { 0 };
+
+  map_builder_add_polygon(&builder, 0, 100, 1, WALLTEX(TEXTURE_NONE), TEXTURE_NONE, TEXTURE_NONE, VERTICES(
+    VEC2F(0, 0), VEC2F(0, 300), VEC2F(300, 300), VEC2F(300, 0)
+  ));
+
+  map_builder_add_polygon(&builder, 10, 90, 1, WALLTEX(TEXTURE_NONE), TEXTURE_NONE, TEXTURE_NONE, VERTICES(
+    VEC2F(50, 50), VEC2F(50, 250), VEC2F(250, 250), VEC2F(250, 50)
+  ));
+
+  map_builder_add_polygon(&builder, 20, 80, 1, WALLTEX(TEXTURE_NONE), TEXTURE_NONE, TEXTURE_NONE, VERTICES(
+    VEC2F(100, 100), VEC2F(100, 200), VEC2F(200, 200), VEC2F(200, 100)
+  ));
+
+  level_data *level = map_builder_build(&builder);
+
+  TEST_ASSERT_EQUAL(3, level->sectors_count);
+  TEST_ASSERT_EQUAL(8, level->sectors[0].linedefs_count);
+  TEST_ASSERT_EQUAL(8, level->sectors[1].linedefs_count);
+
+  for (i = 0; i < level->sectors[2].linedefs_count; ++i) {
+    TEST_ASSERT_EQUAL_PTR(&level->sectors[1], level->sectors[2].linedefs[i]->side[1].sector);
+  }
+
+  level_data_free(level);
+  map_builder_free(&builder);
+}
+
+TEST(map_builder, read_map)
+{
+  map_reader_error error;
+  level_data *level = read_map_text(
+    "# Same as intersecting_sectors, with extras\n"
+    "sky 5\n"
+    "polygon 0 100 1 none none none none none\n"
+    "  0 0  0 100  100 100  100 0\n"
+    "polygon 10 90 1 1 2 3 4 5 50 25 150 25 150 75 50 75 # trailing comment\n"
+    "middle_texture 0 0 0 100 7\n"
+    "light 25 50 50 100 0.5\n"
+    "sprite 75 50 10 32 64 6\n",
+    &error
+  );
+
+  TEST_ASSERT_NULL(error.message);
+  TEST_ASSERT_NOT_NULL(level);
+  TEST_ASSERT_EQUAL(10, level->vertices_count);
+  TEST_ASSERT_EQUAL(2, level->sectors_count);
+  TEST_ASSERT_EQUAL(10, level->sectors[1].floor.height);
+  TEST_ASSERT_EQUAL(4, level->sectors[1].floor.texture);
+  TEST_ASSERT_EQUAL(5, level->sky_texture);
+  TEST_ASSERT_EQUAL(7, level_data_find_linedef(level, VEC2F(0, 0), VEC2F(0, 100))->side[0].texture[LINE_TEXTURE_MIDDLE]);
+  TEST_ASSERT_EQUAL(1, level->lights_count);
+  TEST_ASSERT_EQUAL(1, level->sprites_count);
+  TEST_ASSERT_EQUAL(6, level_data_sprite_at(level, 0)->texture);
+  TEST_ASSERT_EQUAL_PTR(&level->sectors[1], level_data_sprite_at(level, 0)->entity.sector);
+
+  level_data_free(level);
+}
+
+TEST(map_builder, read_map_errors)
+{
+  map_reader_error error;
+
+  TEST_ASSERT_NULL(read_map_text("polygon 0 100 1 none none none none none\n  0 0  0 100\n", &error));
+  TEST_ASSERT_EQUAL_STRING("Polygon needs at least 3 vertices", error.message);
+  TEST_ASSERT_EQUAL(1, error.line);
+
+  TEST_ASSERT_NULL(read_map_text("sky 5\n\n# Comment\nlight 0 0 x 100 1\n", &error));
+  TEST_ASSERT_EQUAL_STRING("Expected a number", error.message);
+  TEST_ASSERT_EQUAL(4, error.line);
+
+  TEST_ASSERT_NULL(read_map_text("polygon 0 100 1 none none none none none 0 0 0 100 100 100\nsector 1\n", &error));
+  TEST_ASSERT_EQUAL_STRING("Unknown statement", error.message);
+  TEST_ASSERT_EQUAL(2, error.line);
+
+  TEST_ASSERT_NULL(read_map_text("polygon 0 100 1 none none none none none 0 0 0 100 100 100\nmiddle_texture 5 5 6 6 1\n", &error));
+  TEST_ASSERT_EQUAL(2, error.line);
+
+  TEST_ASSERT_NULL(read_map_text("# Heights\npolygon 0 100.5 1 none none none none none 0 0 0 100 100 100\n", &error));
+  TEST_ASSERT_EQUAL_STRING("Expected an integer", error.message);
+  TEST_ASSERT_EQUAL(2, error.line);
+
+  TEST_ASSERT_NULL(read_map_text("polygon 0 99999999 1 none none none none none 0 0 0 100 100 100\n", &error));
+  TEST_ASSERT_EQUAL_STRING("Value out of range", error.message);
+  TEST_ASSERT_EQUAL(1, error.line);
+
+  TEST_ASSERT_NULL(read_map_text("polygon 0 100 1\n  1 2 3\n  4 1e1 0 0 0 100 100 100\n", &error));
+  TEST_ASSERT_EQUAL_STRING("Expected an integer", error.message);
+  TEST_ASSERT_EQUAL(3, error.line);
+
+  TEST_ASSERT_NULL(read_map_text("sky -2\n", &error));
+  TEST_ASSERT_EQUAL_STRING("Value out of range", error.message);
+  TEST_ASSERT_EQUAL(1, error.line);
+
+  TEST_ASSERT_NULL(read_map_text("sky 4294967296\n", &error));
+  TEST_ASSERT_EQUAL_STRING("Value out of range", error.message);
+
+  TEST_ASSERT_NULL(read_map_text("light 0 0 nan 100 1\n", &error));
+  TEST_ASSERT_EQUAL_STRING("Expected a number", error.message);
+
+  TEST_ASSERT_NULL(read_map_text("# Nothing\n", &error));
+  TEST_ASSERT_EQUAL_STRING("No polygons", error.message);
+}
+
 TEST_GROUP_RUNNER(map_builder)
 {
   RUN_TEST_CASE(map_builder, convex_polygon);
@@ -345,4 +609,40 @@ TEST_GROUP_RUNNER(map_builder)
   RUN_TEST_CASE(map_builder, intersecting_sectors);
   RUN_TEST_CASE(map_builder, polygon_splitting);
   RUN_TEST_CASE(map_builder, optimize_polygon);
+  RUN_TEST_CASE(map_builder, sector_visibility);
+  RUN_TEST_CASE(map_builder, pieces_are_clipped_by_later_polygons);
+  RUN_TEST_CASE(map_builder, partly_shared_edge_is_split);
+  RUN_TEST_CASE(map_builder, edge_grid_query);
+  RUN_TEST_CASE(map_builder, nested_sectors_back_onto_innermost);
+  RUN_TEST_CASE(map_builder, read_map);
+  RUN_TEST_CASE(map_builder, read_map_errors);
+}
+
+static level_data*
+read_map_text(const char *text, map_reader_error *error)
+{
+  level_data *level;
+  FILE *file = tmpfile();
+
+  fputs(text, file);
+  rewind(file);
+  level = map_reader_read(file, error);
+  fclose(file);
+
+  return level;
+}
+
+/* Linear search, the lists in these levels are short */
+static bool
+list_contains(const uint32_t *list, size_t count, uint32_t value)
+{
+  size_t i;
+
+  for (i = 0; i < count; ++i) {
+    if (list[i] == value) {
+      return true;
+    }
+  }
+
+  return false;
 }
@@ -202,6 +202,55 @@ TEST(polygon, contains_polygon)
   TEST_ASSERT_FALSE(polygon_contains_polygon(&poly1, &poly0, true));
 }
 
+TEST(polygon, cached_bounds)
+{
+  vec2f *vertices = (vec2f*)malloc(3*sizeof(vec2f));
+  vertices[0] = VEC2F(0, 0);
+  vertices[1] = VEC2F(100, 0);
+  vertices[2] = VEC2F(100, 100);
+
+  polygon poly = {
+    .vertices_count = 3,
+    .vertices = vertices
+  };
+
+  polygon far_away = {
+    .vertices_count = 3,
+    .vertices = (vec2f[]) {
+      VEC2F(300, 300),
+      VEC2F(400, 300),
+      VEC2F(400, 400)
+    }
+  };
+
+  polygon_update_bounds(&poly);
+
+  TEST_ASSERT_TRUE(poly.bounds_valid);
+  TEST_ASSERT_EQUAL_VEC2F(VEC2F(0, 0), poly.bounds_min);
+  TEST_ASSERT_EQUAL_VEC2F(VEC2F(100, 100), poly.bounds_max);
+  TEST_ASSERT_FALSE(polygon_is_point_inside(&poly, VEC2F(150, 50), true));
+  TEST_ASSERT_FALSE(polygon_overlaps_polygon(&poly, &far_away));
+  TEST_ASSERT_FALSE(polygon_contains_polygon(&poly, &far_away, true));
+
+  /* Changing the vertices clears the bounds, so the new ones still count */
+  polygon_insert_point(&poly, VEC2F(200, 50), VEC2F(100, 0), VEC2F(100, 100));
+
+  TEST_ASSERT_FALSE(poly.bounds_valid);
+  TEST_ASSERT_TRUE(polygon_is_point_inside(&poly, VEC2F(150, 50), true));
+
+  polygon_update_bounds(&poly);
+
+  TEST_ASSERT_EQUAL_VEC2F(VEC2F(200, 100), poly.bounds_max);
+  TEST_ASSERT_TRUE(polygon_is_point_inside(&poly, VEC2F(150, 50), true));
+
+  polygon_remove_point(&poly, VEC2F(200, 50));
+
+  TEST_ASSERT_FALSE(poly.bounds_valid);
+  TEST_ASSERT_FALSE(polygon_is_point_inside(&poly, VEC2F(150, 50), true));
+
+  free(poly.vertices);
+}
+
 TEST_GROUP_RUNNER(polygon)
 {
   RUN_TEST_CASE(polygon, vertices_contains_point);
@@ -211,4 +260,5 @@ TEST_GROUP_RUNNER(polygon)
   RUN_TEST_CASE(polygon, overlaps_polygon);
   RUN_TEST_CASE(polygon, signed_area);
   RUN_TEST_CASE(polygon, contains_polygon);
+  RUN_TEST_CASE(polygon, cached_bounds);
 }
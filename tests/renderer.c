@@ -0,0 +1,681 @@
+#include "unity.h"
+#include "fixture.h"
+#include "map_builder.h"
+#include "level_data.h"
+#include "renderer.h"
+#include "camera.h"
+#include "texture.h"
+#include "sprite.h"
+#include "light.h"
+#include "map_cache.h"
+#include "levels.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define VIEWS_COUNT 24
+/* Drawn in a colour the debug sampler never gives */
+#define SPRITE_TEXTURE 99
+
+/*
+ * Golden images are frames of the demo levels drawn with the debug texture
+ * sampler by a build with the default options. Set RAYCASTER_UPDATE_GOLDEN
+ * to write new ones instead of comparing against them.
+ */
+#ifndef RAYCASTER_GOLDEN_DIR
+  #define RAYCASTER_GOLDEN_DIR "tests/golden"
+#endif
+
+#if defined(RAYCASTER_PRERENDER_VISCHECK) && defined(RAYCASTER_DYNAMIC_SHADOWS) && (!defined RAYCASTER_LIGHT_STEPS || (RAYCASTER_LIGHT_STEPS == 0))
+  #define GOLDEN_BUILD_OPTIONS
+#endif
+
+#define GOLDEN_WIDTH 96
+#define GOLDEN_HEIGHT 72
+#define GOLDEN_VIEWS_COUNT 2
+/* How far a channel may be off (SIMD lighting rounds differently), and the share of pixels allowed past that */
+#define GOLDEN_CHANNEL_TOLERANCE 2
+#define GOLDEN_MAX_BAD_PIXELS 0.001f
+/* Best of a few draws per view, in milliseconds. RAYCASTER_VIEW_BUDGET_MS overrides it, 0 turns it off */
+#define GOLDEN_VIEW_BUDGET_MS 25.0
+#define GOLDEN_DRAWS 3
+
+static level_data*
+create_level(void);
+
+static void
+sprite_texture_sampler(texture_ref, float, float, texture_coordinates_func, uint8_t, uint8_t*, uint8_t*);
+
+static bool
+sprite_changes_frame(level_data*, vec3f, depth_type*);
+
+static level_data*
+create_lit_room(void);
+
+static bool
+list_has_light(struct light**, size_t, const light*);
+
+static void
+check_golden_views(int);
+
+static bool
+read_ppm(const char*, uint8_t*, int32_t, int32_t);
+
+static bool
+write_ppm(const char*, const pixel_type*, int32_t, int32_t);
+
+static double
+now_ms(void);
+
+TEST_GROUP(renderer);
+
+TEST_SETUP(renderer)
+{
+  texture_sampler = debug_texture_sampler;
+}
+
+TEST_TEAR_DOWN(renderer) {}
+
+/*  ┌────────────┐
+    │ TEST CASES │
+    └────────────┘ */
+
+TEST(renderer, batch_matches_single_views)
+{
+  register size_t i;
+  const vec2i size = VEC2I(64, 48);
+  level_data *level = create_level();
+  camera cameras[VIEWS_COUNT], *batch[VIEWS_COUNT];
+  renderer single, batched;
+  renderer_view view;
+
+  renderer_init(&single, size);
+  renderer_init(&batched, size);
+  renderer_view_init(&view);
+
+  for (i = 0; i < VIEWS_COUNT; ++i) {
+    camera_init(&cameras[i], level);
+    camera_rotate(&cameras[i], i * 0.6f);
+    camera_move(&cameras[i], (i % 4) * 40.f);
+    batch[i] = &cameras[i];
+  }
+
+  /* Twice, so the second batch reuses the views and frames of the first */
+  renderer_draw_batch(&batched, batch, VIEWS_COUNT / 2);
+  renderer_draw_batch(&batched, batch, VIEWS_COUNT);
+
+  TEST_ASSERT_EQUAL(VIEWS_COUNT, batched.frames_count);
+
+  for (i = 0; i < VIEWS_COUNT; ++i) {
+    renderer_draw(&single, &view, &cameras[i]);
+    TEST_ASSERT_EQUAL_MEMORY(single.buffer, renderer_frame(&batched, i), size.x * size.y * sizeof(pixel_type));
+  }
+
+  renderer_view_destroy(&view);
+  renderer_destroy(&single);
+  renderer_destroy(&batched);
+  level_data_free(level);
+}
+
+TEST(renderer, depth_from_distance)
+{
+  float distance;
+  depth_type depth, previous = 0;
+
+  for (distance = 0.f; distance < RENDERER_DRAW_DISTANCE * 1.5f; distance += 7.5f) {
+    depth = renderer_depth_from_distance(distance);
+    TEST_ASSERT_TRUE(depth >= previous);
+    previous = depth;
+  }
+
+  TEST_ASSERT_EQUAL(0, renderer_depth_from_distance(0.f));
+  TEST_ASSERT_TRUE(renderer_depth_from_distance(RENDERER_DRAW_DISTANCE * 0.5f) < RENDERER_DEPTH_MAX);
+  TEST_ASSERT_EQUAL(RENDERER_DEPTH_MAX, renderer_depth_from_distance(RENDERER_DRAW_DISTANCE));
+  TEST_ASSERT_EQUAL(RENDERER_DEPTH_MAX, renderer_depth_from_distance(RENDERER_DRAW_DISTANCE * 2.f));
+}
+
+TEST(renderer, sky_and_far_pixels_keep_max_depth)
+{
+  register int32_t y;
+  const vec2i size = VEC2I(64, 48);
+  map_builder builder = { 0 };
+  level_data *level;
+  renderer rend;
+  renderer_view view;
+  camera cam;
+
+  /* Long corridor open to the sky, its far end further away than the draw distance */
+  map_builder_add_polygon(&builder, 0, 128, 1.f, WALLTEX(1), 2, TEXTURE_NONE, VERTICES(
+    VEC2F(0, 0), VEC2F(40000, 0), VEC2F(40000, 400), VEC2F(0, 400)
+  ));
+
+  level = map_builder_build(&builder);
+  map_builder_free(&builder);
+
+  camera_init(&cam, level);
+  entity_set_position(&cam.entity, VEC2F(100, 200));
+  renderer_init(&rend, size);
+  renderer_view_init(&view);
+  renderer_draw(&rend, &view, &cam);
+
+  /* Rays down the corridor hit nothing, the side walls have sky above and floor below */
+  for (y = 0; y < size.y; ++y) {
+    TEST_ASSERT_EQUAL(RENDERER_DEPTH_MAX, rend.depth[y * size.x + size.x / 2]);
+  }
+
+  TEST_ASSERT_EQUAL(RENDERER_DEPTH_MAX, rend.depth[0]);
+  TEST_ASSERT_TRUE(rend.depth[(size.y / 2) * size.x] < RENDERER_DEPTH_MAX);
+  TEST_ASSERT_TRUE(rend.depth[(size.y - 1) * size.x] < RENDERER_DEPTH_MAX);
+
+  renderer_view_destroy(&view);
+  renderer_destroy(&rend);
+  level_data_free(level);
+}
+
+TEST(renderer, sprites_sorted_back_to_front)
+{
+  register size_t i;
+  const size_t count = 50;
+  map_builder builder = { 0 };
+  level_data *level;
+  renderer rend;
+  renderer_view view;
+  camera cam;
+
+  map_builder_add_polygon(&builder, 0, 128, 1.f, WALLTEX(1), 2, 3, VERTICES(
+    VEC2F(0, 0), VEC2F(1000, 0), VEC2F(1000, 400), VEC2F(0, 400)
+  ));
+
+  level = map_builder_build(&builder);
+  map_builder_free(&builder);
+
+  /* Out of order, and far enough apart that depths differ in both bytes */
+  for (i = 0; i < count; ++i) {
+    level_data_add_sprite(level, VEC3F(150 + ((i * 37) % count) * 15, 150 + (i % 5) * 25, 0), 32, 64, SPRITE_TEXTURE);
+  }
+
+  camera_init(&cam, level);
+  entity_set_position(&cam.entity, VEC2F(100, 200));
+  renderer_init(&rend, VEC2I(64, 48));
+  renderer_view_init(&view);
+  renderer_draw(&rend, &view, &cam);
+
+  TEST_ASSERT_EQUAL(count, view.sprites.count);
+  TEST_ASSERT_TRUE((view.sprites.list[0].depth >> 8) > (view.sprites.list[count - 1].depth >> 8) + 1);
+
+  for (i = 1; i < view.sprites.count; ++i) {
+    TEST_ASSERT_TRUE(view.sprites.list[i].depth <= view.sprites.list[i - 1].depth);
+  }
+
+  renderer_view_destroy(&view);
+  renderer_destroy(&rend);
+  level_data_free(level);
+}
+
+TEST(renderer, sprite_behind_solid_column_is_skipped)
+{
+  map_builder builder = { 0 };
+  level_data *level;
+  depth_type column_depth;
+
+  /* Two rooms apart, the sprite in the one the camera can't see into */
+  map_builder_add_polygon(&builder, 0, 128, 1.f, WALLTEX(1), 2, 3, VERTICES(
+    VEC2F(0, 0), VEC2F(400, 0), VEC2F(400, 400), VEC2F(0, 400)
+  ));
+  map_builder_add_polygon(&builder, 0, 128, 1.f, WALLTEX(1), 2, 3, VERTICES(
+    VEC2F(500, 0), VEC2F(900, 0), VEC2F(900, 400), VEC2F(500, 400)
+  ));
+
+  level = map_builder_build(&builder);
+  map_builder_free(&builder);
+
+  TEST_ASSERT_FALSE(sprite_changes_frame(level, VEC3F(700, 200, 0), &column_depth));
+  TEST_ASSERT_TRUE(column_depth <= renderer_depth_from_distance(600.f));
+
+  level_data_free(level);
+}
+
+TEST(renderer, sprite_behind_gap_column_is_drawn)
+{
+  map_builder builder = { 0 };
+  level_data *level;
+  depth_type column_depth;
+
+  /* A step under open sky, with the sprite standing behind it */
+  map_builder_add_polygon(&builder, 0, 128, 1.f, WALLTEX(1), 2, TEXTURE_NONE, VERTICES(
+    VEC2F(0, 0), VEC2F(1000, 0), VEC2F(1000, 400), VEC2F(0, 400)
+  ));
+  map_builder_add_polygon(&builder, 32, 128, 1.f, WALLTEX(1), 2, TEXTURE_NONE, VERTICES(
+    VEC2F(300, 0), VEC2F(350, 0), VEC2F(350, 400), VEC2F(300, 400)
+  ));
+
+  level = map_builder_build(&builder);
+  map_builder_free(&builder);
+
+  TEST_ASSERT_TRUE(sprite_changes_frame(level, VEC3F(600, 200, 0), &column_depth));
+  TEST_ASSERT_EQUAL(RENDERER_DEPTH_MAX, column_depth);
+
+  level_data_free(level);
+}
+
+TEST(renderer, light_tiles_list_covering_lights)
+{
+  register size_t i, k;
+  register int32_t tx, ty;
+  level_data *level = create_lit_room();
+  renderer rend;
+  renderer_view view;
+  camera cam;
+  const visible_light *vl;
+  const light_tile *tile;
+  vec2f centre;
+  size_t covered;
+  bool overlaps, listed;
+
+  camera_init(&cam, level);
+  entity_set_position(&cam.entity, VEC2F(100, 1500));
+  renderer_init(&rend, VEC2I(64, 48));
+  renderer_view_init(&view);
+  renderer_draw(&rend, &view, &cam);
+
+  TEST_ASSERT_EQUAL(4, view.lights.tiles_w);
+  TEST_ASSERT_EQUAL(3, view.lights.tiles_h);
+  TEST_ASSERT_EQUAL(level->lights_count, view.lights.visible_count);
+
+  for (i = 0; i < view.lights.visible_count; ++i) {
+    vl = &view.lights.visible[i];
+
+    /* Bounds hold the light's own centre, facing +x it is at 1 - dy/dx across and z above the view */
+    centre = VEC2F(
+      32.f * (1.f - (vl->light->entity.position.y - 1500.f) / (vl->light->entity.position.x - 100.f)),
+      24.f + 32.f * (cam.entity.z - vl->light->entity.z) / (vl->light->entity.position.x - 100.f)
+    );
+
+    TEST_ASSERT_TRUE(centre.x >= vl->x_start && centre.x < vl->x_end);
+    TEST_ASSERT_TRUE(centre.y >= vl->y_start && centre.y < vl->y_end);
+
+    /* Listed in exactly the tiles the bounds overlap, the small ones in only some */
+    for (ty = 0, covered = 0; ty < view.lights.tiles_h; ++ty) {
+      for (tx = 0; tx < view.lights.tiles_w; ++tx) {
+        tile = &view.lights.tiles[ty * view.lights.tiles_w + tx];
+        overlaps = vl->x_start < (tx + 1) * LIGHT_TILE_SIZE && vl->x_end > tx * LIGHT_TILE_SIZE &&
+                   vl->y_start < (ty + 1) * LIGHT_TILE_SIZE && vl->y_end > ty * LIGHT_TILE_SIZE;
+        listed = list_has_light(view.lights.list + tile->offset, tile->count, vl->light);
+        TEST_ASSERT_EQUAL(overlaps, listed);
+        covered += listed;
+      }
+    }
+
+    if (vl->light->radius < 100.f) {
+      TEST_ASSERT_TRUE(covered > 0 && covered < (size_t)(view.lights.tiles_w * view.lights.tiles_h));
+    }
+  }
+
+  /* Strongest first in every tile */
+  for (i = 0; i < (size_t)(view.lights.tiles_w * view.lights.tiles_h); ++i) {
+    tile = &view.lights.tiles[i];
+
+    for (k = 1; k < tile->count; ++k) {
+      TEST_ASSERT_TRUE(view.lights.list[tile->offset + k]->strength <= view.lights.list[tile->offset + k - 1]->strength);
+    }
+  }
+
+  renderer_view_destroy(&view);
+  renderer_destroy(&rend);
+  level_data_free(level);
+}
+
+TEST(renderer, light_tiles_agree_with_cells)
+{
+  register size_t i;
+  register int32_t x, y;
+  const vec2i size = VEC2I(64, 48);
+  level_data *level = create_lit_room();
+  renderer rend;
+  renderer_view view;
+  camera cam;
+  const light_tile *tile;
+  const map_cache_cell *cell;
+  const light *lt;
+  float cam_x, planar_distance;
+  vec3f point;
+  size_t checked = 0;
+
+  camera_init(&cam, level);
+  entity_set_position(&cam.entity, VEC2F(100, 1500));
+  renderer_init(&rend, size);
+  renderer_view_init(&view);
+  renderer_draw(&rend, &view, &cam);
+
+  /*
+   * Rows this far below the horizon only see the floor. A light well within
+   * reach of a floor pixel has to be in both lists the pixel may pick from.
+   */
+  for (y = size.y / 2 + 3; y < size.y; ++y) {
+    for (x = 0; x < size.x; ++x) {
+      TEST_ASSERT_TRUE(rend.depth[y * size.x + x] < RENDERER_DEPTH_MAX);
+
+      cam_x = ((x << 1) / (float)size.x) - 1;
+      planar_distance = rend.depth[y * size.x + x] * (RENDERER_DRAW_DISTANCE / RENDERER_DEPTH_MAX);
+      point = VEC3F(
+        cam.entity.position.x + (cam.entity.direction.x + cam.plane.x * cam_x) * planar_distance,
+        cam.entity.position.y + (cam.entity.direction.y + cam.plane.y * cam_x) * planar_distance,
+        0
+      );
+
+      tile = &view.lights.tiles[(y / LIGHT_TILE_SIZE) * view.lights.tiles_w + x / LIGHT_TILE_SIZE];
+      cell = map_cache_cell_at(&level->cache, VEC2F(point.x, point.y));
+      TEST_ASSERT_NOT_NULL(cell);
+
+      for (i = 0; i < level->lights_count; ++i) {
+        lt = level_data_light_at(level, i);
+
+        if (math_vec3_distance_squared(VEC3F(lt->entity.position.x, lt->entity.position.y, lt->entity.z), point) >= lt->radius_sq * 0.9f) {
+          continue;
+        }
+
+        TEST_ASSERT_TRUE(list_has_light(view.lights.list + tile->offset, tile->count, lt));
+        TEST_ASSERT_TRUE(list_has_light(light_list_lights(&cell->lights, &level->cache.light_pool), cell->lights.count, lt));
+        checked++;
+      }
+    }
+  }
+
+  TEST_ASSERT_TRUE(checked > 0);
+
+  renderer_view_destroy(&view);
+  renderer_destroy(&rend);
+  level_data_free(level);
+}
+
+TEST(renderer, golden_grid_level) { check_golden_views(0); }
+TEST(renderer, golden_demo_level) { check_golden_views(1); }
+TEST(renderer, golden_big_one) { check_golden_views(2); }
+TEST(renderer, golden_semi_intersecting_sectors) { check_golden_views(3); }
+TEST(renderer, golden_crossing_and_splitting_sectors) { check_golden_views(4); }
+TEST(renderer, golden_large_sky) { check_golden_views(5); }
+
+TEST_GROUP_RUNNER(renderer)
+{
+  RUN_TEST_CASE(renderer, batch_matches_single_views);
+  RUN_TEST_CASE(renderer, depth_from_distance);
+  RUN_TEST_CASE(renderer, sky_and_far_pixels_keep_max_depth);
+  RUN_TEST_CASE(renderer, sprites_sorted_back_to_front);
+  RUN_TEST_CASE(renderer, sprite_behind_solid_column_is_skipped);
+  RUN_TEST_CASE(renderer, sprite_behind_gap_column_is_drawn);
+  RUN_TEST_CASE(renderer, light_tiles_list_covering_lights);
+  RUN_TEST_CASE(renderer, light_tiles_agree_with_cells);
+  RUN_TEST_CASE(renderer, golden_grid_level);
+  RUN_TEST_CASE(renderer, golden_demo_level);
+  RUN_TEST_CASE(renderer, golden_big_one);
+  RUN_TEST_CASE(renderer, golden_semi_intersecting_sectors);
+  RUN_TEST_CASE(renderer, golden_crossing_and_splitting_sectors);
+  RUN_TEST_CASE(renderer, golden_large_sky);
+}
+
+static level_data*
+create_level(void)
+{
+  map_builder builder = { 0 };
+
+  map_builder_add_polygon(&builder, 0, 144, 0.8f, WALLTEX(1), 2, 3, VERTICES(
+    VEC2F(0, 0), VEC2F(400, 0), VEC2F(400, 400), VEC2F(200, 300), VEC2F(0, 400)
+  ));
+  map_builder_add_polygon(&builder, -32, 176, 1.1f, WALLTEX(1), 2, TEXTURE_NONE, VERTICES(
+    VEC2F(50, 50), VEC2F(50, 200), VEC2F(200, 200), VEC2F(200, 50)
+  ));
+  map_builder_add_polygon(&builder, 128, 128, 1.f, WALLTEX(4), 4, 4, VERTICES(
+    VEC2F(100, 100), VEC2F(125, 100), VEC2F(125, 125), VEC2F(100, 125)
+  ));
+  map_builder_add_polygon(&builder, -128, 256, 0.25f, WALLTEX(1), 2, 3, VERTICES(
+    VEC2F(400, 400), VEC2F(200, 300), VEC2F(100, 1000), VEC2F(500, 1000)
+  ));
+
+  level_data *level = map_builder_build(&builder);
+
+  map_builder_free(&builder);
+
+  level_data_add_light(level, VEC3F(300, 400, 64), 300, 1.f);
+  level_data_add_light(level, VEC3F(100, 60, 100), 200, 0.8f);
+  level_data_add_sprite(level, VEC3F(250, 120, 0), 32, 64, 1);
+  level_data_add_sprite(level, VEC3F(300, 250, 0), 32, 64, 1);
+
+  return level;
+}
+
+/* Open room with lights of a few sizes and strengths in front of (100, 1500) */
+static level_data*
+create_lit_room(void)
+{
+  map_builder builder = { 0 };
+  level_data *level;
+
+  map_builder_add_polygon(&builder, 0, 512, 0.5f, WALLTEX(1), 2, 3, VERTICES(
+    VEC2F(0, 0), VEC2F(3000, 0), VEC2F(3000, 3000), VEC2F(0, 3000)
+  ));
+
+  level = map_builder_build(&builder);
+  map_builder_free(&builder);
+
+  level_data_add_light(level, VEC3F(600, 1700, 32), 60, 0.6f);
+  level_data_add_light(level, VEC3F(500, 1300, 40), 80, 1.f);
+  level_data_add_light(level, VEC3F(400, 1500, 48), 250, 0.3f);
+  level_data_add_light(level, VEC3F(900, 1450, 16), 300, 0.8f);
+
+  return level;
+}
+
+static bool
+list_has_light(struct light **lights, size_t count, const light *lt)
+{
+  register size_t i;
+
+  for (i = 0; i < count; ++i) {
+    if (lights[i] == lt) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+static void
+sprite_texture_sampler(
+  texture_ref texture,
+  float fx,
+  float fy,
+  texture_coordinates_func coords,
+  uint8_t mip_level,
+  uint8_t *pixel,
+  uint8_t *mask
+) {
+  debug_texture_sampler(texture, fx, fy, coords, mip_level, pixel, mask);
+
+  if (texture == SPRITE_TEXTURE && pixel) {
+    pixel[0] = 255;
+    pixel[1] = 0;
+    pixel[2] = 255;
+  }
+}
+
+/*
+ * Draws the level from (100, 200) facing +x, then again with a sprite
+ * added at 'position'. Gives whether the frame changed, and the depth
+ * behind which the column through the sprite's middle is covered.
+ */
+static bool
+sprite_changes_frame(level_data *level, vec3f position, depth_type *column_depth)
+{
+  const vec2i size = VEC2I(64, 48);
+  pixel_type *before = malloc(size.x * size.y * sizeof(pixel_type));
+  renderer rend;
+  renderer_view view;
+  camera cam;
+  bool changed;
+
+  texture_sampler = sprite_texture_sampler;
+  camera_init(&cam, level);
+  entity_set_position(&cam.entity, VEC2F(100, 200));
+  renderer_init(&rend, size);
+  renderer_view_init(&view);
+
+  renderer_draw(&rend, &view, &cam);
+  memcpy(before, rend.buffer, size.x * size.y * sizeof(pixel_type));
+
+  level_data_add_sprite(level, position, 32, 96, SPRITE_TEXTURE);
+  renderer_draw(&rend, &view, &cam);
+
+  /* The sprite is on screen either way, only what is in front of it differs */
+  TEST_ASSERT_EQUAL(1, view.sprites.count);
+  TEST_ASSERT_TRUE(view.sprites.list[0].x_start <= size.x / 2 && view.sprites.list[0].x_end > size.x / 2);
+
+  changed = memcmp(before, rend.buffer, size.x * size.y * sizeof(pixel_type)) != 0;
+  *column_depth = rend.column_depth[size.x / 2];
+
+  renderer_view_destroy(&view);
+  renderer_destroy(&rend);
+  free(before);
+
+  return changed;
+}
+
+/*
+ * Draws each view of demo level 'n' and compares it to its golden image,
+ * writing what was drawn next to the test binary when they differ
+ */
+static void
+check_golden_views(int n)
+{
+  register size_t i, k;
+  const char *budget_override = getenv("RAYCASTER_VIEW_BUDGET_MS");
+  const double budget = budget_override ? atof(budget_override) : GOLDEN_VIEW_BUDGET_MS;
+  const bool update = getenv("RAYCASTER_UPDATE_GOLDEN") != NULL;
+  char path[256], message[128];
+  static uint8_t golden[GOLDEN_WIDTH * GOLDEN_HEIGHT * 3];
+  level_data *level;
+  renderer rend;
+  renderer_view view;
+  camera cam;
+  int32_t view_index, diff, max_diff;
+  size_t bad_pixels;
+  double start, best;
+  pixel_type p;
+
+#ifndef GOLDEN_BUILD_OPTIONS
+  if (!update) {
+    TEST_IGNORE_MESSAGE("Golden images are drawn with the default build options");
+  }
+#endif
+
+  /* Some levels are randomized */
+  srand(1);
+  level = demo_levels_create(n, NULL, NULL);
+  camera_init(&cam, level);
+  renderer_init(&rend, VEC2I(GOLDEN_WIDTH, GOLDEN_HEIGHT));
+  renderer_view_init(&view);
+
+  for (view_index = 0; view_index < GOLDEN_VIEWS_COUNT; ++view_index) {
+    /* Second view looks back over the level, a little from above */
+    if (view_index == 1) {
+      camera_rotate(&cam, 2.3f);
+      cam.pitch = -0.2f;
+    }
+
+    for (k = 0, best = 0.0; k < GOLDEN_DRAWS; ++k) {
+      start = now_ms();
+      renderer_draw(&rend, &view, &cam);
+      best = k ? fmin(best, now_ms() - start) : now_ms() - start;
+    }
+
+    snprintf(path, sizeof(path), "%s/level%d_view%d.ppm", RAYCASTER_GOLDEN_DIR, n, view_index);
+
+    if (update) {
+      TEST_ASSERT_TRUE_MESSAGE(write_ppm(path, rend.buffer, GOLDEN_WIDTH, GOLDEN_HEIGHT), path);
+      continue;
+    }
+
+    snprintf(message, sizeof(message), "Golden image %s is missing", path);
+    TEST_ASSERT_TRUE_MESSAGE(read_ppm(path, golden, GOLDEN_WIDTH, GOLDEN_HEIGHT), message);
+
+    for (i = 0, bad_pixels = 0, max_diff = 0; i < GOLDEN_WIDTH * GOLDEN_HEIGHT; ++i) {
+      p = rend.buffer[i];
+      diff = M_MAX(abs((int32_t)((p >> 16) & 0xFF) - golden[i * 3]), M_MAX(
+             abs((int32_t)((p >> 8) & 0xFF) - golden[i * 3 + 1]),
+             abs((int32_t)(p & 0xFF) - golden[i * 3 + 2])));
+      max_diff = M_MAX(max_diff, diff);
+      bad_pixels += diff > GOLDEN_CHANNEL_TOLERANCE;
+    }
+
+    if (bad_pixels > GOLDEN_MAX_BAD_PIXELS * GOLDEN_WIDTH * GOLDEN_HEIGHT) {
+      snprintf(path, sizeof(path), "level%d_view%d.actual.ppm", n, view_index);
+      write_ppm(path, rend.buffer, GOLDEN_WIDTH, GOLDEN_HEIGHT);
+      snprintf(message, sizeof(message), "View %d: %u pixels off by up to %d, see %s", view_index, (unsigned)bad_pixels, max_diff, path);
+      TEST_FAIL_MESSAGE(message);
+    }
+
+    if (budget > 0.0 && best > budget) {
+      snprintf(message, sizeof(message), "View %d took %.2f ms, over the %.2f ms budget", view_index, best, budget);
+      TEST_FAIL_MESSAGE(message);
+    }
+  }
+
+  renderer_view_destroy(&view);
+  renderer_destroy(&rend);
+  level_data_free(level);
+}
+
+static bool
+read_ppm(const char *path, uint8_t *rgb, int32_t w, int32_t h)
+{
+  int32_t file_w, file_h, max_value;
+  FILE *file = fopen(path, "rb");
+  bool read;
+
+  if (!file) {
+    return false;
+  }
+
+  read = fscanf(file, "P6 %d %d %d", &file_w, &file_h, &max_value) == 3
+      && file_w == w && file_h == h && max_value == 255
+      && fgetc(file) != EOF
+      && fread(rgb, 3, w * h, file) == (size_t)(w * h);
+
+  fclose(file);
+
+  return read;
+}
+
+static bool
+write_ppm(const char *path, const pixel_type *pixels, int32_t w, int32_t h)
+{
+  register int32_t i;
+  FILE *file = fopen(path, "wb");
+
+  if (!file) {
+    return false;
+  }
+
+  fprintf(file, "P6\n%d %d\n255\n", w, h);
+
+  for (i = 0; i < w * h; ++i) {
+    fputc((pixels[i] >> 16) & 0xFF, file);
+    fputc((pixels[i] >> 8) & 0xFF, file);
+    fputc(pixels[i] & 0xFF, file);
+  }
+
+  return fclose(file) == 0;
+}
+
+static double
+now_ms(void)
+{
+#ifdef _WIN32
+  /* Wall time on Windows */
+  return clock() * 1000.0 / CLOCKS_PER_SEC;
+#else
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+#endif
+}